@@ -25,6 +25,9 @@
 #include <QUrl>
 #include <QFile>
 #include <QCoreApplication>
+#include <QStorageInfo>
+
+#include <algorithm>
 
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -548,6 +551,22 @@ bool FileSystem::isChildPathOf(const QString &child, const QString &parent)
         // clear trailing slashes etc
         || QString::compare(QDir::cleanPath(parent), QDir::cleanPath(child), sensitivity) == 0);
 }
+
+bool FileSystem::isOnNetworkFileSystem(const QString &path)
+{
+    if (path.startsWith(QLatin1String("//")) || path.startsWith(QLatin1String("\\\\")))
+        return true;
+
+    const QStorageInfo storage(path);
+    if (!storage.isValid())
+        return false;
+    const QByteArray fsType = storage.fileSystemType().toLower();
+    static const QByteArrayList networkFileSystems = {
+        "nfs", "cifs", "smb", "afpfs", "webdav", "davfs", "fuse.sshfs", "9p"
+    };
+    return std::any_of(networkFileSystems.cbegin(), networkFileSystems.cend(),
+        [&fsType](const QByteArray &networkFs) { return fsType.startsWith(networkFs); });
+}
 } // namespace OCC
 
 #include "moc_filesystembase.cpp"
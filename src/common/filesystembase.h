@@ -168,6 +168,11 @@ namespace FileSystem {
      * Returns whether a Path is a child of another
      */
     bool OCSYNC_EXPORT isChildPathOf(const QString &child, const QString &parent);
+
+    /**
+     * Returns whether the path is on a network file system, like NFS or SMB.
+     */
+    bool OCSYNC_EXPORT isOnNetworkFileSystem(const QString &path);
 }
 
 /** @} */
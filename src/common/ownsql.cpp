@@ -17,8 +17,11 @@
  */
 
 #include <QDateTime>
+#include <QElapsedTimer>
 #include <QLoggingCategory>
+#include <QMutex>
 #include <QString>
+#include <QVector>
 #include <QFile>
 #include <QFileInfo>
 #include <QDir>
@@ -28,6 +31,9 @@
 #include "common/asserts.h"
 #include <sqlite3.h>
 
+#include <algorithm>
+#include <atomic>
+
 #define SQLITE_SLEEP_TIME_USEC 100000
 #define SQLITE_REPEAT_COUNT 20
 
@@ -43,6 +49,99 @@ namespace OCC {
 
 Q_LOGGING_CATEGORY(lcSql, "sync.database.sql", QtInfoMsg)
 
+namespace {
+    struct ProfilerData
+    {
+        QMutex mutex;
+        QHash<QByteArray, SqlProfiler::Statistics> statistics;
+    };
+    Q_GLOBAL_STATIC(ProfilerData, profilerData)
+
+    std::atomic<bool> &profilerEnabled()
+    {
+        static std::atomic<bool> enabled(!qEnvironmentVariableIsEmpty("OWNCLOUD_SQL_PROFILE"));
+        return enabled;
+    }
+
+    std::atomic<qint64> &slowQueryThresholdNsecs()
+    {
+        static std::atomic<qint64> threshold([] {
+            bool ok = false;
+            const int msecs = qEnvironmentVariableIntValue("OWNCLOUD_SQL_SLOW_QUERY_MS", &ok);
+            return qint64(ok ? msecs : 100) * 1000 * 1000;
+        }());
+        return threshold;
+    }
+}
+
+bool SqlProfiler::isEnabled()
+{
+    return profilerEnabled().load(std::memory_order_relaxed);
+}
+
+void SqlProfiler::setEnabled(bool enabled)
+{
+    profilerEnabled() = enabled;
+}
+
+void SqlProfiler::setSlowQueryThreshold(std::chrono::milliseconds threshold)
+{
+    slowQueryThresholdNsecs() = std::chrono::nanoseconds(threshold).count();
+}
+
+QHash<QByteArray, SqlProfiler::Statistics> SqlProfiler::statistics()
+{
+    QMutexLocker locker(&profilerData->mutex);
+    return profilerData->statistics;
+}
+
+void SqlProfiler::reset()
+{
+    QMutexLocker locker(&profilerData->mutex);
+    profilerData->statistics.clear();
+}
+
+void SqlProfiler::dump()
+{
+    const auto statistics = SqlProfiler::statistics();
+    QVector<QPair<QByteArray, Statistics>> sorted;
+    sorted.reserve(statistics.size());
+    for (auto it = statistics.cbegin(); it != statistics.cend(); ++it)
+        sorted.append({ it.key(), it.value() });
+    std::sort(sorted.begin(), sorted.end(), [](const auto &a, const auto &b) {
+        return a.second.totalNsecs > b.second.totalNsecs;
+    });
+
+    qCInfo(lcSql) << "SQL profile of" << sorted.size() << "statements:";
+    for (const auto &it : qAsConst(sorted)) {
+        const auto &stats = it.second;
+        qCInfo(lcSql) << "calls:" << stats.calls << "prepares:" << stats.prepares << "rows:" << stats.rows
+                      << "total ms:" << stats.totalNsecs / 1000000 << "max ms:" << stats.maxNsecs / 1000000
+                      << it.first;
+    }
+}
+
+void SqlProfiler::recordPrepare(const QByteArray &sql)
+{
+    QMutexLocker locker(&profilerData->mutex);
+    ++profilerData->statistics[sql].prepares;
+}
+
+void SqlProfiler::recordExecution(const QByteArray &sql, qint64 nsecs, qint64 rows)
+{
+    {
+        QMutexLocker locker(&profilerData->mutex);
+        auto &stats = profilerData->statistics[sql];
+        ++stats.calls;
+        stats.rows += rows;
+        stats.totalNsecs += nsecs;
+        stats.maxNsecs = std::max(stats.maxNsecs, nsecs);
+    }
+    if (nsecs >= slowQueryThresholdNsecs().load(std::memory_order_relaxed)) {
+        qCWarning(lcSql) << "Slow query took" << nsecs / 1000000 << "ms for" << rows << "rows:" << sql;
+    }
+}
+
 SqlDatabase::SqlDatabase()
     : _db(nullptr)
     , _errId(0)
@@ -161,7 +260,7 @@ bool SqlDatabase::openOrCreateReadWrite(const QString &filename)
     return true;
 }
 
-bool SqlDatabase::openReadOnly(const QString &filename)
+bool SqlDatabase::openReadOnly(const QString &filename, bool checkConsistency)
 {
     if (isOpen()) {
         return true;
@@ -171,7 +270,7 @@ bool SqlDatabase::openReadOnly(const QString &filename)
         return false;
     }
 
-    if (checkDb() != CheckDbResult::Ok) {
+    if (checkConsistency && checkDb() != CheckDbResult::Ok) {
         qCWarning(lcSql) << "Consistency check failed in readonly mode, giving up" << filename;
         close();
         return false;
@@ -272,6 +371,8 @@ int SqlQuery::prepare(const QByteArray &sql, bool allow_failure)
         } else {
             OC_ASSERT(_stmt);
             _sqldb->_queries.insert(this);
+            if (SqlProfiler::isEnabled())
+                SqlProfiler::recordPrepare(_sql);
         }
     }
     return _errId;
@@ -305,6 +406,15 @@ bool SqlQuery::exec()
         return false;
     }
 
+    finishProfiledExecution();
+    QElapsedTimer timer;
+    if (SqlProfiler::isEnabled()) {
+        _profiling = true;
+        _profileNsecs = 0;
+        _profileRows = 0;
+        timer.start();
+    }
+
     // Don't do anything for selects, that is how we use the lib :-|
     if (!isSelect() && !isPragma()) {
         int rc, n = 0;
@@ -320,6 +430,10 @@ bool SqlQuery::exec()
             }
         } while ((n < SQLITE_REPEAT_COUNT) && ((rc == SQLITE_BUSY) || (rc == SQLITE_LOCKED)));
         _errId = rc;
+        if (_profiling) {
+            _profileNsecs += timer.nsecsElapsed();
+            finishProfiledExecution();
+        }
 
         if (_errId != SQLITE_DONE && _errId != SQLITE_ROW) {
             _error = QString::fromUtf8(sqlite3_errmsg(_db));
@@ -343,6 +457,10 @@ auto SqlQuery::next() -> NextResult
 {
     const bool firstStep = !sqlite3_stmt_busy(_stmt);
 
+    QElapsedTimer timer;
+    if (_profiling)
+        timer.start();
+
     int n = 0;
     forever {
         _errId = sqlite3_step(_stmt);
@@ -355,6 +473,14 @@ auto SqlQuery::next() -> NextResult
         }
     }
 
+    if (_profiling) {
+        _profileNsecs += timer.nsecsElapsed();
+        if (_errId == SQLITE_ROW)
+            ++_profileRows;
+        else
+            finishProfiledExecution();
+    }
+
     NextResult result;
     result.ok = _errId == SQLITE_ROW || _errId == SQLITE_DONE;
     result.hasData = _errId == SQLITE_ROW;
@@ -479,6 +605,7 @@ int SqlQuery::numRowsAffected()
 
 void SqlQuery::finish()
 {
+    finishProfiledExecution();
     if (!_stmt)
         return;
     SQLITE_DO(sqlite3_finalize(_stmt));
@@ -490,10 +617,19 @@ void SqlQuery::finish()
 
 void SqlQuery::reset_and_clear_bindings()
 {
+    finishProfiledExecution();
     if (_stmt) {
         SQLITE_DO(sqlite3_reset(_stmt));
         SQLITE_DO(sqlite3_clear_bindings(_stmt));
     }
 }
 
+void SqlQuery::finishProfiledExecution()
+{
+    if (!_profiling)
+        return;
+    _profiling = false;
+    SqlProfiler::recordExecution(_sql, _profileNsecs, _profileRows);
+}
+
 } // namespace OCC
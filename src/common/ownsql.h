@@ -23,6 +23,9 @@
 #include <QObject>
 #include <QVariant>
 #include <QSet>
+#include <QHash>
+
+#include <chrono>
 
 #include "ocsynclib.h"
 
@@ -34,6 +37,44 @@ OCSYNC_EXPORT Q_DECLARE_LOGGING_CATEGORY(lcSql)
 
 class SqlQuery;
 
+/**
+ * @brief Opt-in statistics about the executed SQL statements
+ *
+ * Set OWNCLOUD_SQL_PROFILE to enable it. An execution lasts from
+ * SqlQuery::exec() to the last row or the reset of the query. Executions
+ * taking longer than the slow query threshold are logged, it can be set
+ * with OWNCLOUD_SQL_SLOW_QUERY_MS and defaults to 100ms.
+ * @ingroup libsync
+ */
+class OCSYNC_EXPORT SqlProfiler
+{
+public:
+    struct Statistics
+    {
+        qint64 prepares = 0;
+        qint64 calls = 0;
+        qint64 rows = 0; // rows stepped through
+        qint64 totalNsecs = 0;
+        qint64 maxNsecs = 0;
+    };
+
+    static bool isEnabled();
+    static void setEnabled(bool enabled);
+    static void setSlowQueryThreshold(std::chrono::milliseconds threshold);
+
+    /// The statistics per SQL text since the last reset()
+    static QHash<QByteArray, Statistics> statistics();
+    static void reset();
+
+    /// Logs the statistics, the statements taking the most time first
+    static void dump();
+
+private:
+    friend class SqlQuery;
+    static void recordPrepare(const QByteArray &sql);
+    static void recordExecution(const QByteArray &sql, qint64 nsecs, qint64 rows);
+};
+
 /**
  * @brief The SqlDatabase class
  * @ingroup libsync
@@ -47,7 +88,8 @@ public:
 
     bool isOpen();
     bool openOrCreateReadWrite(const QString &filename);
-    bool openReadOnly(const QString &filename);
+    /// Skipping the consistency check is only for databases already checked by another connection
+    bool openReadOnly(const QString &filename, bool checkConsistency = true);
     bool transaction();
     bool commit();
     void close();
@@ -154,6 +196,8 @@ public:
 private:
     void bindValueInternal(int pos, const QVariant &value);
     void finish();
+    /// Hands the current execution to SqlProfiler, if there is one
+    void finishProfiledExecution();
 
     SqlDatabase *_sqldb = nullptr;
     sqlite3 *_db = nullptr;
@@ -162,6 +206,11 @@ private:
     int _errId;
     QByteArray _sql;
 
+    // The execution measured for SqlProfiler
+    bool _profiling = false;
+    qint64 _profileNsecs = 0;
+    qint64 _profileRows = 0;
+
     friend class SqlDatabase;
     friend class PreparedSqlQueryManager;
 };
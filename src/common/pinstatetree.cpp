@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) by ownCloud GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "common/pinstatetree.h"
+
+#include <vector>
+
+namespace OCC {
+
+// Calls f with each component of path, stops when f returns false
+template <typename F>
+static void forEachComponent(const QByteArray &path, F &&f)
+{
+    for (int start = 0; start < path.size();) {
+        int end = path.indexOf('/', start);
+        if (end == -1)
+            end = path.size();
+        if (!f(path.mid(start, end - start)))
+            return;
+        start = end + 1;
+    }
+}
+
+void PinStateTree::load(const QVector<QPair<QByteArray, PinState>> &states)
+{
+    clear();
+    for (const auto &it : states)
+        setForPath(it.first, it.second);
+    _loaded = true;
+}
+
+void PinStateTree::clear()
+{
+    _root.state = PinState::Inherited;
+    _root.children.clear();
+    _loaded = false;
+}
+
+const PinStateTree::Node *PinStateTree::find(const QByteArray &path) const
+{
+    const Node *node = &_root;
+    forEachComponent(path, [&](const QByteArray &name) {
+        const auto it = node->children.find(name);
+        node = it == node->children.end() ? nullptr : it->second.get();
+        return node != nullptr;
+    });
+    return node;
+}
+
+PinState PinStateTree::rawForPath(const QByteArray &path) const
+{
+    const auto node = find(path);
+    return node ? node->state : PinState::Inherited;
+}
+
+PinState PinStateTree::effectiveForPath(const QByteArray &path) const
+{
+    // If the root path has no setting, assume AlwaysLocal
+    PinState result = _root.state != PinState::Inherited ? _root.state : PinState::AlwaysLocal;
+    const Node *node = &_root;
+    forEachComponent(path, [&](const QByteArray &name) {
+        const auto it = node->children.find(name);
+        if (it == node->children.end())
+            return false;
+        node = it->second.get();
+        if (node->state != PinState::Inherited)
+            result = node->state;
+        return true;
+    });
+    return result;
+}
+
+PinState PinStateTree::effectiveForPathRecursive(const QByteArray &path) const
+{
+    const auto basePin = effectiveForPath(path);
+    const auto node = find(path);
+    if (!node)
+        return basePin;
+
+    // Check if the non-inherited pin states below are all identical to it
+    std::vector<const Node *> pending { node };
+    while (!pending.empty()) {
+        const auto current = pending.back();
+        pending.pop_back();
+        for (const auto &child : current->children) {
+            const auto subPin = child.second->state;
+            if (subPin != PinState::Inherited && subPin != basePin)
+                return PinState::Inherited;
+            pending.push_back(child.second.get());
+        }
+    }
+    return basePin;
+}
+
+void PinStateTree::setForPath(const QByteArray &path, PinState state)
+{
+    Node *node = &_root;
+    forEachComponent(path, [&](const QByteArray &name) {
+        auto &child = node->children[name];
+        if (!child)
+            child.reset(new Node);
+        node = child.get();
+        return true;
+    });
+    node->state = state;
+}
+
+void PinStateTree::wipeForPathAndBelow(const QByteArray &path)
+{
+    if (path.isEmpty()) {
+        _root.state = PinState::Inherited;
+        _root.children.clear();
+        return;
+    }
+
+    const int slash = path.lastIndexOf('/');
+    const auto parent = const_cast<Node *>(find(slash == -1 ? QByteArray() : path.left(slash)));
+    if (parent)
+        parent->children.erase(path.mid(slash + 1));
+}
+}
@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) by ownCloud GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#pragma once
+
+#include <QByteArray>
+#include <QPair>
+#include <QVector>
+
+#include <map>
+#include <memory>
+
+#include "ocsynclib.h"
+#include "common/pinstate.h"
+
+namespace OCC {
+
+/**
+ * @brief The pin states of the flags table as a tree of path components
+ *
+ * Answers the same questions as SyncJournalDb::PinStateInterface by walking
+ * down the path, without SQL. The tree only has nodes for the paths that have
+ * a pin state and their parents.
+ *
+ * It isn't thread safe, SyncJournalDb guards it with its mutex.
+ * @ingroup libsync
+ */
+class OCSYNC_EXPORT PinStateTree
+{
+public:
+    /// Replaces the contents, as returned by PinStateInterface::rawList()
+    void load(const QVector<QPair<QByteArray, PinState>> &states);
+
+    /// Forgets everything, isLoaded() is false afterwards
+    void clear();
+    bool isLoaded() const { return _loaded; }
+
+    /// See PinStateInterface::rawForPath()
+    PinState rawForPath(const QByteArray &path) const;
+    /// See PinStateInterface::effectiveForPath()
+    PinState effectiveForPath(const QByteArray &path) const;
+    /// See PinStateInterface::effectiveForPathRecursive()
+    PinState effectiveForPathRecursive(const QByteArray &path) const;
+
+    /// See PinStateInterface::setForPath()
+    void setForPath(const QByteArray &path, PinState state);
+    /// See PinStateInterface::wipeForPathAndBelow()
+    void wipeForPathAndBelow(const QByteArray &path);
+
+private:
+    struct Node
+    {
+        PinState state = PinState::Inherited;
+        std::map<QByteArray, std::unique_ptr<Node>> children;
+    };
+
+    /// The node of the path, nullptr if there is none
+    const Node *find(const QByteArray &path) const;
+
+    Node _root;
+    bool _loaded = false;
+};
+}
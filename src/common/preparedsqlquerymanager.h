@@ -84,12 +84,18 @@ public:
         GetDataFingerprintQuery,
         SetDataFingerprintQuery1,
         SetDataFingerprintQuery2,
+        GetSyncTokenQuery,
+        SetSyncTokenQuery1,
+        SetSyncTokenQuery2,
+        GetLocalDirectoryStateQuery,
+        SetLocalDirectoryStateQuery,
+        DeleteLocalDirectoryStateQuery,
+        DeleteLocalDirectoryStatesRecursively,
+        GetDiscoveryListingQuery,
+        SetDiscoveryListingQuery,
         GetConflictRecordQuery,
         SetConflictRecordQuery,
         DeleteConflictRecordQuery,
-        GetRawPinStateQuery,
-        GetEffectivePinStateQuery,
-        GetSubPinsQuery,
         CountDehydratedFilesQuery,
         SetPinStateQuery,
         WipePinStateQuery,
@@ -18,18 +18,23 @@
 
 #include <QCryptographicHash>
 #include <QFile>
+#include <QFileInfo>
 #include <QLoggingCategory>
 #include <QStringList>
+#include <QTimer>
 #include <QElapsedTimer>
 #include <QUrl>
 #include <QDir>
 #include <sqlite3.h>
+#include <algorithm>
 #include <cstring>
+#include <utility>
 
 #include "common/asserts.h"
 #include "common/checksums.h"
 #include "common/preparedsqlquerymanager.h"
 #include "common/syncjournaldb.h"
+#include "common/utility.h"
 #include "common/version.h"
 #include "filesystembase.h"
 #include "version.h"
@@ -67,6 +72,13 @@ static void fillFileRecordFromGetQuery(SyncJournalFileRecord &rec, SqlQuery &que
     rec._checksumHeader = query.baValue(9);
 }
 
+// The blacklist is queried case insensitively on case preserving file systems.
+// Lowering more than SQLite's NOCASE does only makes more paths look up the table.
+static QString blacklistKey(const QString &path)
+{
+    return Utility::fsCasePreserving() ? path.toLower() : path;
+}
+
 static QByteArray defaultJournalMode(const QString &dbPath)
 {
 #if defined(Q_OS_WIN)
@@ -200,18 +212,92 @@ QString SyncJournalDb::databaseFilePath() const
     return _dbFile;
 }
 
-// Note that this does not change the size of the -wal file, but it is supposed to make
-// the normal .db faster since the changes from the wal will be incorporated into it.
-// Then the next sync (and the SocketAPI) will have a faster access.
-void SyncJournalDb::walCheckpoint()
+// Returns the first column of a pragma's result, -1 on error
+static qint64 pragmaValue(SqlDatabase &db, const QByteArray &pragma)
 {
-    QElapsedTimer t;
-    t.start();
-    SqlQuery pragma1(_db);
-    pragma1.prepare("PRAGMA wal_checkpoint(FULL);");
-    if (pragma1.exec()) {
-        qCDebug(lcDb) << "took" << t.elapsed() << "msec";
+    SqlQuery query("PRAGMA " + pragma + ";", db);
+    if (!query.exec() || !query.next().hasData)
+        return -1;
+    return qint64(query.int64Value(0));
+}
+
+void SyncJournalDb::performMaintenance()
+{
+    QMutexLocker locker(&_mutex);
+    if (!_db.isOpen() || _transaction != 0)
+        return;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    // Give free pages back once there are many of them
+    static constexpr qint64 minFreeBytes = 8 * 1024 * 1024;
+    static constexpr qint64 maxVacuumPages = 25000;
+    const qint64 pageSize = pragmaValue(_db, "page_size");
+    const qint64 pageCount = pragmaValue(_db, "page_count");
+    const qint64 freePages = pragmaValue(_db, "freelist_count");
+    if (pageSize > 0 && freePages * pageSize >= minFreeBytes && freePages * 10 >= pageCount) {
+        if (pragmaValue(_db, "auto_vacuum") == 2) {
+            // Each step frees a page, limit the work done in one idle period
+            SqlQuery query("PRAGMA incremental_vacuum(" + QByteArray::number(std::min(freePages, maxVacuumPages)) + ");", _db);
+            if (query.exec()) {
+                while (query.next().hasData) {
+                }
+            }
+        } else {
+            // Journals created by older clients have no auto vacuum, only a VACUUM changes that.
+            // It rewrites the whole file while holding the mutex and needs space for a copy,
+            // so it is only done while the journal is small enough to be done quickly.
+            static constexpr qint64 maxConvertBytes = 64 * 1024 * 1024;
+            const qint64 dbBytes = pageCount * pageSize;
+            const qint64 freeSpace = Utility::freeDiskSpace(QFileInfo(_dbFile).absolutePath());
+            if (dbBytes > maxConvertBytes) {
+                qCInfo(lcDb) << "Not converting the journal to incremental auto vacuum, it has" << dbBytes << "bytes";
+            } else if (freeSpace != -1 && freeSpace < 2 * dbBytes) {
+                qCWarning(lcDb) << "Not converting the journal to incremental auto vacuum, only" << freeSpace << "bytes are free";
+            } else {
+                qCInfo(lcDb) << "Converting the journal to incremental auto vacuum," << freePages << "of" << pageCount << "pages are free";
+                SqlQuery query("PRAGMA auto_vacuum = INCREMENTAL;", _db);
+                query.exec();
+                query.prepare("VACUUM;");
+                if (!query.exec())
+                    qCWarning(lcDb) << "VACUUM failed:" << query.error();
+            }
+        }
+        qCInfo(lcDb) << "Free pages reduced from" << freePages << "to" << pragmaValue(_db, "freelist_count");
+    }
+
+    // A passive checkpoint doesn't wait for readers, truncating keeps the WAL file small
+    static constexpr qint64 maxWalBytes = 16 * 1024 * 1024;
+    const QFileInfo walFile(_dbFile + QStringLiteral("-wal"));
+    if (walFile.exists()) {
+        const bool truncate = walFile.size() >= maxWalBytes;
+        SqlQuery query(truncate ? "PRAGMA wal_checkpoint(TRUNCATE);" : "PRAGMA wal_checkpoint(PASSIVE);", _db);
+        if (query.exec())
+            query.next();
+        if (truncate)
+            qCInfo(lcDb) << "Truncated the WAL of" << walFile.size() << "bytes";
     }
+
+    qCInfo(lcDb) << "Journal maintenance took" << timer.elapsed() << "ms";
+}
+
+void SyncJournalDb::adaptCacheSizes(int recordCount)
+{
+    // About 1KiB of cache per record, SQLite's default of 2000KiB is the minimum
+    const qint64 cacheKiB = qBound<qint64>(2000, recordCount, 64 * 1024);
+    SqlQuery query("PRAGMA cache_size = " + QByteArray::number(-cacheKiB) + ";", _db);
+    query.exec();
+
+    // Large journals are read faster through a memory mapping. Not on a network
+    // file system though, where a page fault can't report a failing read.
+    qint64 mmapBytes = 0;
+    if (recordCount >= 10000 && !FileSystem::isOnNetworkFileSystem(_dbFile))
+        mmapBytes = qMin<qint64>(qint64(recordCount) * 2048, 256 * 1024 * 1024);
+    query.prepare("PRAGMA mmap_size = " + QByteArray::number(mmapBytes) + ";");
+    if (query.exec())
+        query.next();
+    qCInfo(lcDb) << "sqlite3 cache_size=" << cacheKiB << "KiB mmap_size=" << mmapBytes << "for" << recordCount << "records";
 }
 
 void SyncJournalDb::startTransaction()
@@ -230,11 +316,17 @@ void SyncJournalDb::startTransaction()
 void SyncJournalDb::commitTransaction()
 {
     if (_transaction == 1) {
-        if (!_db.commit()) {
+        QElapsedTimer timer;
+        timer.start();
+        const bool ok = _db.commit();
+        ++_writeStatistics.commits;
+        _writeStatistics.commitNsecs += timer.nsecsElapsed();
+        if (!ok) {
             qCWarning(lcDb) << "ERROR committing to the database:" << _db.error();
             return;
         }
         _transaction = 0;
+        _groupCommitRecords = 0;
     } else {
         qCDebug(lcDb) << "No database Transaction to commit";
     }
@@ -244,6 +336,7 @@ bool SyncJournalDb::sqlFail(const QString &log, const SqlQuery &query)
 {
     commitTransaction();
     qCWarning(lcDb) << "SQL Error" << log << query.error();
+    closeReader();
     _db.close();
     OC_ASSERT(false);
     return false;
@@ -296,15 +389,36 @@ bool SyncJournalDb::checkConnect()
     }
 
     // Set locking mode to avoid issues with WAL on Windows
-    static QByteArray locking_mode_env = qgetenv("OWNCLOUD_SQLITE_LOCKING_MODE");
-    if (locking_mode_env.isEmpty())
-        locking_mode_env = "EXCLUSIVE";
-    pragma1.prepare("PRAGMA locking_mode=" + locking_mode_env + ";");
+    static const QByteArray locking_mode_env = qgetenv("OWNCLOUD_SQLITE_LOCKING_MODE");
+    QByteArray lockingMode = locking_mode_env;
+    if (lockingMode.isEmpty()) {
+#ifdef Q_OS_WIN
+        lockingMode = "EXCLUSIVE";
+#else
+        // NORMAL allows the read-only connection of getCommittedFileRecord(), but
+        // the shared memory of WAL needs a local file system
+        lockingMode = FileSystem::isOnNetworkFileSystem(_dbFile) ? "EXCLUSIVE" : "NORMAL";
+#endif
+    }
+    pragma1.prepare("PRAGMA locking_mode=" + lockingMode + ";");
+    bool sharedLocking = false;
+    bool readerAllowed = false;
     if (!pragma1.exec()) {
         return sqlFail(QStringLiteral("Set PRAGMA locking_mode"), pragma1);
     } else {
         pragma1.next();
         qCInfo(lcDb) << "sqlite3 locking_mode=" << pragma1.stringValue(0);
+        sharedLocking = pragma1.stringValue(0).compare(QLatin1String("normal"), Qt::CaseInsensitive) == 0;
+    }
+
+    // The mode is stored in the file and can only be set while a new journal is
+    // still empty, so before switching to WAL. Older journals are converted by
+    // performMaintenance()
+    if (pragmaValue(_db, "page_count") == 0) {
+        pragma1.prepare("PRAGMA auto_vacuum = INCREMENTAL;");
+        if (!pragma1.exec()) {
+            return sqlFail(QStringLiteral("Set PRAGMA auto_vacuum"), pragma1);
+        }
     }
 
     pragma1.prepare("PRAGMA journal_mode=" + _journalMode + ";");
@@ -313,6 +427,8 @@ bool SyncJournalDb::checkConnect()
     } else {
         pragma1.next();
         qCInfo(lcDb) << "sqlite3 journal_mode=" << pragma1.stringValue(0);
+        // Other connections can only read next to the sync's transaction with WAL
+        readerAllowed = sharedLocking && pragma1.stringValue(0).compare(QLatin1String("wal"), Qt::CaseInsensitive) == 0;
     }
 
     // For debugging purposes, allow temp_store to be set
@@ -479,6 +595,34 @@ bool SyncJournalDb::checkConnect()
         return sqlFail(QStringLiteral("Create table datafingerprint"), createQuery);
     }
 
+    // create the synctoken table.
+    createQuery.prepare("CREATE TABLE IF NOT EXISTS synctoken("
+                        "token TEXT UNIQUE"
+                        ");");
+    if (!createQuery.exec()) {
+        return sqlFail(QStringLiteral("Create table synctoken"), createQuery);
+    }
+
+    // create the localdirectories table.
+    createQuery.prepare("CREATE TABLE IF NOT EXISTS localdirectories("
+                        "path TEXT PRIMARY KEY,"
+                        "modtime INTEGER,"
+                        "inode INTEGER"
+                        ");");
+    if (!createQuery.exec()) {
+        return sqlFail(QStringLiteral("Create table localdirectories"), createQuery);
+    }
+
+    // create the discoverylistings table.
+    createQuery.prepare("CREATE TABLE IF NOT EXISTS discoverylistings("
+                        "path TEXT PRIMARY KEY,"
+                        "etag TEXT,"
+                        "listing BLOB"
+                        ");");
+    if (!createQuery.exec()) {
+        return sqlFail(QStringLiteral("Create table discoverylistings"), createQuery);
+    }
+
     // create the flags table.
     createQuery.prepare("CREATE TABLE IF NOT EXISTS flags ("
                         "path TEXT PRIMARY KEY,"
@@ -510,6 +654,7 @@ bool SyncJournalDb::checkConnect()
     }
 
     bool forceRemoteDiscovery = false;
+    _journalVersionChanged = false;
 
     SqlQuery versionQuery("SELECT major, minor, patch FROM version;", _db);
     if (!versionQuery.next().hasData) {
@@ -545,6 +690,7 @@ bool SyncJournalDb::checkConnect()
 
         // Not comparing the BUILD id here, correct?
         if (QVersionNumber(major, minor, patch) != OCC::Version::version()) {
+            _journalVersionChanged = true;
             createQuery.prepare("UPDATE version SET major=?1, minor=?2, patch =?3, custom=?4 "
                                 "WHERE major=?5 AND minor=?6 AND patch=?7;");
             const auto segments = OCC::Version::versionWithBuildNumber().segments();
@@ -606,7 +752,9 @@ bool SyncJournalDb::checkConnect()
 
     // This avoid reading from the DB if we already know it is empty
     // thereby speeding up the initial discovery significantly.
-    _metadataTableIsEmpty = (getFileRecordCount() == 0);
+    const int recordCount = getFileRecordCount();
+    _metadataTableIsEmpty = (recordCount == 0);
+    adaptCacheSizes(std::max(recordCount, 0));
 
     // Hide 'em all!
     FileSystem::setFileHidden(databaseFilePath(), true);
@@ -614,6 +762,8 @@ bool SyncJournalDb::checkConnect()
     FileSystem::setFileHidden(databaseFilePath() + QStringLiteral("-shm"), true);
     FileSystem::setFileHidden(databaseFilePath() + QStringLiteral("-journal"), true);
 
+    // Only now the journal is checked and migrated, see checkReaderConnect()
+    _readerAllowed = rc && readerAllowed;
     return rc;
 }
 
@@ -622,10 +772,44 @@ void SyncJournalDb::close()
     QMutexLocker locker(&_mutex);
     qCInfo(lcDb) << "Closing DB" << _dbFile;
 
+    closeReader();
     commitTransaction();
     _db.close();
     clearEtagStorageFilter();
     _metadataTableIsEmpty = false;
+    _errorBlacklistPaths.clear();
+    _errorBlacklistPathsLoaded = false;
+    _pinStateTree.clear();
+}
+
+bool SyncJournalDb::checkReaderConnect()
+{
+    if (_readerDb.isOpen())
+        return true;
+    // Don't wait for the busy timeout on every lookup, close() allows a new attempt
+    if (_readerFailed)
+        return false;
+
+    // Only an existing journal, the main connection creates and migrates it
+    if (!QFile::exists(_dbFile))
+        return false;
+    // The main connection already checked the journal's consistency
+    if (!OC_ENSURE(_readerAllowed))
+        return false;
+    if (!_readerDb.openReadOnly(_dbFile, false)) {
+        qCInfo(lcDb) << "Could not open a read-only connection to" << _dbFile;
+        _readerFailed = true;
+        return false;
+    }
+    return true;
+}
+
+void SyncJournalDb::closeReader()
+{
+    QMutexLocker locker(&_readerMutex);
+    _readerAllowed = false;
+    _readerDb.close();
+    _readerFailed = false;
 }
 
 
@@ -703,13 +887,49 @@ bool SyncJournalDb::updateMetadataTableStructure()
     }
 
     if (1) {
+        // Lets getFilesBelowPath() read a subtree in index order instead of sorting it
+        SqlQuery query(_db);
+        query.prepare("CREATE INDEX IF NOT EXISTS metadata_sort_key ON metadata(path||'/');");
+        if (!query.exec()) {
+            sqlFail(QStringLiteral("updateMetadataTableStructure: create index sort key"), query);
+            re = false;
+        }
+        commitInternal(QStringLiteral("update database structure: add sort key index"));
+    }
+
+    // The parent_id is the phash of the parent directory, it replaces the
+    // metadata_parent index on parent_hash(path)
+    bool fillParentIds = _journalVersionChanged; // an older client may have written rows since
+    if (columns.indexOf("parent_id") == -1) {
         SqlQuery query(_db);
-        query.prepare("CREATE INDEX IF NOT EXISTS metadata_parent ON metadata(parent_hash(path));");
+        query.prepare("ALTER TABLE metadata ADD COLUMN parent_id INTEGER(8);");
         if (!query.exec()) {
-            sqlFail(QStringLiteral("updateMetadataTableStructure: create index parent"), query);
+            sqlFail(QStringLiteral("updateMetadataTableStructure: add parent_id column"), query);
             re = false;
         }
-        commitInternal(QStringLiteral("update database structure: add parent index"));
+        commitInternal(QStringLiteral("update database structure: add parent_id col"));
+        fillParentIds = true;
+    }
+
+    if (fillParentIds) {
+        // Older clients don't set parent_id, fill it in for the rows they wrote
+        SqlQuery query(_db);
+        query.prepare("UPDATE metadata SET parent_id = parent_hash(path) WHERE parent_id IS NULL;");
+        if (!query.exec()) {
+            sqlFail(QStringLiteral("updateMetadataTableStructure: fill parent_id"), query);
+            re = false;
+        }
+        commitInternal(QStringLiteral("update database structure: fill parent_id"));
+    }
+
+    if (1) {
+        SqlQuery query(_db);
+        query.prepare("CREATE INDEX IF NOT EXISTS metadata_parent_id ON metadata(parent_id);");
+        if (!query.exec()) {
+            sqlFail(QStringLiteral("updateMetadataTableStructure: create index parent_id"), query);
+            re = false;
+        }
+        commitInternal(QStringLiteral("update database structure: add parent_id index"));
     }
 
     if (columns.indexOf("ignoredChildrenRemote") == -1) {
@@ -880,9 +1100,36 @@ Result<void, QString> SyncJournalDb::setFileRecord(const SyncJournalFileRecord &
                  << "etag:" << record._etag << "fileId:" << record._fileId << "remotePerm:" << record._remotePerm.toString()
                  << "fileSize:" << record._fileSize << "checksum:" << record._checksumHeader;
 
+    auto result = writeFileRecord(record);
+    if (!result)
+        return result;
+
+    // Only the commit is deferred, see setGroupCommitPolicy()
+    if (_groupCommitMaxRecords > 0 && _transaction == 1) {
+        if (++_groupCommitRecords >= _groupCommitMaxRecords) {
+            commitInternal(QStringLiteral("group commit"));
+        } else if (!_groupCommitTimerPending) {
+            // Commits the group when no further records complete it in time.
+            // A timer left over from an earlier group only commits earlier.
+            _groupCommitTimerPending = true;
+            QTimer::singleShot(_groupCommitMaxDelay, this, [this] {
+                QMutexLocker lock(&_mutex);
+                _groupCommitTimerPending = false;
+                if (_transaction == 1 && _groupCommitRecords > 0)
+                    commitInternal(QStringLiteral("group commit delay"));
+            });
+        }
+    }
+    return {};
+}
+
+Result<void, QString> SyncJournalDb::writeFileRecord(const SyncJournalFileRecord &record)
+{
     const qint64 phash = getPHash(record._path);
     if (checkConnect()) {
         int plen = record._path.length();
+        const int slash = record._path.lastIndexOf('/');
+        const qint64 parentId = getPHash(slash == -1 ? QByteArray() : record._path.left(slash));
 
         QByteArray etag(record._etag);
         if (etag.isEmpty())
@@ -895,8 +1142,8 @@ Result<void, QString> SyncJournalDb::setFileRecord(const SyncJournalFileRecord &
         parseChecksumHeader(record._checksumHeader, &checksumType, &checksum);
         int contentChecksumTypeId = mapChecksumType(checksumType);
         const auto query = _queryManager.get(PreparedSqlQueryManager::SetFileRecordQuery, QByteArrayLiteral("INSERT OR REPLACE INTO metadata "
-                                                                                                            "(phash, pathlen, path, inode, uid, gid, mode, modtime, type, md5, fileid, remotePerm, filesize, ignoredChildrenRemote, contentChecksum, contentChecksumTypeId) "
-                                                                                                            "VALUES (?1 , ?2, ?3 , ?4 , ?5 , ?6 , ?7,  ?8 , ?9 , ?10, ?11, ?12, ?13, ?14, ?15, ?16);"),
+                                                                                                            "(phash, pathlen, path, inode, uid, gid, mode, modtime, type, md5, fileid, remotePerm, filesize, ignoredChildrenRemote, contentChecksum, contentChecksumTypeId, parent_id) "
+                                                                                                            "VALUES (?1 , ?2, ?3 , ?4 , ?5 , ?6 , ?7,  ?8 , ?9 , ?10, ?11, ?12, ?13, ?14, ?15, ?16, ?17);"),
             _db);
         if (!query) {
             return query->error();
@@ -918,8 +1165,14 @@ Result<void, QString> SyncJournalDb::setFileRecord(const SyncJournalFileRecord &
         query->bindValue(14, record._serverHasIgnoredFiles ? 1 : 0);
         query->bindValue(15, checksum);
         query->bindValue(16, contentChecksumTypeId);
-
-        if (!query->exec()) {
+        query->bindValue(17, parentId);
+
+        QElapsedTimer timer;
+        timer.start();
+        const bool ok = query->exec();
+        ++_writeStatistics.records;
+        _writeStatistics.recordNsecs += timer.nsecsElapsed();
+        if (!ok) {
             return query->error();
         }
 
@@ -937,7 +1190,6 @@ Result<void, QString> SyncJournalDb::setFileRecord(const SyncJournalFileRecord &
 bool SyncJournalDb::deleteFileRecord(const QString &filename, bool recursively)
 {
     QMutexLocker locker(&_mutex);
-
     if (checkConnect()) {
         // if (!recursively) {
         // always delete the actual file.
@@ -965,6 +1217,19 @@ bool SyncJournalDb::deleteFileRecord(const QString &filename, bool recursively)
                 return false;
             }
         }
+
+        // A removed or renamed directory must be listed again if it shows up at the old path
+        {
+            const auto query = recursively
+                ? _queryManager.get(PreparedSqlQueryManager::DeleteLocalDirectoryStatesRecursively, QByteArrayLiteral("DELETE FROM localdirectories WHERE " IS_PREFIX_PATH_OR_EQUAL("?1", "path")), _db)
+                : _queryManager.get(PreparedSqlQueryManager::DeleteLocalDirectoryStateQuery, QByteArrayLiteral("DELETE FROM localdirectories WHERE path=?1"), _db);
+            if (!query)
+                return false;
+            query->bindValue(1, filename);
+            if (!query->exec()) {
+                return false;
+            }
+        }
         return true;
     } else {
         qCWarning(lcDb) << "Failed to connect database.";
@@ -1015,6 +1280,34 @@ bool SyncJournalDb::getFileRecord(const QByteArray &filename, SyncJournalFileRec
     return true;
 }
 
+bool SyncJournalDb::getCommittedFileRecord(const QByteArray &filename, SyncJournalFileRecord *rec)
+{
+    Q_ASSERT(rec);
+    rec->_path.clear();
+    Q_ASSERT(!rec->isValid());
+
+    {
+        // closeReader() only disallows it while holding the mutex
+        QMutexLocker locker(&_readerMutex);
+        if (_readerAllowed && checkReaderConnect()) {
+            if (filename.isEmpty())
+                return true;
+
+            const auto query = _readerQueryManager.get(PreparedSqlQueryManager::GetFileRecordQuery, QByteArrayLiteral(GET_FILE_RECORD_QUERY " WHERE phash=?1"), _readerDb);
+            if (!query)
+                return false;
+            query->bindValue(1, getPHash(filename));
+            if (!query->exec())
+                return false;
+            const auto next = query->next();
+            if (next.hasData)
+                fillFileRecordFromGetQuery(*rec, *query);
+            return next.ok;
+        }
+    }
+    return getFileRecord(filename, rec);
+}
+
 bool SyncJournalDb::getFileRecordByInode(quint64 inode, SyncJournalFileRecord *rec)
 {
     QMutexLocker locker(&_mutex);
@@ -1125,12 +1418,14 @@ bool SyncJournalDb::getFilesBelowPath(const QByteArray &path, const std::functio
     } else {
         // This query is used to skip discovery and fill the tree from the
         // database instead
-        const auto query = _queryManager.get(PreparedSqlQueryManager::GetFilesBelowPathQuery, QByteArrayLiteral(GET_FILE_RECORD_QUERY " WHERE " IS_PREFIX_PATH_OF("?1", "path")
+        const auto query = _queryManager.get(PreparedSqlQueryManager::GetFilesBelowPathQuery, QByteArrayLiteral(GET_FILE_RECORD_QUERY " WHERE " IS_PREFIX_PATH_OF("?1", "path||'/'")
                                                                                                   // We want to ensure that the contents of a directory are sorted
                                                                                                   // directly behind the directory itself. Without this ORDER BY
                                                                                                   // an ordering like foo, foo-2, foo/file would be returned.
                                                                                                   // With the trailing /, we get foo-2, foo, foo/file. This property
                                                                                                   // is used in fill_tree_from_db().
+                                                                                                  // The condition is on the same expression as the ORDER BY so
+                                                                                                  // both are served by the metadata_sort_key index.
                                                                                                   " ORDER BY path||'/' ASC"),
             _db);
         if (!query) {
@@ -1152,7 +1447,7 @@ bool SyncJournalDb::listFilesInPath(const QByteArray& path,
     if (!checkConnect())
         return false;
 
-    const auto query = _queryManager.get(PreparedSqlQueryManager::ListFilesInPathQuery, QByteArrayLiteral(GET_FILE_RECORD_QUERY " WHERE parent_hash(path) = ?1 ORDER BY path||'/' ASC"), _db);
+    const auto query = _queryManager.get(PreparedSqlQueryManager::ListFilesInPathQuery, QByteArrayLiteral(GET_FILE_RECORD_QUERY " WHERE parent_id = ?1 ORDER BY path||'/' ASC"), _db);
     if (!query) {
         return false;
     }
@@ -1511,6 +1806,11 @@ SyncJournalErrorBlacklistRecord SyncJournalDb::errorBlacklistEntry(const QString
     if (file.isEmpty())
         return entry;
 
+    if (!loadErrorBlacklistPaths())
+        return entry;
+    if (!_errorBlacklistPaths.contains(blacklistKey(file)))
+        return entry;
+
     if (checkConnect()) {
         const auto query = _queryManager.get(PreparedSqlQueryManager::GetErrorBlacklistQuery);
         query->bindValue(1, file);
@@ -1534,6 +1834,29 @@ SyncJournalErrorBlacklistRecord SyncJournalDb::errorBlacklistEntry(const QString
     return entry;
 }
 
+bool SyncJournalDb::loadErrorBlacklistPaths()
+{
+    if (_errorBlacklistPathsLoaded)
+        return true;
+    if (!checkConnect())
+        return false;
+
+    SqlQuery query("SELECT path FROM blacklist", _db);
+    if (!query.exec())
+        return false;
+    _errorBlacklistPaths.clear();
+    forever {
+        auto next = query.next();
+        if (!next.ok)
+            return false;
+        if (!next.hasData)
+            break;
+        _errorBlacklistPaths.insert(blacklistKey(query.stringValue(0)));
+    }
+    _errorBlacklistPathsLoaded = true;
+    return true;
+}
+
 bool SyncJournalDb::deleteStaleErrorBlacklistEntries(const QSet<QString> &keep)
 {
     QMutexLocker locker(&_mutex);
@@ -1560,6 +1883,7 @@ bool SyncJournalDb::deleteStaleErrorBlacklistEntries(const QSet<QString> &keep)
 
     SqlQuery delQuery(_db);
     delQuery.prepare("DELETE FROM blacklist WHERE path = ?");
+    _errorBlacklistPathsLoaded = false;
     return deleteBatch(delQuery, superfluousPaths, QStringLiteral("blacklist"));
 }
 
@@ -1571,6 +1895,7 @@ void SyncJournalDb::deleteStaleFlagsEntries()
 
     SqlQuery delQuery("DELETE FROM flags WHERE path != '' AND path NOT IN (SELECT path from metadata);", _db);
     delQuery.exec();
+    _pinStateTree.clear();
 }
 
 int SyncJournalDb::errorBlackListEntryCount()
@@ -1603,6 +1928,8 @@ int SyncJournalDb::wipeErrorBlacklist()
             sqlFail(QStringLiteral("Deletion of whole blacklist failed"), query);
             return -1;
         }
+        _errorBlacklistPaths.clear();
+        _errorBlacklistPathsLoaded = true;
         return query.numRowsAffected();
     }
     return -1;
@@ -1622,6 +1949,9 @@ void SyncJournalDb::wipeErrorBlacklistEntry(const QString &file)
         query.bindValue(1, file);
         if (!query.exec()) {
             sqlFail(QStringLiteral("Deletion of blacklist item failed."), query);
+        } else if (!Utility::fsCasePreserving()) {
+            // Otherwise a path differing in case may still use the key
+            _errorBlacklistPaths.remove(file);
         }
     }
 }
@@ -1637,6 +1967,7 @@ void SyncJournalDb::wipeErrorBlacklistCategory(SyncJournalErrorBlacklistRecord::
         if (!query.exec()) {
             sqlFail(QStringLiteral("Deletion of blacklist category failed."), query);
         }
+        _errorBlacklistPathsLoaded = false;
     }
 }
 
@@ -1671,7 +2002,8 @@ void SyncJournalDb::setErrorBlacklistEntry(const SyncJournalErrorBlacklistRecord
     query->bindValue(8, item._renameTarget);
     query->bindValue(9, item._errorCategory);
     query->bindValue(10, item._requestId);
-    query->exec();
+    if (query->exec())
+        _errorBlacklistPaths.insert(blacklistKey(item._file));
 }
 
 QStringList SyncJournalDb::getSelectiveSyncList(SyncJournalDb::SelectiveSyncListType type, bool *ok)
@@ -1811,6 +2143,11 @@ void SyncJournalDb::forceRemoteDiscoveryNextSyncLocked()
     SqlQuery deleteRemoteFolderEtagsQuery(_db);
     deleteRemoteFolderEtagsQuery.prepare("UPDATE metadata SET md5='_invalid_' WHERE type=2;");
     deleteRemoteFolderEtagsQuery.exec();
+
+    // The changes since the last sync would not be used anyway
+    SqlQuery deleteSyncTokenQuery(_db);
+    deleteSyncTokenQuery.prepare("DELETE FROM synctoken;");
+    deleteSyncTokenQuery.exec();
 }
 
 
@@ -1922,6 +2259,198 @@ void SyncJournalDb::setDataFingerprint(const QByteArray &dataFingerprint)
     setDataFingerprintQuery2->exec();
 }
 
+QByteArray SyncJournalDb::syncToken()
+{
+    QMutexLocker locker(&_mutex);
+    if (!checkConnect()) {
+        return QByteArray();
+    }
+
+    const auto query = _queryManager.get(PreparedSqlQueryManager::GetSyncTokenQuery, QByteArrayLiteral("SELECT token FROM synctoken"), _db);
+    if (!query) {
+        return QByteArray();
+    }
+
+    if (!query->exec()) {
+        return QByteArray();
+    }
+
+    if (!query->next().hasData) {
+        return QByteArray();
+    }
+    return query->baValue(0);
+}
+
+void SyncJournalDb::setSyncToken(const QByteArray &syncToken)
+{
+    QMutexLocker locker(&_mutex);
+    if (!checkConnect()) {
+        return;
+    }
+
+    const auto setSyncTokenQuery1 = _queryManager.get(PreparedSqlQueryManager::SetSyncTokenQuery1, QByteArrayLiteral("DELETE FROM synctoken;"), _db);
+    const auto setSyncTokenQuery2 = _queryManager.get(PreparedSqlQueryManager::SetSyncTokenQuery2, QByteArrayLiteral("INSERT INTO synctoken (token) VALUES (?1);"), _db);
+    if (!setSyncTokenQuery1 || !setSyncTokenQuery2) {
+        return;
+    }
+
+    setSyncTokenQuery1->exec();
+
+    if (!syncToken.isEmpty()) {
+        setSyncTokenQuery2->bindValue(1, syncToken);
+        setSyncTokenQuery2->exec();
+    }
+}
+
+SyncJournalDb::LocalDirectoryState SyncJournalDb::localDirectoryState(const QByteArray &path)
+{
+    QMutexLocker locker(&_mutex);
+
+    LocalDirectoryState res;
+
+    if (!checkConnect()) {
+        return res;
+    }
+
+    const auto query = _queryManager.get(PreparedSqlQueryManager::GetLocalDirectoryStateQuery, QByteArrayLiteral("SELECT modtime, inode FROM localdirectories WHERE path=?1"), _db);
+    if (!query) {
+        return res;
+    }
+    query->bindValue(1, path);
+
+    if (!query->exec()) {
+        return res;
+    }
+
+    if (query->next().hasData) {
+        res._modtime = query->int64Value(0);
+        res._inode = query->int64Value(1);
+        res._valid = true;
+    }
+    return res;
+}
+
+QHash<QByteArray, SyncJournalDb::LocalDirectoryState> SyncJournalDb::localDirectoryStates()
+{
+    QMutexLocker locker(&_mutex);
+
+    QHash<QByteArray, LocalDirectoryState> res;
+
+    if (!checkConnect()) {
+        return res;
+    }
+
+    SqlQuery query("SELECT path, modtime, inode FROM localdirectories", _db);
+    if (!query.exec()) {
+        return res;
+    }
+
+    while (query.next().hasData) {
+        LocalDirectoryState state;
+        state._modtime = query.int64Value(1);
+        state._inode = query.int64Value(2);
+        state._valid = true;
+        res.insert(query.baValue(0), state);
+    }
+    return res;
+}
+
+void SyncJournalDb::setLocalDirectoryState(const QByteArray &path, const LocalDirectoryState &state)
+{
+    QMutexLocker locker(&_mutex);
+
+    if (!checkConnect()) {
+        return;
+    }
+
+    const auto query = _queryManager.get(PreparedSqlQueryManager::SetLocalDirectoryStateQuery, QByteArrayLiteral("INSERT OR REPLACE INTO localdirectories "
+                                                                                                                 "(path, modtime, inode) "
+                                                                                                                 "VALUES (?1, ?2, ?3);"),
+        _db);
+    if (!query) {
+        return;
+    }
+    query->bindValue(1, path);
+    query->bindValue(2, state._modtime);
+    query->bindValue(3, state._inode);
+    query->exec();
+}
+
+QByteArray SyncJournalDb::discoveryListing(const QByteArray &path, const QByteArray &etag)
+{
+    QMutexLocker locker(&_mutex);
+
+    if (!checkConnect()) {
+        return QByteArray();
+    }
+
+    const auto query = _queryManager.get(PreparedSqlQueryManager::GetDiscoveryListingQuery, QByteArrayLiteral("SELECT listing FROM discoverylistings WHERE path=?1 AND etag=?2"), _db);
+    if (!query) {
+        return QByteArray();
+    }
+    query->bindValue(1, path);
+    query->bindValue(2, etag);
+
+    if (!query->exec()) {
+        return QByteArray();
+    }
+
+    if (!query->next().hasData) {
+        return QByteArray();
+    }
+    return query->baValue(0);
+}
+
+void SyncJournalDb::setDiscoveryListing(const QByteArray &path, const QByteArray &etag, const QByteArray &listing)
+{
+    QMutexLocker locker(&_mutex);
+
+    if (!checkConnect()) {
+        return;
+    }
+
+    const auto query = _queryManager.get(PreparedSqlQueryManager::SetDiscoveryListingQuery, QByteArrayLiteral("INSERT OR REPLACE INTO discoverylistings "
+                                                                                                              "(path, etag, listing) "
+                                                                                                              "VALUES (?1, ?2, ?3);"),
+        _db);
+    if (!query) {
+        return;
+    }
+    query->bindValue(1, path);
+    query->bindValue(2, etag);
+    query->bindValue(3, listing);
+    query->exec();
+}
+
+void SyncJournalDb::clearDiscoveryListings()
+{
+    QMutexLocker locker(&_mutex);
+
+    if (!checkConnect()) {
+        return;
+    }
+
+    SqlQuery query(_db);
+    query.prepare("DELETE FROM discoverylistings;");
+    query.exec();
+}
+
+bool SyncJournalDb::hasDiscoveryListings()
+{
+    QMutexLocker locker(&_mutex);
+
+    if (!checkConnect()) {
+        return false;
+    }
+
+    SqlQuery query(_db);
+    query.prepare("SELECT 1 FROM discoverylistings LIMIT 1;");
+    if (!query.exec()) {
+        return false;
+    }
+    return query.next().hasData;
+}
+
 void SyncJournalDb::setConflictRecord(const ConflictRecord &record)
 {
     QMutexLocker locker(&_mutex);
@@ -2015,6 +2544,13 @@ void SyncJournalDb::clearFileTable()
     SqlQuery query(_db);
     query.prepare("DELETE FROM metadata;");
     query.exec();
+    // The changes since the last sync only make sense together with the file records
+    query.prepare("DELETE FROM synctoken;");
+    query.exec();
+    query.prepare("DELETE FROM localdirectories;");
+    query.exec();
+    query.prepare("DELETE FROM discoverylistings;");
+    query.exec();
 }
 
 void SyncJournalDb::markVirtualFileForDownloadRecursively(const QByteArray &path)
@@ -2042,85 +2578,25 @@ void SyncJournalDb::markVirtualFileForDownloadRecursively(const QByteArray &path
 Optional<PinState> SyncJournalDb::PinStateInterface::rawForPath(const QByteArray &path)
 {
     QMutexLocker lock(&_db->_mutex);
-    if (!_db->checkConnect())
-        return {};
-
-    const auto query = _db->_queryManager.get(PreparedSqlQueryManager::GetRawPinStateQuery, QByteArrayLiteral("SELECT pinState FROM flags WHERE path == ?1;"), _db->_db);
-    OC_ASSERT(query);
-    query->bindValue(1, path);
-    query->exec();
-
-    auto next = query->next();
-    if (!next.ok)
+    if (!_db->loadPinStateTree())
         return {};
-    // no-entry means Inherited
-    if (!next.hasData)
-        return PinState::Inherited;
-
-    return static_cast<PinState>(query->intValue(0));
+    return _db->_pinStateTree.rawForPath(path);
 }
 
 Optional<PinState> SyncJournalDb::PinStateInterface::effectiveForPath(const QByteArray &path)
 {
     QMutexLocker lock(&_db->_mutex);
-    if (!_db->checkConnect())
-        return {};
-
-    const auto query = _db->_queryManager.get(PreparedSqlQueryManager::GetEffectivePinStateQuery, QByteArrayLiteral("SELECT pinState FROM flags WHERE"
-                                                                                                                    // explicitly allow "" to represent the root path
-                                                                                                                    // (it'd be great if paths started with a / and "/" could be the root)
-                                                                                                                    " (" IS_PREFIX_PATH_OR_EQUAL("path", "?1") " OR path == '')"
-                                                                                                                                                               " AND pinState is not null AND pinState != 0"
-                                                                                                                                                               " ORDER BY length(path) DESC LIMIT 1;"),
-        _db->_db);
-    OC_ASSERT(query);
-    query->bindValue(1, path);
-    query->exec();
-
-    auto next = query->next();
-    if (!next.ok)
+    if (!_db->loadPinStateTree())
         return {};
-    // If the root path has no setting, assume AlwaysLocal
-    if (!next.hasData)
-        return PinState::AlwaysLocal;
-
-    return static_cast<PinState>(query->intValue(0));
+    return _db->_pinStateTree.effectiveForPath(path);
 }
 
 Optional<PinState> SyncJournalDb::PinStateInterface::effectiveForPathRecursive(const QByteArray &path)
 {
-    // Get the item's effective pin state. We'll compare subitem's pin states
-    // against this.
-    const auto basePin = effectiveForPath(path);
-    if (!basePin)
-        return {};
-
     QMutexLocker lock(&_db->_mutex);
-    if (!_db->checkConnect())
+    if (!_db->loadPinStateTree())
         return {};
-
-    // Find all the non-inherited pin states below the item
-    const auto query = _db->_queryManager.get(PreparedSqlQueryManager::GetSubPinsQuery, QByteArrayLiteral("SELECT DISTINCT pinState FROM flags WHERE"
-                                                                                                          " (" IS_PREFIX_PATH_OF("?1", "path") " OR ?1 == '')"
-                                                                                                                                               " AND pinState is not null and pinState != 0;"),
-        _db->_db);
-    OC_ASSERT(query);
-    query->bindValue(1, path);
-    query->exec();
-
-    // Check if they are all identical
-    forever {
-        auto next = query->next();
-        if (!next.ok)
-            return {};
-        if (!next.hasData)
-            break;
-        const auto subPin = static_cast<PinState>(query->intValue(0));
-        if (subPin != *basePin)
-            return PinState::Inherited;
-    }
-
-    return *basePin;
+    return _db->_pinStateTree.effectiveForPathRecursive(path);
 }
 
 void SyncJournalDb::PinStateInterface::setForPath(const QByteArray &path, PinState state)
@@ -2140,7 +2616,10 @@ void SyncJournalDb::PinStateInterface::setForPath(const QByteArray &path, PinSta
     OC_ASSERT(query);
     query->bindValue(1, path);
     query->bindValue(2, state);
-    query->exec();
+    if (query->exec())
+        _db->_pinStateTree.setForPath(path, state);
+    else
+        _db->_pinStateTree.clear();
 }
 
 void SyncJournalDb::PinStateInterface::wipeForPathAndBelow(const QByteArray &path)
@@ -2155,7 +2634,10 @@ void SyncJournalDb::PinStateInterface::wipeForPathAndBelow(const QByteArray &pat
         _db->_db);
     OC_ASSERT(query);
     query->bindValue(1, path);
-    query->exec();
+    if (query->exec())
+        _db->_pinStateTree.wipeForPathAndBelow(path);
+    else
+        _db->_pinStateTree.clear();
 }
 
 Optional<QVector<QPair<QByteArray, PinState>>>
@@ -2185,12 +2667,36 @@ SyncJournalDb::PinStateInterface SyncJournalDb::internalPinStates()
     return {this};
 }
 
+bool SyncJournalDb::loadPinStateTree()
+{
+    if (_pinStateTree.isLoaded())
+        return true;
+    const auto states = internalPinStates().rawList();
+    if (!states)
+        return false;
+    _pinStateTree.load(*states);
+    return true;
+}
+
 void SyncJournalDb::commit(const QString &context, bool startTrans)
 {
     QMutexLocker lock(&_mutex);
     commitInternal(context, startTrans);
 }
 
+void SyncJournalDb::setGroupCommitPolicy(int maxRecords, std::chrono::milliseconds maxDelay)
+{
+    QMutexLocker lock(&_mutex);
+    _groupCommitMaxRecords = maxRecords;
+    _groupCommitMaxDelay = maxDelay;
+}
+
+SyncJournalDb::WriteStatistics SyncJournalDb::takeWriteStatistics()
+{
+    QMutexLocker lock(&_mutex);
+    return std::exchange(_writeStatistics, WriteStatistics());
+}
+
 void SyncJournalDb::commitIfNeededAndStartNewTransaction(const QString &context)
 {
     QMutexLocker lock(&_mutex);
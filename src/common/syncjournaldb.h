@@ -23,6 +23,9 @@
 #include <qmutex.h>
 #include <QDateTime>
 #include <QHash>
+#include <QSet>
+#include <atomic>
+#include <chrono>
 #include <functional>
 
 #include "common/utility.h"
@@ -31,6 +34,7 @@
 #include "common/syncjournalfilerecord.h"
 #include "common/result.h"
 #include "common/pinstate.h"
+#include "common/pinstatetree.h"
 
 namespace OCC {
 class SyncJournalFileRecord;
@@ -59,9 +63,22 @@ public:
     bool getFileRecord(const QString &filename, SyncJournalFileRecord *rec) { return getFileRecord(filename.toUtf8(), rec); }
     bool getFileRecord(const QByteArray &filename, SyncJournalFileRecord *rec);
     bool getFileRecordByInode(quint64 inode, SyncJournalFileRecord *rec);
+    /** Like getFileRecord(), but through a separate read-only connection
+     *
+     * It doesn't wait for the sync run to release the mutex, which makes it
+     * suitable for the lookups of the GUI and the socket API, but it only sees
+     * committed records. Falls back to getFileRecord() if the read-only
+     * connection can't be opened or the journal's locking or journal mode
+     * don't allow a second connection.
+     */
+    bool getCommittedFileRecord(const QByteArray &filename, SyncJournalFileRecord *rec);
+    bool getCommittedFileRecord(const QString &filename, SyncJournalFileRecord *rec) { return getCommittedFileRecord(filename.toUtf8(), rec); }
     bool getFileRecordsByFileId(const QByteArray &fileId, const std::function<void(const SyncJournalFileRecord &)> &rowCallback);
     bool getFilesBelowPath(const QByteArray &path, const std::function<void(const SyncJournalFileRecord&)> &rowCallback);
     bool listFilesInPath(const QByteArray &path, const std::function<void(const SyncJournalFileRecord&)> &rowCallback);
+    /// The number of file records, -1 on error or if the database isn't open yet
+    /// (doesn't connect by itself as checkConnect() uses it)
+    int getFileRecordCount();
     Result<void, QString> setFileRecord(const SyncJournalFileRecord &record);
 
     bool deleteFileRecord(const QString &filename, bool recursively = false);
@@ -80,7 +97,19 @@ public:
     Optional<HasHydratedDehydrated> hasHydratedOrDehydratedFiles(const QByteArray &filename);
 
     bool exists();
-    void walCheckpoint();
+
+    /** Housekeeping for the idle time between syncs
+     *
+     * Checkpoints the WAL, truncating it once it grew large, and gives free
+     * pages back to the file system once they take up a sizeable part of the
+     * file. Journals created without incremental auto vacuum are converted
+     * with a VACUUM the first time that happens, unless they are too large to
+     * do that quickly or there isn't enough disk space for the copy.
+     *
+     * Does nothing if the journal isn't open or a transaction is running.
+     * Holds the journal's mutex, call it from a worker thread.
+     */
+    void performMaintenance();
 
     QString databaseFilePath() const;
 
@@ -129,6 +158,20 @@ public:
         bool isChunked() const { return _transferid != 0; }
     };
 
+    /**
+     * The mtime and inode a local directory had when it was last listed
+     * in a sync that finished without errors.
+     *
+     * While they are unchanged the database knows the directory's entries,
+     * see ProcessDirectoryJob::startAsyncLocalQuery().
+     */
+    struct LocalDirectoryState
+    {
+        qint64 _modtime = 0;
+        quint64 _inode = 0;
+        bool _valid = false;
+    };
+
     DownloadInfo getDownloadInfo(const QString &file);
     void setDownloadInfo(const QString &file, const DownloadInfo &i);
     QVector<DownloadInfo> getAndDeleteStaleDownloadInfos(const QSet<QString> &keep);
@@ -203,6 +246,30 @@ public:
     void commit(const QString &context, bool startTrans = true);
     void commitIfNeededAndStartNewTransaction(const QString &context);
 
+    /** Commit the records of setFileRecord() in groups
+     *
+     * setFileRecord() always writes the record right away and reports its
+     * errors. While a transaction is open, the transaction is committed once
+     * maxRecords were written since the last commit, or by a timer maxDelay
+     * after the first of them. The timer needs the event loop of the
+     * journal's thread.
+     *
+     * With maxRecords <= 0 only commit() commits them.
+     */
+    void setGroupCommitPolicy(int maxRecords, std::chrono::milliseconds maxDelay);
+
+    /// Time spent in the SQLite write paths, see takeWriteStatistics()
+    struct WriteStatistics
+    {
+        qint64 records = 0; // file records written
+        qint64 recordNsecs = 0;
+        qint64 commits = 0;
+        qint64 commitNsecs = 0;
+    };
+
+    /// The statistics since the last call, they start from zero again
+    WriteStatistics takeWriteStatistics();
+
     /** Open the db if it isn't already.
      *
      * This usually creates some temporary files next to the db file, like
@@ -229,6 +296,35 @@ public:
     void setDataFingerprint(const QByteArray &dataFingerprint);
     QByteArray dataFingerprint();
 
+    /**
+     * The sync-token of the remote root at the time of the last successful sync
+     *
+     * Used to ask the server for the changes since then. An empty token removes it.
+     */
+    void setSyncToken(const QByteArray &syncToken);
+    QByteArray syncToken();
+
+    LocalDirectoryState localDirectoryState(const QByteArray &path);
+    /// All stored states by path, in one query
+    QHash<QByteArray, LocalDirectoryState> localDirectoryStates();
+    void setLocalDirectoryState(const QByteArray &path, const LocalDirectoryState &state);
+
+    /**
+     * The server listing of a directory, fetched in a sync that didn't finish yet
+     *
+     * The discovery reuses it instead of listing the directory again while the
+     * directory's etag is unchanged. The listing is serialized by the caller.
+     * Returns an empty listing if there is none for that etag.
+     */
+    QByteArray discoveryListing(const QByteArray &path, const QByteArray &etag);
+    void setDiscoveryListing(const QByteArray &path, const QByteArray &etag, const QByteArray &listing);
+
+    /// Once a sync succeeded the file records are more recent than the listings
+    void clearDiscoveryListings();
+
+    /// Whether there is any listing, the discovery doesn't look for them otherwise
+    bool hasDiscoveryListings();
+
 
     // Conflict record functions
 
@@ -269,7 +365,8 @@ public:
 
     /** Grouping for all functions relating to pin states,
      *
-     * Use internalPinStates() to get at them.
+     * Use internalPinStates() to get at them. The lookups are answered from
+     * a PinStateTree that is loaded by the first of them.
      */
     struct OCSYNC_EXPORT PinStateInterface
     {
@@ -363,7 +460,12 @@ public:
     int autotestFailCounter = -1;
 
 private:
-    int getFileRecordCount();
+    /// The write of setFileRecord(), without the group commit
+    Result<void, QString> writeFileRecord(const SyncJournalFileRecord &record);
+    /// Fills _errorBlacklistPaths if needed, false on db error
+    bool loadErrorBlacklistPaths();
+    /// Fills _pinStateTree if needed, false on db error
+    bool loadPinStateTree();
     bool updateDatabaseStructure();
     bool updateMetadataTableStructure();
     bool updateErrorBlacklistTableStructure();
@@ -373,6 +475,12 @@ private:
     void commitTransaction();
     QVector<QByteArray> tableColumns(const QByteArray &table);
     bool checkConnect();
+    /// Sizes SQLite's page cache and memory mapping for the number of records
+    void adaptCacheSizes(int recordCount);
+    // Opens _readerDb, needs _readerMutex
+    bool checkReaderConnect();
+    // Closes _readerDb, it stays unused until checkConnect() succeeds again
+    void closeReader();
 
     // Same as forceRemoteDiscoveryNextSync but without acquiring the lock
     void forceRemoteDiscoveryNextSyncLocked();
@@ -388,6 +496,15 @@ private:
     QMap<QByteArray, int> _checksymTypeCache;
     int _transaction;
     bool _metadataTableIsEmpty;
+    bool _journalVersionChanged = false; // the journal was last opened by another client version
+
+    // See setGroupCommitPolicy()
+    int _groupCommitMaxRecords = 100;
+    std::chrono::milliseconds _groupCommitMaxDelay = std::chrono::seconds(1);
+    int _groupCommitRecords = 0; // written since the last commit
+    bool _groupCommitTimerPending = false; // the maxDelay timer of the first of them
+
+    WriteStatistics _writeStatistics;
 
     /* Storing etags to these folders, or their parent folders, is filtered out.
      *
@@ -404,6 +521,17 @@ private:
      */
     QList<QByteArray> _etagStorageFilter;
 
+    /* The paths in the blacklist table, see blacklistKey()
+     *
+     * The table usually has a handful of rows, errorBlacklistEntry() only
+     * queries it for paths in here. Loaded on first use, reset on close().
+     */
+    QSet<QString> _errorBlacklistPaths;
+    bool _errorBlacklistPathsLoaded = false;
+
+    // The flags table's pin states, loaded on first use and reset on close()
+    PinStateTree _pinStateTree;
+
     /** The journal mode to use for the db.
      *
      * Typically WAL initially, but may be set to other modes via environment
@@ -412,6 +540,13 @@ private:
     QByteArray _journalMode;
 
     PreparedSqlQueryManager _queryManager;
+
+    // The read-only connection of getCommittedFileRecord(), it has its own mutex
+    QMutex _readerMutex;
+    std::atomic<bool> _readerAllowed { false }; // while the main connection is open and checked
+    bool _readerFailed = false;
+    SqlDatabase _readerDb;
+    PreparedSqlQueryManager _readerQueryManager;
 };
 
 bool OCSYNC_EXPORT
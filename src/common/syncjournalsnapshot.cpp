@@ -0,0 +1,216 @@
+/*
+ * Copyright (C) by ownCloud GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "common/syncjournalsnapshot.h"
+#include "common/syncjournaldb.h"
+
+#include <QHash>
+
+#include <algorithm>
+#include <cstring>
+
+namespace OCC {
+
+// Compares a + '/' with b + '/', which is how the journal orders the names of siblings
+static int compareNames(const char *a, int aSize, const char *b, int bSize)
+{
+    const int commonSize = std::min(aSize, bSize);
+    const int cmp = std::memcmp(a, b, commonSize);
+    if (cmp != 0 || aSize == bSize)
+        return cmp;
+    if (aSize < bSize)
+        return int('/') - int(uchar(b[commonSize]));
+    return int(uchar(a[commonSize])) - int('/');
+}
+
+bool SyncJournalSnapshot::load(SyncJournalDb *journal)
+{
+    _entries.clear();
+    _children.clear();
+    _strings.clear();
+    _recordCount = 0;
+
+    _entries.reserve(size_t(std::max(journal->getFileRecordCount(), 0)) + 1);
+    _entries.emplace_back(); // the root
+    std::vector<quint32> parents { 0 };
+    QHash<QByteArray, StringRef> names;
+
+    const auto addString = [this](const QByteArray &str) {
+        StringRef ref;
+        ref.offset = quint32(_strings.size());
+        ref.size = quint32(str.size());
+        _strings.append(str);
+        return ref;
+    };
+    const auto addEntry = [&](quint32 parent, const QByteArray &name) {
+        auto nameIt = names.constFind(name);
+        if (nameIt == names.constEnd())
+            nameIt = names.insert(name, addString(name));
+        _entries.emplace_back();
+        _entries.back().name = *nameIt;
+        parents.push_back(parent);
+        return quint32(_entries.size() - 1);
+    };
+
+    // The directories that contain the current path, with their index.
+    // The journal lists a directory's contents right after the directory.
+    std::vector<std::pair<QByteArray, quint32>> directories;
+    const bool ok = journal->getFilesBelowPath(QByteArray(), [&](const SyncJournalFileRecord &rec) {
+        const QByteArray &path = rec._path;
+        while (!directories.empty()) {
+            const QByteArray &dir = directories.back().first;
+            if (path.size() > dir.size() && path[dir.size()] == '/' && path.startsWith(dir))
+                break;
+            directories.pop_back();
+        }
+        quint32 parent = directories.empty() ? 0 : directories.back().second;
+        int nameStart = directories.empty() ? 0 : directories.back().first.size() + 1;
+
+        // The parent directories may have no record of their own
+        for (int slash = path.indexOf('/', nameStart); slash != -1; slash = path.indexOf('/', nameStart)) {
+            parent = addEntry(parent, path.mid(nameStart, slash - nameStart));
+            directories.emplace_back(path.left(slash), parent);
+            nameStart = slash + 1;
+        }
+
+        const auto index = addEntry(parent, path.mid(nameStart));
+        auto &entry = _entries[index];
+        entry.etag = addString(rec._etag);
+        entry.fileId = addString(rec._fileId);
+        entry.checksumHeader = addString(rec._checksumHeader);
+        entry.inode = rec._inode;
+        entry.modtime = rec._modtime;
+        entry.fileSize = rec._fileSize;
+        entry.remotePerm = rec._remotePerm;
+        entry.type = rec._type;
+        entry.serverHasIgnoredFiles = rec._serverHasIgnoredFiles;
+        entry.hasRecord = true;
+        ++_recordCount;
+        directories.emplace_back(path, index);
+    });
+    if (!ok) {
+        _entries.clear();
+        _strings.clear();
+        _recordCount = 0;
+        return false;
+    }
+
+    // Lay out the children of each entry next to each other, in the order they were added
+    for (size_t i = 1; i < _entries.size(); ++i)
+        ++_entries[parents[i]].childCount;
+    quint32 firstChild = 0;
+    for (auto &entry : _entries) {
+        entry.firstChild = firstChild;
+        firstChild += entry.childCount;
+        entry.childCount = 0;
+    }
+    _children.resize(firstChild);
+    for (size_t i = 1; i < _entries.size(); ++i) {
+        auto &parent = _entries[parents[i]];
+        _children[parent.firstChild + parent.childCount++] = quint32(i);
+    }
+    return true;
+}
+
+QByteArray SyncJournalSnapshot::string(const StringRef &ref) const
+{
+    return QByteArray(_strings.constData() + ref.offset, int(ref.size));
+}
+
+int SyncJournalSnapshot::find(const QByteArray &path) const
+{
+    if (_entries.empty())
+        return -1;
+
+    quint32 index = 0;
+    for (int start = 0; start < path.size();) {
+        int end = path.indexOf('/', start);
+        if (end == -1)
+            end = path.size();
+        const char *name = path.constData() + start;
+        const int nameSize = end - start;
+
+        const auto &dir = _entries[index];
+        const auto first = _children.begin() + dir.firstChild;
+        const auto last = first + dir.childCount;
+        const auto it = std::lower_bound(first, last, 0, [&](quint32 child, int) {
+            const auto &ref = _entries[child].name;
+            return compareNames(_strings.constData() + ref.offset, int(ref.size), name, nameSize) < 0;
+        });
+        if (it == last)
+            return -1;
+        const auto &entry = _entries[*it];
+        if (entry.removed || compareNames(_strings.constData() + entry.name.offset, int(entry.name.size), name, nameSize) != 0)
+            return -1;
+
+        index = *it;
+        start = end + 1;
+    }
+    return int(index);
+}
+
+void SyncJournalSnapshot::fillRecord(const Entry &entry, const QByteArray &path, SyncJournalFileRecord *rec) const
+{
+    rec->_path = path;
+    rec->_inode = entry.inode;
+    rec->_modtime = entry.modtime;
+    rec->_type = entry.type;
+    rec->_etag = string(entry.etag);
+    rec->_fileId = string(entry.fileId);
+    rec->_remotePerm = entry.remotePerm;
+    rec->_fileSize = entry.fileSize;
+    rec->_serverHasIgnoredFiles = entry.serverHasIgnoredFiles;
+    rec->_checksumHeader = string(entry.checksumHeader);
+}
+
+void SyncJournalSnapshot::listFilesInPath(const QByteArray &path, const std::function<void(const SyncJournalFileRecord &)> &rowCallback) const
+{
+    const int index = find(path);
+    if (index == -1)
+        return;
+
+    const auto &dir = _entries[index];
+    for (quint32 i = dir.firstChild; i < dir.firstChild + dir.childCount; ++i) {
+        const auto &entry = _entries[_children[i]];
+        if (!entry.hasRecord || entry.removed)
+            continue;
+        const auto name = string(entry.name);
+        SyncJournalFileRecord rec;
+        fillRecord(entry, path.isEmpty() ? name : path + '/' + name, &rec);
+        rowCallback(rec);
+    }
+}
+
+void SyncJournalSnapshot::getFileRecord(const QByteArray &path, SyncJournalFileRecord *rec) const
+{
+    Q_ASSERT(rec);
+    rec->_path.clear();
+
+    const int index = find(path);
+    if (index > 0 && _entries[index].hasRecord)
+        fillRecord(_entries[index], path, rec);
+}
+
+void SyncJournalSnapshot::removeFileRecord(const QByteArray &path)
+{
+    // The entries below can't be found anymore either
+    const int index = find(path);
+    if (index > 0)
+        _entries[index].removed = true;
+}
+}
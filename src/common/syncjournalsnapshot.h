@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) by ownCloud GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#pragma once
+
+#include <QByteArray>
+
+#include <functional>
+#include <vector>
+
+#include "ocsynclib.h"
+#include "common/syncjournalfilerecord.h"
+
+namespace OCC {
+class SyncJournalDb;
+
+/**
+ * @brief A read-only copy of the journal's metadata table
+ *
+ * Loading the whole table with one query is a lot cheaper than running
+ * SyncJournalDb::listFilesInPath() for every directory of a large tree.
+ *
+ * The records are kept as a tree: The entries are in one vector, the names,
+ * etags, file ids and checksums in a single buffer and equal names are
+ * stored only once. Records are only built when they are asked for.
+ *
+ * The snapshot doesn't see later changes to the journal, except for
+ * removeFileRecord(). It isn't thread safe.
+ * @ingroup libsync
+ */
+class OCSYNC_EXPORT SyncJournalSnapshot
+{
+public:
+    /// Replaces the contents with all records of the journal, false on a database error
+    bool load(SyncJournalDb *journal);
+
+    /// The number of records that were loaded
+    int size() const { return _recordCount; }
+
+    /// Same as SyncJournalDb::listFilesInPath()
+    void listFilesInPath(const QByteArray &path, const std::function<void(const SyncJournalFileRecord &)> &rowCallback) const;
+
+    /// Same as SyncJournalDb::getFileRecord(), rec is invalid if there is no record for the path
+    void getFileRecord(const QByteArray &path, SyncJournalFileRecord *rec) const;
+
+    /// Forgets the record of the path and those below it, like SyncJournalDb::deleteFileRecord(path, true)
+    void removeFileRecord(const QByteArray &path);
+
+private:
+    // A string in _strings
+    struct StringRef
+    {
+        quint32 offset = 0;
+        quint32 size = 0;
+    };
+
+    struct Entry
+    {
+        StringRef name;
+        StringRef etag;
+        StringRef fileId;
+        StringRef checksumHeader;
+        quint64 inode = 0;
+        qint64 modtime = 0;
+        qint64 fileSize = 0;
+        // The children are _children[firstChild] to _children[firstChild + childCount - 1]
+        quint32 firstChild = 0;
+        quint32 childCount = 0;
+        RemotePermissions remotePerm;
+        ItemType type = ItemTypeSkip;
+        bool serverHasIgnoredFiles = false;
+        // Directories without a record of their own exist to hold their children
+        bool hasRecord = false;
+        bool removed = false;
+    };
+
+    QByteArray string(const StringRef &ref) const;
+
+    /// The index of the entry for the path, -1 if there is none
+    int find(const QByteArray &path) const;
+
+    void fillRecord(const Entry &entry, const QByteArray &path, SyncJournalFileRecord *rec) const;
+
+    // The entries in the order of the journal's paths, the root is the first one
+    std::vector<Entry> _entries;
+    // The indexes of each entry's children, in the order of the journal's paths
+    std::vector<quint32> _children;
+    QByteArray _strings;
+    int _recordCount = 0;
+};
+}
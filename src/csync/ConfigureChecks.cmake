@@ -29,4 +29,9 @@ endif()
 check_function_exists(utimes HAVE_UTIMES)
 check_function_exists(lstat HAVE_LSTAT)
 
+# glibc only declares statx with _GNU_SOURCE
+set(CMAKE_REQUIRED_DEFINITIONS -D_GNU_SOURCE)
+check_symbol_exists(statx "sys/stat.h" HAVE_STATX)
+unset(CMAKE_REQUIRED_DEFINITIONS)
+
 set(CSYNC_REQUIRED_LIBRARIES ${CMAKE_REQUIRED_LIBRARIES} CACHE INTERNAL "csync required system libraries")
@@ -9,5 +9,6 @@
 
 #cmakedefine HAVE_UTIMES 1
 #cmakedefine HAVE_LSTAT 1
+#cmakedefine HAVE_STATX 1
 
 
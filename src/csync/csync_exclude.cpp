@@ -38,6 +38,9 @@
 #include <QFileInfo>
 #include <QFile>
 #include <QDir>
+#include <QMutexLocker>
+
+#include <algorithm>
 
 namespace {
 
@@ -221,6 +224,12 @@ static CSYNC_EXCLUDE_TYPE _csync_excluded_common(const QStringRef &path, bool ex
     }
 #endif
 
+    /* Exclude files of a directory only apply locally, a sharer must not be able
+     * to hide other users' files by syncing one to them. */
+    if (bname == ExcludedFiles::directoryExcludeFileName()) {
+        return CSYNC_FILE_SILENTLY_EXCLUDED;
+    }
+
     /* Do not sync desktop.ini files anywhere in the tree. */
     const auto desktopIniFile = QStringLiteral("desktop.ini");
     if (blen == static_cast<qsizetype>(desktopIniFile.length()) && bname.compare(desktopIniFile, Qt::CaseInsensitive) == 0) {
@@ -238,7 +247,8 @@ static CSYNC_EXCLUDE_TYPE _csync_excluded_common(const QStringRef &path, bool ex
 using namespace OCC;
 
 ExcludedFiles::ExcludedFiles()
-    : _clientVersion(OCC::Version::version())
+    : _bnameCache(10000)
+    , _clientVersion(OCC::Version::version())
 {
     // Windows used to use PathMatchSpec which allows *foo to match abc/deffoo.
     _wildcardsMatchSlash = Utility::isWindows();
@@ -275,6 +285,8 @@ void ExcludedFiles::setWildcardsMatchSlash(bool onoff)
 {
     _wildcardsMatchSlash = onoff;
     prepare();
+    for (const auto &dir : qAsConst(_directoryExcludes))
+        dir.excludes->setWildcardsMatchSlash(onoff);
 }
 
 void ExcludedFiles::setClientVersion(QVersionNumber version)
@@ -282,6 +294,60 @@ void ExcludedFiles::setClientVersion(QVersionNumber version)
     _clientVersion = version;
 }
 
+QString ExcludedFiles::directoryExcludeFileName()
+{
+    return QStringLiteral(".sync-exclude.lst");
+}
+
+void ExcludedFiles::updateDirectoryExcludeFile(const QString &dirPath, const QString &filePath, qint64 modtime, qint64 size)
+{
+    auto &dir = _directoryExcludes[dirPath];
+    if (dir.excludes && dir.modtime == modtime && dir.size == size)
+        return;
+
+    // The directory's patterns get their own instance so that each one is
+    // compiled on its own and only this one needs to be prepared again
+    dir.excludes.reset(new ExcludedFiles);
+    dir.excludes->_wildcardsMatchSlash = _wildcardsMatchSlash;
+    dir.excludes->_clientVersion = _clientVersion;
+    dir.excludes->addExcludeFilePath(filePath);
+    dir.excludes->reloadExcludeFiles();
+    dir.modtime = modtime;
+    dir.size = size;
+    _directoryExcludeHashes.insert(qHash(dirPath));
+}
+
+void ExcludedFiles::removeDirectoryExcludeFile(const QString &dirPath)
+{
+    if (_directoryExcludes.remove(dirPath))
+        updateDirectoryExcludeHashes();
+}
+
+void ExcludedFiles::removeDirectoryExcludeFiles(const QString &dirPath)
+{
+    if (_directoryExcludes.isEmpty())
+        return;
+    bool removed = _directoryExcludes.remove(dirPath) > 0;
+    const QString prefix = dirPath + QLatin1Char('/');
+    for (auto it = _directoryExcludes.begin(); it != _directoryExcludes.end();) {
+        if (it.key().startsWith(prefix)) {
+            it = _directoryExcludes.erase(it);
+            removed = true;
+        } else {
+            ++it;
+        }
+    }
+    if (removed)
+        updateDirectoryExcludeHashes();
+}
+
+void ExcludedFiles::updateDirectoryExcludeHashes()
+{
+    _directoryExcludeHashes.clear();
+    for (auto it = _directoryExcludes.cbegin(); it != _directoryExcludes.cend(); ++it)
+        _directoryExcludeHashes.insert(qHash(it.key()));
+}
+
 bool ExcludedFiles::reloadExcludeFiles()
 {
     _allExcludes.clear();
@@ -396,8 +462,15 @@ bool ExcludedFiles::isExcludedRemote(const QString &filePath, const QString &bas
 CSYNC_EXCLUDE_TYPE ExcludedFiles::traversalPatternMatch(const QStringRef &path, ItemType filetype) const
 {
     auto match = _csync_excluded_common(path, _excludeConflictFiles);
-    if (match != CSYNC_NOT_EXCLUDED)
-        return match;
+    if (match == CSYNC_NOT_EXCLUDED)
+        match = traversalExcludesMatch(path, filetype);
+    if (match == CSYNC_NOT_EXCLUDED)
+        match = directoryExcludesMatch(path, filetype, true);
+    return match;
+}
+
+CSYNC_EXCLUDE_TYPE ExcludedFiles::traversalExcludesMatch(const QStringRef &path, ItemType filetype) const
+{
     if (_allExcludes.isEmpty())
         return CSYNC_NOT_EXCLUDED;
 
@@ -409,23 +482,22 @@ CSYNC_EXCLUDE_TYPE ExcludedFiles::traversalPatternMatch(const QStringRef &path,
         bnameStr = path.mid(lastSlash + 1);
     }
 
-    QRegularExpressionMatch m;
-    if (filetype == ItemTypeDirectory) {
-        m = _bnameTraversalRegexDir.match(bnameStr);
-    } else {
-        m = _bnameTraversalRegexFile.match(bnameStr);
-    }
-    if (!m.hasMatch())
+    switch (cachedBnameMatch(bnameStr, filetype)) {
+    case BnameMatcher::NoMatch:
         return CSYNC_NOT_EXCLUDED;
-    if (m.capturedStart(QStringLiteral("exclude")) != -1) {
+    case BnameMatcher::Exclude:
         return CSYNC_FILE_EXCLUDE_LIST;
-    } else if (m.capturedStart(QStringLiteral("excluderemove")) != -1) {
+    case BnameMatcher::ExcludeRemove:
         return CSYNC_FILE_EXCLUDE_AND_REMOVE;
+    case BnameMatcher::Trigger:
+        break;
     }
 
-    // third capture: full path matching is triggered
+    // full path matching is triggered
     QStringRef pathStr = path;
 
+    QRegularExpressionMatch m;
+
     if (filetype == ItemTypeDirectory) {
         m = _fullTraversalRegexDir.match(pathStr);
     } else {
@@ -441,11 +513,36 @@ CSYNC_EXCLUDE_TYPE ExcludedFiles::traversalPatternMatch(const QStringRef &path,
     return CSYNC_NOT_EXCLUDED;
 }
 
+ExcludedFiles::BnameMatcher::Kind ExcludedFiles::cachedBnameMatch(const QStringRef &bname, ItemType filetype) const
+{
+    const QString key = _bnameMatcher.key(bname);
+    const int type = filetype == ItemTypeDirectory ? 1 : 0;
+
+    QMutexLocker lock(&_bnameCacheMutex);
+    auto *cached = _bnameCache.object(key);
+    if (!cached) {
+        cached = new CachedBnameMatch;
+        _bnameCache.insert(key, cached);
+    }
+    if (!cached->known[type]) {
+        cached->kinds[type] = _bnameMatcher.match(key, filetype);
+        cached->known[type] = true;
+    }
+    return cached->kinds[type];
+}
+
 CSYNC_EXCLUDE_TYPE ExcludedFiles::fullPatternMatch(const QStringRef &p, ItemType filetype) const
 {
     auto match = _csync_excluded_common(p, _excludeConflictFiles);
-    if (match != CSYNC_NOT_EXCLUDED)
-        return match;
+    if (match == CSYNC_NOT_EXCLUDED)
+        match = fullExcludesMatch(p, filetype);
+    if (match == CSYNC_NOT_EXCLUDED)
+        match = directoryExcludesMatch(p, filetype, false);
+    return match;
+}
+
+CSYNC_EXCLUDE_TYPE ExcludedFiles::fullExcludesMatch(const QStringRef &p, ItemType filetype) const
+{
     if (_allExcludes.isEmpty())
         return CSYNC_NOT_EXCLUDED;
 
@@ -465,6 +562,33 @@ CSYNC_EXCLUDE_TYPE ExcludedFiles::fullPatternMatch(const QStringRef &p, ItemType
     return CSYNC_NOT_EXCLUDED;
 }
 
+CSYNC_EXCLUDE_TYPE ExcludedFiles::directoryExcludesMatch(const QStringRef &path, ItemType filetype, bool traversal) const
+{
+    if (_directoryExcludes.isEmpty())
+        return CSYNC_NOT_EXCLUDED;
+
+    // Walk up from the parent directory to the root
+    int dirLength = path.size();
+    while (dirLength > 0) {
+        const int slash = path.lastIndexOf(QLatin1Char('/'), dirLength - 1);
+        dirLength = std::max(slash, 0);
+        // qHash() of a QStringRef equals that of the QString, only a likely match is copied
+        const auto dirPath = path.left(dirLength);
+        if (!_directoryExcludeHashes.contains(qHash(dirPath)))
+            continue;
+        const auto it = _directoryExcludes.constFind(dirPath.toString());
+        if (it == _directoryExcludes.constEnd())
+            continue;
+        const auto relativePath = path.mid(slash + 1);
+        const auto match = traversal
+            ? it->excludes->traversalExcludesMatch(relativePath, filetype)
+            : it->excludes->fullExcludesMatch(relativePath, filetype);
+        if (match != CSYNC_NOT_EXCLUDED)
+            return match;
+    }
+    return CSYNC_NOT_EXCLUDED;
+}
+
 /**
  * On linux we used to use fnmatch with FNM_PATHNAME, but the windows function we used
  * didn't have that behavior. wildcardsMatchSlash can be used to control which behavior
@@ -600,7 +724,7 @@ void ExcludedFiles::prepare()
 {
     // Build regular expressions for the different cases.
     //
-    // To compose the _bnameTraversalRegex, _fullTraversalRegex and _fullRegex
+    // To compose the _bnameMatcher, _fullTraversalRegex and _fullRegex
     // patterns we collect several subgroups of patterns here.
     //
     // * The "full" group will contain all patterns that contain a non-trailing
@@ -609,7 +733,7 @@ void ExcludedFiles::prepare()
     //   These need separate handling in the _fullRegex (slash-containing
     //   patterns must be anchored to the front, these don't need it)
     // * The "bnameTrigger" group contains the bname part of all patterns in the
-    //   "full" group. These and the "bname" group become _bnameTraversalRegex.
+    //   "full" group. These and the "bname" group go into _bnameMatcher.
     //
     // To complicate matters, the exclude patterns have two binary attributes
     // meaning we'll end up with 4 variants:
@@ -629,8 +753,11 @@ void ExcludedFiles::prepare()
     QString bnameDirKeep;
     QString bnameDirRemove;
 
-    QString bnameTriggerFileDir;
-    QString bnameTriggerDir;
+    _bnameMatcher.clear(OCC::Utility::fsCasePreserving());
+    {
+        QMutexLocker lock(&_bnameCacheMutex);
+        _bnameCache.clear();
+    }
 
     auto regexAppend = [](QString &fileDirPattern, QString &dirPattern, const QString &appendMe, bool dirOnly) {
         QString &pattern = dirOnly ? dirPattern : fileDirPattern;
@@ -664,15 +791,17 @@ void ExcludedFiles::prepare()
         auto regexExclude = convertToRegexpSyntax(exclude, _wildcardsMatchSlash);
         if (!fullPath) {
             regexAppend(bnameFileDir, bnameDir, regexExclude, matchDirOnly);
+            _bnameMatcher.addPattern(exclude, removeExcluded ? BnameMatcher::ExcludeRemove : BnameMatcher::Exclude,
+                matchDirOnly, _wildcardsMatchSlash);
         } else {
             regexAppend(fullFileDir, fullDir, regexExclude, matchDirOnly);
 
             // For activation, trigger on the 'bname' part of the full pattern.
             QString bnameExclude = extractBnameTrigger(exclude, _wildcardsMatchSlash);
-            auto regexBname = convertToRegexpSyntax(bnameExclude, true);
-            regexAppend(bnameTriggerFileDir, bnameTriggerDir, regexBname, matchDirOnly);
+            _bnameMatcher.addPattern(bnameExclude, BnameMatcher::Trigger, matchDirOnly, true);
         }
     }
+    _bnameMatcher.finish();
 
     // The empty pattern would match everything - change it to match-nothing
     auto emptyMatchNothing = [](QString &pattern) {
@@ -689,25 +818,6 @@ void ExcludedFiles::prepare()
     emptyMatchNothing(bnameDirKeep);
     emptyMatchNothing(bnameDirRemove);
 
-    emptyMatchNothing(bnameTriggerFileDir);
-    emptyMatchNothing(bnameTriggerDir);
-
-    // The bname regex is applied to the bname only, so it must be
-    // anchored in the beginning and in the end. It has the structure:
-    // (exclude)|(excluderemove)|(bname triggers).
-    // If the third group matches, the fullActivatedRegex needs to be applied
-    // to the full path.
-    _bnameTraversalRegexFile.setPattern(
-        QStringLiteral("^(?P<exclude>%1)$|"
-                       "^(?P<excluderemove>%2)$|"
-                       "^(?P<trigger>%3)$")
-            .arg(bnameFileDirKeep, bnameFileDirRemove, bnameTriggerFileDir));
-    _bnameTraversalRegexDir.setPattern(
-        QStringLiteral("^(?P<exclude>%1|%2)$|"
-                       "^(?P<excluderemove>%3|%4)$|"
-                       "^(?P<trigger>%5|%6)$")
-            .arg(bnameFileDirKeep, bnameDirKeep, bnameFileDirRemove, bnameDirRemove, bnameTriggerFileDir, bnameTriggerDir));
-
     // The full traveral regex is applied to the full path if the trigger capture of
     // the bname regex matches. Its basic form is (exclude)|(excluderemove)".
     // This pattern can be much simpler than fullRegex since we can assume a traversal
@@ -754,10 +864,6 @@ void ExcludedFiles::prepare()
     QRegularExpression::PatternOptions patternOptions = QRegularExpression::NoPatternOption;
     if (OCC::Utility::fsCasePreserving())
         patternOptions |= QRegularExpression::CaseInsensitiveOption;
-    _bnameTraversalRegexFile.setPatternOptions(patternOptions);
-    _bnameTraversalRegexFile.optimize();
-    _bnameTraversalRegexDir.setPatternOptions(patternOptions);
-    _bnameTraversalRegexDir.optimize();
     _fullTraversalRegexFile.setPatternOptions(patternOptions);
     _fullTraversalRegexFile.optimize();
     _fullTraversalRegexDir.setPatternOptions(patternOptions);
@@ -767,3 +873,158 @@ void ExcludedFiles::prepare()
     _fullRegexDir.setPatternOptions(patternOptions);
     _fullRegexDir.optimize();
 }
+
+void ExcludedFiles::BnameMatcher::Result::add(Kind kind, bool dirOnly)
+{
+    if (!dirOnly)
+        file = std::min(file, kind);
+    dir = std::min(dir, kind);
+}
+
+void ExcludedFiles::BnameMatcher::Result::add(const Result &other)
+{
+    file = std::min(file, other.file);
+    dir = std::min(dir, other.dir);
+}
+
+void ExcludedFiles::BnameMatcher::clear(bool caseInsensitive)
+{
+    _caseInsensitive = caseInsensitive;
+    _literals.clear();
+    _prefixTrie.assign(1, TrieNode());
+    _suffixTrie.assign(1, TrieNode());
+    for (auto &patterns : _regexPatterns) {
+        for (auto &pattern : patterns)
+            pattern.clear();
+    }
+    _regexFile = QRegularExpression();
+    _regexDir = QRegularExpression();
+}
+
+void ExcludedFiles::BnameMatcher::trieInsert(std::vector<TrieNode> &trie, const QString &key, bool reversed, Kind kind, bool dirOnly)
+{
+    int node = 0;
+    for (int i = 0; i < key.size(); ++i) {
+        const QChar c = key.at(reversed ? key.size() - 1 - i : i);
+        auto &children = trie[node].children;
+        auto it = std::find_if(children.cbegin(), children.cend(), [c](const auto &child) { return child.first == c; });
+        if (it != children.cend()) {
+            node = it->second;
+        } else {
+            const int child = int(trie.size());
+            children.emplace_back(c, child);
+            trie.emplace_back();
+            node = child;
+        }
+    }
+    trie[node].result.add(kind, dirOnly);
+}
+
+void ExcludedFiles::BnameMatcher::addPattern(const QString &pattern, Kind kind, bool dirOnly, bool wildcardsMatchSlash)
+{
+    // The bname never contains a slash, so the wildcards behave the same either way
+    auto isLiteral = [](const QStringRef &str) {
+        return std::none_of(str.cbegin(), str.cend(), [](QChar c) {
+            return c == QLatin1Char('*') || c == QLatin1Char('?') || c == QLatin1Char('[') || c == QLatin1Char('\\');
+        });
+    };
+    const QString key = _caseInsensitive ? pattern.toCaseFolded() : pattern;
+
+    if (isLiteral(QStringRef(&key))) {
+        _literals[key].add(kind, dirOnly);
+    } else if (key.startsWith(QLatin1Char('*')) && isLiteral(key.midRef(1))) {
+        trieInsert(_suffixTrie, key.mid(1), true, kind, dirOnly);
+    } else if (key.endsWith(QLatin1Char('*')) && isLiteral(key.leftRef(key.size() - 1))) {
+        trieInsert(_prefixTrie, key.left(key.size() - 1), false, kind, dirOnly);
+    } else {
+        QString &regex = _regexPatterns[kind][dirOnly ? 1 : 0];
+        if (!regex.isEmpty())
+            regex.append(QLatin1Char('|'));
+        regex.append(convertToRegexpSyntax(pattern, wildcardsMatchSlash));
+    }
+}
+
+void ExcludedFiles::BnameMatcher::finish()
+{
+    auto build = [this](QRegularExpression &regex, bool isDir) {
+        QString groups[NoMatch];
+        bool needed = false;
+        for (int kind = 0; kind < NoMatch; ++kind) {
+            for (int dirOnly = 0; dirOnly <= (isDir ? 1 : 0); ++dirOnly) {
+                const QString &pattern = _regexPatterns[kind][dirOnly];
+                if (pattern.isEmpty())
+                    continue;
+                if (!groups[kind].isEmpty())
+                    groups[kind].append(QLatin1Char('|'));
+                groups[kind].append(pattern);
+                needed = true;
+            }
+            // The empty pattern would match everything - change it to match-nothing
+            if (groups[kind].isEmpty())
+                groups[kind] = QStringLiteral("a^");
+        }
+        if (!needed) {
+            regex = QRegularExpression();
+            return;
+        }
+        // Applied to the bname only, so anchored in the beginning and in the end
+        regex.setPattern(
+            QStringLiteral("^(?P<exclude>%1)$|"
+                           "^(?P<excluderemove>%2)$|"
+                           "^(?P<trigger>%3)$")
+                .arg(groups[Exclude], groups[ExcludeRemove], groups[Trigger]));
+        regex.setPatternOptions(_caseInsensitive ? QRegularExpression::CaseInsensitiveOption : QRegularExpression::NoPatternOption);
+        regex.optimize();
+    };
+    build(_regexFile, false);
+    build(_regexDir, true);
+}
+
+QString ExcludedFiles::BnameMatcher::key(const QStringRef &bname) const
+{
+    // Folds the copy in place
+    return _caseInsensitive ? bname.toString().toCaseFolded() : bname.toString();
+}
+
+ExcludedFiles::BnameMatcher::Kind ExcludedFiles::BnameMatcher::match(const QString &key, ItemType filetype) const
+{
+    const bool isDir = filetype == ItemTypeDirectory;
+
+    Result result;
+    auto literalIt = _literals.constFind(key);
+    if (literalIt != _literals.cend())
+        result.add(*literalIt);
+
+    // Every node on the path is a pattern matching the bname
+    auto walk = [&](const std::vector<TrieNode> &trie, bool reversed) {
+        int node = 0;
+        result.add(trie[node].result);
+        for (int i = 0; i < key.size(); ++i) {
+            const QChar c = key.at(reversed ? key.size() - 1 - i : i);
+            const auto &children = trie[node].children;
+            auto it = std::find_if(children.cbegin(), children.cend(), [c](const auto &child) { return child.first == c; });
+            if (it == children.cend())
+                return;
+            node = it->second;
+            result.add(trie[node].result);
+        }
+    };
+    walk(_prefixTrie, false);
+    walk(_suffixTrie, true);
+
+    Kind kind = isDir ? result.dir : result.file;
+    if (kind == Exclude)
+        return kind;
+
+    const QRegularExpression &regex = isDir ? _regexDir : _regexFile;
+    if (regex.pattern().isEmpty())
+        return kind;
+    const auto m = regex.match(key);
+    if (!m.hasMatch())
+        return kind;
+    if (m.capturedStart(QStringLiteral("exclude")) != -1)
+        return Exclude;
+    if (m.capturedStart(QStringLiteral("excluderemove")) != -1)
+        return ExcludeRemove;
+    return std::min(kind, Trigger);
+}
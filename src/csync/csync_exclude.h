@@ -25,13 +25,18 @@
 
 #include "csync.h"
 
+#include <QCache>
+#include <QHash>
+#include <QMutex>
 #include <QObject>
 #include <QRegularExpression>
 #include <QSet>
+#include <QSharedPointer>
 #include <QString>
 #include <QVersionNumber>
 
 #include <functional>
+#include <vector>
 
 enum CSYNC_EXCLUDE_TYPE {
     CSYNC_NOT_EXCLUDED = 0,
@@ -145,6 +150,40 @@ public:
      */
     CSYNC_EXCLUDE_TYPE traversalPatternMatch(const QStringRef &path, ItemType filetype) const;
 
+    /**
+     * The name of the files with exclude patterns for a single directory.
+     *
+     * Like a .gitignore, the patterns of such a file apply to the paths below
+     * its directory, relative to it, in addition to the global patterns.
+     * The files themselves are excluded from the sync: they only affect the
+     * local tree they were put into, not the trees of the users it is shared with.
+     */
+    static QString directoryExcludeFileName();
+
+    /**
+     * Loads the exclude file of a directory.
+     *
+     * The patterns are only compiled again if modtime or size changed since
+     * the file was last loaded, the other directories' patterns are kept.
+     *
+     * @param dirPath   folder-relative path of the directory, empty for the root
+     * @param filePath  the absolute path to the exclude file
+     */
+    void updateDirectoryExcludeFile(const QString &dirPath, const QString &filePath, qint64 modtime, qint64 size);
+
+    /**
+     * Forgets the patterns of a directory that has no exclude file (anymore).
+     */
+    void removeDirectoryExcludeFile(const QString &dirPath);
+
+    /**
+     * Forgets the patterns of a directory and of all directories below it.
+     *
+     * For directories that were removed, renamed or excluded, the discovery
+     * doesn't visit them anymore.
+     */
+    void removeDirectoryExcludeFiles(const QString &dirPath);
+
 public slots:
     /**
      * Reloads the exclude patterns from the registered paths.
@@ -179,6 +218,19 @@ private:
      */
     CSYNC_EXCLUDE_TYPE fullPatternMatch(const QStringRef &path, ItemType filetype) const;
 
+    /// The pattern part of traversalPatternMatch(), without the directory exclude files
+    CSYNC_EXCLUDE_TYPE traversalExcludesMatch(const QStringRef &path, ItemType filetype) const;
+
+    /// The pattern part of fullPatternMatch(), without the directory exclude files
+    CSYNC_EXCLUDE_TYPE fullExcludesMatch(const QStringRef &path, ItemType filetype) const;
+
+    /**
+     * Match the path against the exclude files of the directories above it.
+     *
+     * Each directory's patterns see the path relative to that directory.
+     */
+    CSYNC_EXCLUDE_TYPE directoryExcludesMatch(const QStringRef &path, ItemType filetype, bool traversal) const;
+
     /**
      * Generate optimized regular expressions for the exclude patterns.
      *
@@ -200,8 +252,8 @@ private:
      *   full("a/b/c/d") == traversal("a") || traversal("a/b") || traversal("a/b/c")
      *
      * The traversal matcher can be extremely fast because it has a fast early-out
-     * case: It checks the bname part of the path against _bnameTraversalRegex
-     * and only runs a simplified _fullTraversalRegex on the whole path if bname
+     * case: It checks the bname part of the path with _bnameMatcher and only
+     * runs a simplified _fullTraversalRegex on the whole path if bname
      * activation for it was triggered.
      *
      * Note: The traversal matcher will return not-excluded on some paths that the
@@ -222,14 +274,99 @@ private:
     /// List of all active exclude patterns
     QStringList _allExcludes;
 
+    /**
+     * Matches the bname part of a path in traversalPatternMatch()
+     *
+     * Most exclude patterns are plain names, "*.ext" or "prefix*". These are
+     * looked up in a hash and in a prefix and a suffix trie. Only the remaining
+     * patterns are combined into regular expressions.
+     */
+    class BnameMatcher
+    {
+    public:
+        /// The outcome of a match, smaller values take precedence
+        enum Kind : quint8 {
+            Exclude, // excluded
+            ExcludeRemove, // excluded, may be removed
+            Trigger, // the full path must be checked
+            NoMatch
+        };
+
+        void clear(bool caseInsensitive);
+        void addPattern(const QString &pattern, Kind kind, bool dirOnly, bool wildcardsMatchSlash);
+        /// Builds the regular expressions, call after the last addPattern()
+        void finish();
+
+        /// The bname as match() expects it, case folded if the patterns are case insensitive
+        QString key(const QStringRef &bname) const;
+        Kind match(const QString &key, ItemType filetype) const;
+
+    private:
+        // The best match for files and for directories
+        struct Result
+        {
+            Kind file = NoMatch;
+            Kind dir = NoMatch;
+            void add(Kind kind, bool dirOnly);
+            void add(const Result &other);
+        };
+        struct TrieNode
+        {
+            std::vector<std::pair<QChar, int>> children;
+            Result result;
+        };
+        static void trieInsert(std::vector<TrieNode> &trie, const QString &key, bool reversed, Kind kind, bool dirOnly);
+
+        QHash<QString, Result> _literals;
+        std::vector<TrieNode> _prefixTrie; // "prefix*", keyed by the prefix
+        std::vector<TrieNode> _suffixTrie; // "*suffix", keyed by the reversed suffix
+        bool _caseInsensitive = false;
+
+        // The remaining patterns, by kind and for all types or directories only
+        QString _regexPatterns[NoMatch][2];
+        QRegularExpression _regexFile;
+        QRegularExpression _regexDir;
+    };
+
     /// see prepare()
-    QRegularExpression _bnameTraversalRegexFile;
-    QRegularExpression _bnameTraversalRegexDir;
+    BnameMatcher _bnameMatcher;
+
+    /// _bnameMatcher.match() through _bnameCache, emptied by prepare()
+    BnameMatcher::Kind cachedBnameMatch(const QStringRef &bname, ItemType filetype) const;
+
+    /// The results for files and for directories, each computed when first needed
+    struct CachedBnameMatch
+    {
+        BnameMatcher::Kind kinds[2] = { BnameMatcher::NoMatch, BnameMatcher::NoMatch };
+        bool known[2] = { false, false };
+    };
+
+    /**
+     * The bname match results by BnameMatcher::key().
+     *
+     * The same names repeat all over a tree, so most matches are cache hits.
+     */
+    mutable QCache<QString, CachedBnameMatch> _bnameCache;
+    mutable QMutex _bnameCacheMutex;
     QRegularExpression _fullTraversalRegexFile;
     QRegularExpression _fullTraversalRegexDir;
     QRegularExpression _fullRegexFile;
     QRegularExpression _fullRegexDir;
 
+    struct DirectoryExcludes
+    {
+        qint64 modtime = 0;
+        qint64 size = 0;
+        QSharedPointer<ExcludedFiles> excludes;
+    };
+
+    /// The loaded exclude files by folder-relative directory path, see updateDirectoryExcludeFile()
+    QHash<QString, DirectoryExcludes> _directoryExcludes;
+
+    /// qHash() of the keys of _directoryExcludes, the ancestors of a path are looked up without copying them
+    QSet<uint> _directoryExcludeHashes;
+    void updateDirectoryExcludeHashes();
+
     bool _excludeConflictFiles = true;
 
     /**
@@ -26,6 +26,8 @@
 #include <dirent.h>
 #include <stdio.h>
 
+#include <atomic>
+
 #include "c_private.h"
 #include "c_lib.h"
 #include "csync.h"
@@ -35,6 +37,7 @@
 
 #include <QtCore/QLoggingCategory>
 #include <QtCore/QFile>
+#include <QtCore/QTextCodec>
 
 Q_LOGGING_CATEGORY(lcCSyncVIOLocal, "sync.csync.vio_local", QtInfoMsg)
 
@@ -48,6 +51,8 @@ struct csync_vio_handle_t {
 };
 
 static int _csync_vio_local_stat_mb(const mbchar_t *wuri, csync_file_stat_t *buf);
+static int _csync_vio_local_stat_entry(csync_vio_handle_t *handle, const char *name, csync_file_stat_t *buf);
+static QByteArray _csync_vio_local_entry_name(const char *name);
 
 csync_vio_handle_t *csync_vio_local_opendir(const QString &name) {
     QScopedPointer<csync_vio_handle_t> handle(new csync_vio_handle_t{});
@@ -82,10 +87,9 @@ std::unique_ptr<csync_file_stat_t> csync_vio_local_readdir(csync_vio_handle_t *h
   } while (qstrcmp(dirent->d_name, ".") == 0 || qstrcmp(dirent->d_name, "..") == 0);
 
   file_stat.reset(new csync_file_stat_t);
-  file_stat->path = QFile::decodeName(dirent->d_name).toUtf8();
-  QByteArray fullPath = handle->path % '/' % QByteArray() % const_cast<const char *>(dirent->d_name);
+  file_stat->path = _csync_vio_local_entry_name(dirent->d_name);
   if (file_stat->path.isNull()) {
-      file_stat->original_path = fullPath;
+      file_stat->original_path = handle->path % '/' % QByteArray() % const_cast<const char *>(dirent->d_name);
       qCWarning(lcCSyncVIOLocal) << "Invalid characters in file/directory name, please rename:" << dirent->d_name << handle->path;
   }
 
@@ -113,7 +117,7 @@ std::unique_ptr<csync_file_stat_t> csync_vio_local_readdir(csync_vio_handle_t *h
   if (file_stat->path.isNull())
       return file_stat;
 
-  if (_csync_vio_local_stat_mb(fullPath.constData(), file_stat.get()) < 0) {
+  if (_csync_vio_local_stat_entry(handle, dirent->d_name, file_stat.get()) < 0) {
       // Will get excluded by _csync_detect_update.
       file_stat->type = ItemTypeSkip;
   }
@@ -134,15 +138,9 @@ int csync_vio_local_stat(const QString &uri, csync_file_stat_t *buf)
     return _csync_vio_local_stat_mb(QFile::encodeName(uri).constData(), buf);
 }
 
-static int _csync_vio_local_stat_mb(const mbchar_t *wuri, csync_file_stat_t *buf)
+static void _csync_vio_local_fill_stat(csync_file_stat_t *buf, mode_t mode, uint64_t inode, time_t modtime, int64_t size)
 {
-    csync_stat_t sb;
-
-    if (_tstat(wuri, &sb) < 0) {
-        return -1;
-    }
-
-    switch (sb.st_mode & S_IFMT) {
+    switch (mode & S_IFMT) {
     case S_IFDIR:
       buf->type = ItemTypeDirectory;
       break;
@@ -158,14 +156,124 @@ static int _csync_vio_local_stat_mb(const mbchar_t *wuri, csync_file_stat_t *buf
       break;
   }
 
+  buf->inode = inode;
+  buf->modtime = modtime;
+  buf->size = size;
+}
+
+static int _csync_vio_local_stat_mb(const mbchar_t *wuri, csync_file_stat_t *buf)
+{
+    csync_stat_t sb;
+
+    if (_tstat(wuri, &sb) < 0) {
+        return -1;
+    }
+
+    _csync_vio_local_fill_stat(buf, sb.st_mode, sb.st_ino, sb.st_mtime, sb.st_size);
+
 #ifdef __APPLE__
   if (sb.st_flags & UF_HIDDEN) {
       buf->is_hidden = true;
   }
 #endif
-
-  buf->inode = sb.st_ino;
-  buf->modtime = sb.st_mtime;
-  buf->size = sb.st_size;
   return 0;
 }
+
+/*
+ * Stat a directory entry without symlink resolution.
+ *
+ * On Linux the name is resolved relative to the open directory, so the
+ * kernel doesn't have to walk the full path again for every entry.
+ */
+static int _csync_vio_local_stat_entry(csync_vio_handle_t *handle, const char *name, csync_file_stat_t *buf)
+{
+#ifdef __linux__
+    const int fd = dirfd(handle->dh);
+#ifdef HAVE_STATX
+    // Old kernels don't have statx even if the libc does, and seccomp filters of
+    // sandboxes and containers often refuse it with EPERM. It's never tried again
+    // after that. EINVAL comes from kernels and file systems that reject the request.
+    static std::atomic<bool> statxUnsupported(false);
+    if (!statxUnsupported.load(std::memory_order_relaxed)) {
+        static const unsigned int neededMask = STATX_TYPE | STATX_INO | STATX_MTIME | STATX_SIZE;
+        struct statx stx;
+        if (statx(fd, name, AT_SYMLINK_NOFOLLOW, neededMask, &stx) == 0) {
+            // File systems may leave out fields, fstatat() has them all
+            if ((stx.stx_mask & neededMask) == neededMask) {
+                _csync_vio_local_fill_stat(buf, stx.stx_mode, stx.stx_ino, stx.stx_mtime.tv_sec, stx.stx_size);
+                return 0;
+            }
+        } else if (errno == ENOSYS || errno == EPERM || errno == EINVAL) {
+            statxUnsupported.store(true, std::memory_order_relaxed);
+        } else {
+            return -1;
+        }
+    }
+#endif
+    struct stat sb;
+    if (fstatat(fd, name, &sb, AT_SYMLINK_NOFOLLOW) < 0) {
+        return -1;
+    }
+    _csync_vio_local_fill_stat(buf, sb.st_mode, sb.st_ino, sb.st_mtime, sb.st_size);
+    return 0;
+#else
+    QByteArray fullPath = handle->path % '/' % QByteArray() % name;
+    return _csync_vio_local_stat_mb(fullPath.constData(), buf);
+#endif
+}
+
+#ifdef __linux__
+static bool _csync_vio_local_is_valid_utf8(const char *str)
+{
+    static const uint32_t minCodePoint[] = { 0, 0, 0x80, 0x800, 0x10000 };
+    auto s = reinterpret_cast<const unsigned char *>(str);
+    while (*s) {
+        if (*s < 0x80) {
+            ++s;
+            continue;
+        }
+        int len;
+        uint32_t cp;
+        if ((*s & 0xE0) == 0xC0) {
+            len = 2;
+            cp = *s & 0x1F;
+        } else if ((*s & 0xF0) == 0xE0) {
+            len = 3;
+            cp = *s & 0x0F;
+        } else if ((*s & 0xF8) == 0xF0) {
+            len = 4;
+            cp = *s & 0x07;
+        } else {
+            return false;
+        }
+        for (int i = 1; i < len; ++i) {
+            // also stops at the terminating '\0'
+            if ((s[i] & 0xC0) != 0x80)
+                return false;
+            cp = (cp << 6) | (s[i] & 0x3F);
+        }
+        // overlong encodings, surrogates and values beyond Unicode
+        if (cp < minCodePoint[len] || cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF))
+            return false;
+        s += len;
+    }
+    return true;
+}
+#endif
+
+/*
+ * The UTF-8 name of a directory entry, null if it can't be represented.
+ *
+ * With a UTF-8 locale a name that is valid UTF-8 is returned as it is,
+ * the decode/encode round trip through QString wouldn't change it.
+ */
+static QByteArray _csync_vio_local_entry_name(const char *name)
+{
+#ifdef __linux__
+    static const bool localeIsUtf8 = QTextCodec::codecForLocale()->mibId() == 106;
+    if (localeIsUtf8 && _csync_vio_local_is_valid_utf8(name)) {
+        return QByteArray(name);
+    }
+#endif
+    return QFile::decodeName(name).toUtf8();
+}
@@ -41,6 +41,7 @@
 
 #include <QTimer>
 #include <QUrl>
+#include <QtConcurrent>
 #include <QDir>
 #include <QSettings>
 
@@ -127,6 +128,16 @@ Folder::Folder(const FolderDefinition &definition,
     connect(&_scheduleSelfTimer, &QTimer::timeout,
         this, &Folder::slotScheduleThisFolder);
 
+    // Vacuum and checkpoint the journal once the folder was idle for a while
+    _journalMaintenanceTimer.setSingleShot(true);
+    _journalMaintenanceTimer.setInterval(std::chrono::minutes(1));
+    connect(&_journalMaintenanceTimer, &QTimer::timeout, this, [this] {
+        if (isSyncRunning() || _journalMaintenance.isRunning())
+            return;
+        // A sync started meanwhile waits for the journal's mutex, performMaintenance() keeps that short
+        _journalMaintenance = QtConcurrent::run([this] { _journal.performMaintenance(); });
+    });
+
     connect(ProgressDispatcher::instance(), &ProgressDispatcher::folderConflicts,
         this, &Folder::slotFolderConflicts);
     connect(_engine.data(), &SyncEngine::excluded, this, [this](const QString &path, CSYNC_EXCLUDE_TYPE reason) {
@@ -170,6 +181,8 @@ Folder::~Folder()
 
     // Reset then engine first as it will abort and try to access members of the Folder
     _engine.reset();
+
+    _journalMaintenance.waitForFinished();
 }
 
 bool Folder::checkLocalPath()
@@ -862,6 +875,7 @@ void Folder::startSync()
         return;
     }
 
+    _journalMaintenanceTimer.stop();
     _timeSinceLastSyncStart.start();
     _syncResult.setStatus(SyncResult::SyncPrepare);
     emit syncStateChange();
@@ -888,18 +902,34 @@ void Folder::startSync()
         }
         return interval;
     }();
+    // The directory mtimes don't show files modified in place, only every few
+    // periodic runs list everything to catch what the watcher missed
+    const int directoryChecksPerFullLocalDiscovery = 4;
     bool hasDoneFullLocalDiscovery = _timeSinceLastFullLocalDiscovery.isValid();
     bool periodicFullLocalDiscoveryNow =
         fullLocalDiscoveryInterval.count() >= 0 // negative means we don't require periodic full runs
-        && _timeSinceLastFullLocalDiscovery.hasExpired(fullLocalDiscoveryInterval.count());
+        && _timeSinceLastFullLocalDiscovery.hasExpired(fullLocalDiscoveryInterval.count() * directoryChecksPerFullLocalDiscovery);
+    bool periodicDirectoryCheckNow =
+        fullLocalDiscoveryInterval.count() >= 0
+        && (!_timeSinceLastDirectoryCheck.isValid() || _timeSinceLastDirectoryCheck.hasExpired(fullLocalDiscoveryInterval.count()));
     if (_folderWatcher && _folderWatcher->isReliable()
         && hasDoneFullLocalDiscovery
-        && !periodicFullLocalDiscoveryNow) {
+        && !periodicDirectoryCheckNow) {
         qCInfo(lcFolder) << "Allowing local discovery to read from the database";
         _engine->setLocalDiscoveryOptions(
             LocalDiscoveryStyle::DatabaseAndFilesystem,
             _localDiscoveryTracker->localDiscoveryPaths());
         _localDiscoveryTracker->startSyncPartialDiscovery();
+    } else if (_folderWatcher && _folderWatcher->isReliable()
+        && hasDoneFullLocalDiscovery
+        && !periodicFullLocalDiscoveryNow) {
+        // The watcher reports changes to files, the periodic run catches
+        // entries it missed via the directory mtimes
+        qCInfo(lcFolder) << "Allowing local discovery to read unchanged directories from the database";
+        _engine->setLocalDiscoveryOptions(
+            LocalDiscoveryStyle::UnchangedDirectoriesFromDatabase,
+            _localDiscoveryTracker->localDiscoveryPaths());
+        _localDiscoveryTracker->startSyncPartialDiscovery();
     } else {
         qCInfo(lcFolder) << "Forbidding local discovery to read from the database";
         _engine->setLocalDiscoveryOptions(LocalDiscoveryStyle::FilesystemOnly);
@@ -1016,6 +1046,9 @@ void Folder::slotSyncFinished(bool success)
         && success) {
         if (_engine->lastLocalDiscoveryStyle() == LocalDiscoveryStyle::FilesystemOnly) {
             _timeSinceLastFullLocalDiscovery.start();
+            _timeSinceLastDirectoryCheck.start();
+        } else if (_engine->lastLocalDiscoveryStyle() == LocalDiscoveryStyle::UnchangedDirectoriesFromDatabase) {
+            _timeSinceLastDirectoryCheck.start();
         }
     }
 
@@ -1032,6 +1065,7 @@ void Folder::slotSyncFinished(bool success)
 
     _lastSyncDuration = std::chrono::milliseconds(_timeSinceLastSyncStart.elapsed());
     _timeSinceLastSyncDone.start();
+    _journalMaintenanceTimer.start();
 
     // Increment the follow-up sync counter if necessary.
     if (anotherSyncNeeded == ImmediateFollowUp) {
@@ -1138,6 +1172,7 @@ void Folder::slotScheduleThisFolder()
 void Folder::slotNextSyncFullLocalDiscovery()
 {
     _timeSinceLastFullLocalDiscovery.invalidate();
+    _timeSinceLastDirectoryCheck.invalidate();
 }
 
 void Folder::schedulePathForLocalDiscovery(const QString &relativePath)
@@ -24,6 +24,7 @@
 #include "syncoptions.h"
 
 #include <QDateTime>
+#include <QFuture>
 #include <QObject>
 #include <QStringList>
 #include <QUuid>
@@ -460,6 +461,7 @@ private:
     QElapsedTimer _timeSinceLastSyncDone;
     QElapsedTimer _timeSinceLastSyncStart;
     QElapsedTimer _timeSinceLastFullLocalDiscovery;
+    QElapsedTimer _timeSinceLastDirectoryCheck; // restarted by FilesystemOnly and UnchangedDirectoriesFromDatabase runs
     std::chrono::milliseconds _lastSyncDuration;
 
     /// The number of syncs that failed in a row.
@@ -476,6 +478,11 @@ private:
 
     QTimer _scheduleSelfTimer;
 
+    /// Started when a sync finishes, calls SyncJournalDb::performMaintenance()
+    QTimer _journalMaintenanceTimer;
+    /// The maintenance running on a worker thread, waited for on destruction
+    QFuture<void> _journalMaintenance;
+
     /**
      * When the same local path is synced to multiple accounts, only one
      * of them can be stored in the settings in a way that's compatible
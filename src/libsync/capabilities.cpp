@@ -182,6 +182,11 @@ bool Capabilities::chunkingParallelUploadDisabled() const
     return _capabilities.value(QStringLiteral("dav")).toMap().value(QStringLiteral("chunkingParallelUploadDisabled")).toBool();
 }
 
+bool Capabilities::propfindDepthInfinity() const
+{
+    return _capabilities.value(QStringLiteral("dav")).toMap().value(QStringLiteral("propfind")).toMap().value(QStringLiteral("depth_infinity")).toBool();
+}
+
 bool Capabilities::privateLinkPropertyAvailable() const
 {
     return _capabilities.value(QStringLiteral("files")).toMap().value(QStringLiteral("privateLinks")).toBool();
@@ -95,6 +95,9 @@ public:
     /// disable parallel upload in chunking
     bool chunkingParallelUploadDisabled() const;
 
+    /// Whether the server answers PROPFINDs with "Depth: infinity"
+    bool propfindDepthInfinity() const;
+
     /// Whether the "privatelink" DAV property is available
     bool privateLinkPropertyAvailable() const;
 
@@ -13,16 +13,19 @@
  */
 
 #include "discovery.h"
+#include "account.h"
 #include "common/checksums.h"
 #include "common/syncjournaldb.h"
 #include "csync.h"
 #include "csync_exclude.h"
+#include "filesystem.h"
 #include "owncloudpropagator.h"
 #include "syncengine.h"
 #include "syncfileitem.h"
 #include "vio/csync_vio_local.h"
 
 #include <algorithm>
+#include <iterator>
 #include <set>
 
 #include <QDebug>
@@ -38,23 +41,34 @@ Q_LOGGING_CATEGORY(lcDisco, "sync.discovery", QtInfoMsg)
 void ProcessDirectoryJob::start()
 {
     qCInfo(lcDisco) << "STARTING" << _currentFolder._server << _queryServer << _currentFolder._local << _queryLocal;
+    _started = true;
+    if (_localQueryPrefetched) {
+        _localQueryPrefetched = false;
+        _discoveryData->_localPrefetches--;
+    }
+
+    if (_localQueryFailed) {
+        // The prefetched local query already failed, _dirItem was set up
+        // in startAsyncLocalQuery()
+        emit finished();
+        return;
+    }
 
-    if (_queryServer == NormalQuery) {
+    if (_queryServer == NormalQuery && !serverEntriesFromSubtree() && !serverEntriesFromJournal()
+        && !serverEntriesFromRemoteChanges()) {
         _serverJob = startAsyncServerQuery();
     } else {
         _serverQueryDone = true;
     }
 
     // Check whether a normal local query is even necessary
-    if (_queryLocal == NormalQuery) {
-        if (!_discoveryData->_shouldDiscoverLocaly(_currentFolder._local)
-            && (_currentFolder._local == _currentFolder._original || !_discoveryData->_shouldDiscoverLocaly(_currentFolder._original))) {
-            _queryLocal = ParentNotChanged;
-        }
+    if (_queryLocal == NormalQuery && !_localQueryStarted && !isLocalQueryNeeded()) {
+        _queryLocal = ParentNotChanged;
     }
 
     if (_queryLocal == NormalQuery) {
-        startAsyncLocalQuery();
+        if (!_localQueryStarted)
+            startAsyncLocalQuery();
     } else {
         _localQueryDone = true;
     }
@@ -64,65 +78,143 @@ void ProcessDirectoryJob::start()
     }
 }
 
+bool ProcessDirectoryJob::shouldDiscoverLocally() const
+{
+    return _discoveryData->_shouldDiscoverLocaly(_currentFolder._local)
+        || (_currentFolder._local != _currentFolder._original && _discoveryData->_shouldDiscoverLocaly(_currentFolder._original));
+}
+
+bool ProcessDirectoryJob::isLocalQueryNeeded() const
+{
+    // Whether the directory is unchanged is only known once it's stat()ed
+    return _discoveryData->_skipUnchangedLocalDirectories || shouldDiscoverLocally();
+}
+
+void ProcessDirectoryJob::prefetchLocalQuery()
+{
+    if (_started || _localQueryStarted || _queryLocal != NormalQuery || !isLocalQueryNeeded())
+        return;
+    // The result is held until the job starts, don't list a whole wide tree ahead
+    if (_discoveryData->_localPrefetches >= _discoveryData->localDiscoveryPool()->maxThreadCount())
+        return;
+    _discoveryData->_localPrefetches++;
+    _localQueryPrefetched = true;
+    startAsyncLocalQuery();
+}
+
 void ProcessDirectoryJob::process()
 {
     OC_ASSERT(_localQueryDone && _serverQueryDone);
 
-    // Build lookup tables for local, remote and db entries.
+    // Merge the local, remote and db entries by name.
     // For suffix-virtual files, the key will normally be the base file name
     // without the suffix.
     // However, if foo and foo.owncloud exists locally, there'll be "foo"
     // with local, db, server entries and "foo.owncloud" with only a local
     // entry.
     struct Entries {
+        QString name;
         QString nameOverride;
         SyncJournalFileRecord dbEntry;
         RemoteInfo serverEntry;
         LocalInfo localEntry;
     };
-    std::map<QString, Entries> entries;
-    for (auto &e : _serverNormalQueryEntries) {
-        entries[e.name].serverEntry = std::move(e);
-    }
-    _serverNormalQueryEntries.clear();
 
     // fetch all the name from the DB
+    std::vector<std::pair<QString, SyncJournalFileRecord>> dbEntries;
     auto pathU8 = _currentFolder._original.toUtf8();
-    if (!_discoveryData->_statedb->listFilesInPath(pathU8, [&](const SyncJournalFileRecord &rec) {
+    if (!_discoveryData->listFilesInPath(pathU8, [&](const SyncJournalFileRecord &rec) {
             auto name = pathU8.isEmpty() ? QString::fromUtf8(rec._path) : QString::fromUtf8(rec._path.constData() + (pathU8.size() + 1));
             if (rec.isVirtualFile() && isVfsWithSuffix()) {
                 name = chopVirtualFileSuffix(name);
             }
-            auto &dbEntry = entries[name].dbEntry;
-            dbEntry = rec;
-            setupDbPinStateActions(dbEntry);
+            if (_localEntriesFromDb) {
+                // The directory is unchanged, see startAsyncLocalQuery()
+                LocalInfo local;
+                local.name = name;
+                local.modtime = rec._modtime;
+                local.size = rec._fileSize;
+                local.inode = rec._inode;
+                local.type = rec._type;
+                local.isDirectory = rec.isDirectory();
+                local.isSymLink = rec._type == ItemTypeSoftLink;
+                _localNormalQueryEntries.push_back(std::move(local));
+            }
+            dbEntries.emplace_back(std::move(name), rec);
+            setupDbPinStateActions(dbEntries.back().second);
         })) {
         dbError();
         return;
     }
 
-    for (auto &e : _localNormalQueryEntries) {
-        entries[e.name].localEntry = e;
+    // The database sorts by utf8 path, and the suffix was chopped, so sort all
+    // three sources the same way before merging them
+    const auto byName = [](const auto &a, const auto &b) { return a.name < b.name; };
+    std::sort(_serverNormalQueryEntries.begin(), _serverNormalQueryEntries.end(), byName);
+    std::sort(_localNormalQueryEntries.begin(), _localNormalQueryEntries.end(), byName);
+    std::stable_sort(dbEntries.begin(), dbEntries.end(), [](const auto &a, const auto &b) { return a.first < b.first; });
+
+    std::vector<Entries> entries;
+    entries.reserve(std::max({ size_t(_serverNormalQueryEntries.size()), dbEntries.size(), size_t(_localNormalQueryEntries.size()) }));
+    {
+        auto serverIt = _serverNormalQueryEntries.begin();
+        auto dbIt = dbEntries.begin();
+        auto localIt = _localNormalQueryEntries.begin();
+        const auto serverEnd = _serverNormalQueryEntries.end();
+        const auto dbEnd = dbEntries.end();
+        const auto localEnd = _localNormalQueryEntries.end();
+        while (serverIt != serverEnd || dbIt != dbEnd || localIt != localEnd) {
+            const QString *name = nullptr;
+            if (serverIt != serverEnd)
+                name = &serverIt->name;
+            if (dbIt != dbEnd && (!name || dbIt->first < *name))
+                name = &dbIt->first;
+            if (localIt != localEnd && (!name || localIt->name < *name))
+                name = &localIt->name;
+
+            Entries e;
+            e.name = *name;
+            // If a name shows up twice in one source, the last one wins
+            for (; serverIt != serverEnd && serverIt->name == e.name; ++serverIt)
+                e.serverEntry = std::move(*serverIt);
+            for (; dbIt != dbEnd && dbIt->first == e.name; ++dbIt)
+                e.dbEntry = std::move(dbIt->second);
+            for (; localIt != localEnd && localIt->name == e.name; ++localIt)
+                e.localEntry = std::move(*localIt);
+            entries.push_back(std::move(e));
+        }
     }
+    _serverNormalQueryEntries.clear();
+    _localNormalQueryEntries.clear();
+    dbEntries.clear();
+
     if (isVfsWithSuffix()) {
         // For vfs-suffix the local data for suffixed files should usually be associated
         // with the non-suffixed name. Unless both names exist locally or there's
         // other data about the suffixed file.
         // This is done in a second path in order to not depend on the order of
-        // _localNormalQueryEntries.
-        for (auto &e : _localNormalQueryEntries) {
-            if (!e.isVirtualFile)
+        // the local entries.
+        std::vector<Entries> added;
+        for (auto &suffixedEntry : entries) {
+            if (!suffixedEntry.localEntry.isVirtualFile)
                 continue;
-            auto &suffixedEntry = entries[e.name];
             bool hasOtherData = suffixedEntry.serverEntry.isValid() || suffixedEntry.dbEntry.isValid();
 
-            auto nonvirtualName = chopVirtualFileSuffix(e.name);
-            auto &nonvirtualEntry = entries[nonvirtualName];
-            // If the non-suffixed entry has no data, move it
-            if (!nonvirtualEntry.localEntry.isValid()) {
-                std::swap(nonvirtualEntry.localEntry, suffixedEntry.localEntry);
-                if (!hasOtherData)
-                    entries.erase(e.name);
+            auto nonvirtualName = chopVirtualFileSuffix(suffixedEntry.name);
+            auto nonvirtualIt = std::lower_bound(entries.begin(), entries.end(), nonvirtualName,
+                [](const Entries &a, const QString &name) { return a.name < name; });
+            Entries *nonvirtualEntry = nullptr;
+            if (nonvirtualIt != entries.end() && nonvirtualIt->name == nonvirtualName) {
+                nonvirtualEntry = &*nonvirtualIt;
+            } else {
+                added.emplace_back();
+                added.back().name = nonvirtualName;
+                nonvirtualEntry = &added.back();
+            }
+            // If the non-suffixed entry has no data, move it. A suffixed entry that is
+            // left without any data is dropped below.
+            if (!nonvirtualEntry->localEntry.isValid()) {
+                std::swap(nonvirtualEntry->localEntry, suffixedEntry.localEntry);
             } else if (!hasOtherData) {
                 // Normally a lone local suffixed file would be processed under the
                 // unsuffixed name. In this special case it's under the suffixed name.
@@ -131,21 +223,52 @@ void ProcessDirectoryJob::process()
                 suffixedEntry.nameOverride = nonvirtualName;
             }
         }
+        entries.erase(std::remove_if(entries.begin(), entries.end(), [](const Entries &e) {
+            return !e.serverEntry.isValid() && !e.dbEntry.isValid() && !e.localEntry.isValid();
+        }),
+            entries.end());
+        if (!added.empty()) {
+            std::move(added.begin(), added.end(), std::back_inserter(entries));
+            std::sort(entries.begin(), entries.end(), byName);
+        }
+    }
+
+    // The directory's own exclude file applies to all of the entries below,
+    // its patterns are only compiled again when the file changed
+    {
+        const auto excludeFileName = ExcludedFiles::directoryExcludeFileName();
+        const auto it = std::lower_bound(entries.begin(), entries.end(), excludeFileName,
+            [](const Entries &a, const QString &name) { return a.name < name; });
+        const bool found = it != entries.end() && it->name == excludeFileName;
+        const auto excludeFilePath = _discoveryData->_localDir + PathTuple::pathAppend(_currentFolder._local, excludeFileName);
+        if (found && it->localEntry.isValid() && it->localEntry.type == ItemTypeFile) {
+            _discoveryData->_excludes->updateDirectoryExcludeFile(_currentFolder._target,
+                excludeFilePath, it->localEntry.modtime, it->localEntry.size);
+        } else if (_queryLocal == ParentNotChanged) {
+            // The file is excluded from the sync and hence not in the database,
+            // look at the local file itself when the directory wasn't listed
+            const QFileInfo info(excludeFilePath);
+            if (info.isFile()) {
+                _discoveryData->_excludes->updateDirectoryExcludeFile(_currentFolder._target,
+                    excludeFilePath, FileSystem::getModTime(excludeFilePath), info.size());
+            } else {
+                _discoveryData->_excludes->removeDirectoryExcludeFile(_currentFolder._target);
+            }
+        } else {
+            _discoveryData->_excludes->removeDirectoryExcludeFile(_currentFolder._target);
+        }
     }
-    _localNormalQueryEntries.clear();
 
     //
     // Iterate over entries and process them
     //
-    for (const auto &f : entries) {
-        const auto &e = f.second;
-
+    for (const auto &e : entries) {
         PathTuple path;
-        path = _currentFolder.addName(e.nameOverride.isEmpty() ? f.first : e.nameOverride);
+        path = _currentFolder.addName(e.nameOverride.isEmpty() ? e.name : e.nameOverride);
 
         if (isVfsWithSuffix()) {
             // Without suffix vfs the paths would be good. But since the dbEntry and localEntry
-            // can have different names from f.first when suffix vfs is on, make sure the
+            // can have different names from e.name when suffix vfs is on, make sure the
             // corresponding _original and _local paths are right.
 
             if (e.dbEntry.isValid()) {
@@ -166,18 +289,36 @@ void ProcessDirectoryJob::process()
         // For windows, the hidden state is also discovered within the vio
         // local stat function.
         // Recall file shall not be ignored (#4420)
-        bool isHidden = e.localEntry.isHidden || (f.first[0] == QLatin1Char('.') && f.first != QLatin1String(".sys.admin#recall#"));
+        bool isHidden = e.localEntry.isHidden || (e.name[0] == QLatin1Char('.') && e.name != QLatin1String(".sys.admin#recall#"));
+        // The database only has the synced entries, and not whether they are hidden
+        if (e.localEntry.isHidden)
+            _localEntryIgnored = true;
         if (handleExcluded(path._target, e.localEntry.name,
                 e.localEntry.isDirectory || e.serverEntry.isDirectory, isHidden,
-                e.localEntry.isSymLink))
+                e.localEntry.isSymLink)) {
+            if (e.localEntry.isValid())
+                _localEntryIgnored = true;
+            _discoveryData->dropSubtreeListings(path._server);
+            _discoveryData->_excludes->removeDirectoryExcludeFiles(path._target);
             continue;
+        }
 
         if (_queryServer == InBlackList || _discoveryData->isInSelectiveSyncBlackList(path._original)) {
+            if (e.localEntry.isValid())
+                _localEntryIgnored = true;
+            _discoveryData->dropSubtreeListings(path._server);
+            _discoveryData->_excludes->removeDirectoryExcludeFiles(path._target);
             processBlacklisted(path, e.localEntry, e.dbEntry);
             continue;
         }
         processFile(std::move(path), e.localEntry, e.serverEntry, e.dbEntry);
     }
+
+    // A listing built from the database wouldn't have the ignored entries,
+    // so only a directory without them may skip the listing next time
+    if (_localDirectoryState._valid && !_localEntryIgnored && !_childIgnored)
+        _discoveryData->_localDirectoryStates.emplace_back(_currentFolder._local, _localDirectoryState);
+
     QTimer::singleShot(0, _discoveryData, &DiscoveryPhase::scheduleMoreJobs);
 }
 
@@ -467,6 +608,9 @@ void ProcessDirectoryJob::processFileAnalyzeRemoteInfo(
                     --_pendingAsyncJobs;
                     if (!result) {
                         processFileAnalyzeLocalInfo(item, path, localEntry, serverEntry, dbEntry, _queryServer);
+                    } else {
+                        _discoveryData->dropSubtreeListings(path._server);
+                        _discoveryData->_excludes->removeDirectoryExcludeFiles(path._target);
                     }
                     QTimer::singleShot(0, _discoveryData, &DiscoveryPhase::scheduleMoreJobs);
                 });
@@ -687,7 +831,7 @@ void ProcessDirectoryJob::processFileAnalyzeLocalInfo(
         } else if (noServerEntry) {
             // Not locally, not on the server. The entry is stale!
             qCInfo(lcDisco) << "Stale DB entry";
-            _discoveryData->_statedb->deleteFileRecord(path._original, true);
+            _discoveryData->deleteFileRecord(path._original);
             return;
         } else if (dbEntry._type == ItemTypeVirtualFile && isVfsWithSuffix()) {
             // If the virtual file is removed, recreate it.
@@ -939,7 +1083,7 @@ void ProcessDirectoryJob::processFileAnalyzeLocalInfo(
         if (wasDeletedOnClient.first) {
             // More complicated. The REMOVE is canceled. Restore will happen next sync.
             qCInfo(lcDisco) << "Undid remove instruction on source" << originalPath;
-            _discoveryData->_statedb->deleteFileRecord(originalPath, true);
+            _discoveryData->deleteFileRecord(originalPath);
             _discoveryData->_statedb->schedulePathForRemoteDiscovery(originalPath);
             _discoveryData->_anotherSyncNeeded = true;
         } else {
@@ -1121,6 +1265,14 @@ void ProcessDirectoryJob::processFileFinalize(
     } else {
         recurse = false;
     }
+    // Only a job that queries the server takes the listing, see serverEntriesFromSubtree()
+    if (item->isDirectory() && (!recurse || recurseQueryServer != NormalQuery))
+        _discoveryData->dropSubtreeListings(path._server);
+    // The exclude files of a directory that isn't visited, or not under this name anymore
+    if (item->isDirectory() && !recurse)
+        _discoveryData->_excludes->removeDirectoryExcludeFiles(path._target);
+    if (item->isDirectory() && path._original != path._target)
+        _discoveryData->_excludes->removeDirectoryExcludeFiles(path._original);
     if (recurse) {
         auto job = new ProcessDirectoryJob(path, item, recurseQueryLocal, recurseQueryServer, this);
         if (removed) {
@@ -1129,6 +1281,7 @@ void ProcessDirectoryJob::processFileFinalize(
         } else {
             connect(job, &ProcessDirectoryJob::finished, this, &ProcessDirectoryJob::subJobFinished);
             _queuedJobs.push_back(job);
+            job->prefetchLocalQuery();
         }
     } else {
         if (removed
@@ -1167,6 +1320,7 @@ void ProcessDirectoryJob::processBlacklisted(const PathTuple &path, const OCC::L
         auto job = new ProcessDirectoryJob(path, item, NormalQuery, InBlackList, this);
         connect(job, &ProcessDirectoryJob::finished, this, &ProcessDirectoryJob::subJobFinished);
         _queuedJobs.push_back(job);
+        job->prefetchLocalQuery();
     } else {
         emit _discoveryData->itemDiscovered(item);
     }
@@ -1348,6 +1502,11 @@ int ProcessDirectoryJob::processSubJobs(int nbJobs)
         f->start();
         started++;
     }
+
+    // The started jobs made room for prefetching the ones that run next
+    const int prefetchable = qMin<int>(_queuedJobs.size(), _discoveryData->localDiscoveryPool()->maxThreadCount());
+    for (int i = 0; i < prefetchable; ++i)
+        _queuedJobs[i]->prefetchLocalQuery();
     return started;
 }
 
@@ -1383,6 +1542,11 @@ DiscoverySingleDirectoryJob *ProcessDirectoryJob::startAsyncServerQuery()
         _discoveryData->_remoteFolder + _currentFolder._server, this);
     if (!_dirItem)
         serverJob->setIsRootPath(); // query the fingerprint on the root
+    if (_dirItem && _dirItem->_instruction == CSYNC_INSTRUCTION_NEW && _dirItem->_direction == SyncFileItem::Down
+        && !_discoveryData->_subtreeQueryFailed && _discoveryData->_account->capabilities().propfindDepthInfinity()) {
+        // Everything below a new directory is needed, get it in one go instead of one PROPFIND per directory
+        serverJob->setDepthInfinity();
+    }
     connect(serverJob, &DiscoverySingleDirectoryJob::etag, this, &ProcessDirectoryJob::etag);
     _discoveryData->_currentlyActiveJobs++;
     _pendingAsyncJobs++;
@@ -1391,14 +1555,42 @@ DiscoverySingleDirectoryJob *ProcessDirectoryJob::startAsyncServerQuery()
         _pendingAsyncJobs--;
         if (results) {
             _serverNormalQueryEntries = *results;
-            _serverQueryDone = true;
+            storeServerEntries();
             if (!serverJob->_dataFingerprint.isEmpty() && _discoveryData->_dataFingerprint.isEmpty())
                 _discoveryData->_dataFingerprint = serverJob->_dataFingerprint;
+            for (auto it = serverJob->_subtreeListings.begin(); it != serverJob->_subtreeListings.end(); ++it) {
+                _discoveryData->_subtreeListings.insert(PathTuple::pathAppend(_currentFolder._server, it.key()), std::move(*it));
+            }
+            if (!_dirItem) {
+                // The token of the root listing, not the one of the changes below, so nothing
+                // that changes while the sync runs is missed next time
+                _discoveryData->_syncToken = serverJob->_syncToken;
+                if (!_discoveryData->_lastSyncToken.isEmpty() && !serverJob->_syncToken.isEmpty()) {
+                    // The sub directories can use the changes instead of a PROPFIND each
+                    _discoveryData->_currentlyActiveJobs++;
+                    _pendingAsyncJobs++;
+                    _discoveryData->fetchRemoteChanges([this](bool) {
+                        _discoveryData->_currentlyActiveJobs--;
+                        _pendingAsyncJobs--;
+                        _serverQueryDone = true;
+                        if (_localQueryDone)
+                            this->process();
+                    });
+                    return;
+                }
+            }
+            _serverQueryDone = true;
             if (_localQueryDone)
                 this->process();
         } else {
             auto code = results.error().code;
             qCWarning(lcDisco) << "Server error in directory" << _currentFolder._server << code;
+            if (serverJob->isDepthInfinity()) {
+                // Servers may refuse or fail on big listings, list just this directory instead
+                _discoveryData->_subtreeQueryFailed = true;
+                _serverJob = startAsyncServerQuery();
+                return;
+            }
             if (_dirItem && code >= 403) {
                 // In case of an HTTP error, we ignore that directory
                 // 403 Forbidden can be sent by the server if the file firewall is active.
@@ -1424,11 +1616,139 @@ DiscoverySingleDirectoryJob *ProcessDirectoryJob::startAsyncServerQuery()
     return serverJob;
 }
 
+bool ProcessDirectoryJob::serverEntriesFromSubtree()
+{
+    auto it = _discoveryData->_subtreeListings.find(_currentFolder._server);
+    if (it == _discoveryData->_subtreeListings.end())
+        return false;
+    _serverNormalQueryEntries = std::move(it->entries);
+    _rootPermissions = it->permissions;
+    _discoveryData->_subtreeListings.erase(it);
+    storeServerEntries();
+    return true;
+}
+
+bool ProcessDirectoryJob::serverEntriesFromJournal()
+{
+    if (!_dirItem || _dirItem->_etag.isEmpty())
+        return false;
+    if (!_discoveryData->loadServerListing(_currentFolder._server, _dirItem->_etag, &_rootPermissions, &_serverNormalQueryEntries))
+        return false;
+    qCDebug(lcDisco) << "Using the stored listing for" << _currentFolder._server;
+    return true;
+}
+
+void ProcessDirectoryJob::storeServerEntries()
+{
+    // The root's etag is only known with its listing
+    if (!_dirItem || _dirItem->_etag.isEmpty())
+        return;
+    _discoveryData->storeServerListing(_currentFolder._server, _dirItem->_etag, _rootPermissions, _serverNormalQueryEntries);
+}
+
+bool ProcessDirectoryJob::serverEntriesFromRemoteChanges()
+{
+    const RemoteChanges *changes = _discoveryData->_remoteChanges.data();
+    // The changes are by server path, and only complement what is in the database
+    if (!changes || !_dirItem || _currentFolder._server != _currentFolder._original)
+        return false;
+
+    const QString &path = _currentFolder._original;
+    SyncJournalFileRecord dirRecord;
+    if (!_discoveryData->getFileRecord(path, &dirRecord) || !dirRecord.isValid()
+        || !dirRecord.isDirectory() || dirRecord._etag == "_invalid_") {
+        return false;
+    }
+
+    static const QVector<RemoteInfo> noChanges;
+    const QVector<RemoteInfo> &changed = changes->changed.contains(path) ? *changes->changed.constFind(path) : noChanges;
+    const QSet<QString> removed = changes->removed.value(path);
+    QHash<QString, QByteArray> changedDirEtagsInDb;
+    for (const auto &e : changed)
+        changedDirEtagsInDb.insert(e.name, QByteArray());
+
+    // Everything that is not mentioned in the changes is as in the database
+    QVector<RemoteInfo> entries;
+    bool usable = true;
+    const auto pathU8 = path.toUtf8();
+    if (!_discoveryData->listFilesInPath(pathU8, [&](const SyncJournalFileRecord &rec) {
+            auto name = QString::fromUtf8(rec._path.constData() + (pathU8.size() + 1));
+            if (rec.isVirtualFile() && isVfsWithSuffix()) {
+                name = chopVirtualFileSuffix(name);
+            }
+            auto changedIt = changedDirEtagsInDb.find(name);
+            if (changedIt != changedDirEtagsInDb.end()) {
+                if (rec.isDirectory())
+                    *changedIt = rec._etag;
+                return;
+            }
+            if (removed.contains(name))
+                return;
+            if (rec.isDirectory()
+                && (rec._etag == "_invalid_" || changes->dirtyDirectories.contains(PathTuple::pathAppend(path, name)))) {
+                // Needs to be discovered, but the server did not report a new etag for it
+                usable = false;
+                return;
+            }
+            RemoteInfo info;
+            info.name = name;
+            info.etag = rec._etag;
+            info.fileId = rec._fileId;
+            info.checksumHeader = rec._checksumHeader;
+            info.remotePerm = rec._remotePerm;
+            info.modtime = rec._modtime;
+            info.size = rec.isDirectory() ? 0 : rec._fileSize;
+            info.isDirectory = rec.isDirectory();
+            entries.push_back(std::move(info));
+        })
+        || !usable) {
+        return false;
+    }
+
+    for (const auto &e : changed) {
+        if (e.isDirectory && changes->dirtyDirectories.contains(PathTuple::pathAppend(path, e.name))
+            && changedDirEtagsInDb.value(e.name) == e.etag) {
+            // Something changed inside, so the etag should have too
+            return false;
+        }
+    }
+
+    const auto dirPermIt = changes->directoryPermissions.constFind(path);
+    _rootPermissions = dirPermIt != changes->directoryPermissions.constEnd() ? *dirPermIt : dirRecord._remotePerm;
+    // See DiscoverySingleDirectoryJob::directoryListingIterated()
+    const bool isExternalStorage = dirPermIt != changes->directoryPermissions.constEnd()
+        ? _rootPermissions.hasPermission(RemotePermissions::IsMounted)
+        : (dirRecord._remotePerm.hasPermission(RemotePermissions::IsMounted) || dirRecord._remotePerm.hasPermission(RemotePermissions::IsMountedSub));
+    for (auto e : changed) {
+        if (isExternalStorage && e.remotePerm.hasPermission(RemotePermissions::IsMounted)) {
+            e.remotePerm.unsetPermission(RemotePermissions::IsMounted);
+            e.remotePerm.setPermission(RemotePermissions::IsMountedSub);
+        }
+        entries.push_back(std::move(e));
+    }
+
+    qCDebug(lcDisco) << "Using the remote changes for" << path << changed.size() << removed.size();
+    _serverNormalQueryEntries = std::move(entries);
+    return true;
+}
+
 void ProcessDirectoryJob::startAsyncLocalQuery()
 {
     QString localPath = _discoveryData->_localDir + _currentFolder._local;
     auto localJob = new DiscoverySingleLocalDirectoryJob(_discoveryData->_account, localPath, _discoveryData->_syncOptions._vfs.data());
 
+    _localQueryStarted = true;
+    // Without a notification about changes below it, a directory whose mtime
+    // and inode are unchanged still has the entries the database knows about.
+    // Files modified in place don't change the directory's mtime, so this relies
+    // on the file system watcher for them.
+    if (_discoveryData->_skipUnchangedLocalDirectories
+        && _currentFolder._local == _currentFolder._original
+        && _discoveryData->_syncOptions._vfs->mode() == Vfs::Off
+        && !shouldDiscoverLocally()) {
+        localJob->setKnownDirectoryState(_discoveryData->_knownLocalDirectoryStates.value(_currentFolder._local.toUtf8()));
+    }
+
     _discoveryData->_currentlyActiveJobs++;
     _pendingAsyncJobs++;
 
@@ -1439,8 +1759,7 @@ void ProcessDirectoryJob::startAsyncLocalQuery()
     });
 
     connect(localJob, &DiscoverySingleLocalDirectoryJob::finishedFatalError, this, [this](const QString &msg) {
-        _discoveryData->_currentlyActiveJobs--;
-        _pendingAsyncJobs--;
+        localQueryFinished();
         if (_serverJob)
             _serverJob->abort();
 
@@ -1448,32 +1767,58 @@ void ProcessDirectoryJob::startAsyncLocalQuery()
     });
 
     connect(localJob, &DiscoverySingleLocalDirectoryJob::finishedNonFatalError, this, [this](const QString &msg) {
-        _discoveryData->_currentlyActiveJobs--;
-        _pendingAsyncJobs--;
+        localQueryFinished();
 
         if (_dirItem) {
             _dirItem->_instruction = CSYNC_INSTRUCTION_IGNORE;
             _dirItem->_errorString = msg;
-            emit this->finished();
+            // A prefetched job reports this once it is started
+            _localQueryFailed = true;
+            if (_started)
+                emit this->finished();
         } else {
             // Fatal for the root job since it has no SyncFileItem
             emit _discoveryData->fatalError(msg);
         }
     });
 
+    connect(localJob, &DiscoverySingleLocalDirectoryJob::directoryState, this, [this](qint64 modtime, quint64 inode) {
+        _localDirectoryState._modtime = modtime;
+        _localDirectoryState._inode = inode;
+        _localDirectoryState._valid = true;
+    });
+
+    connect(localJob, &DiscoverySingleLocalDirectoryJob::finishedUnchanged, this, [this] {
+        localQueryFinished();
+
+        _localEntriesFromDb = true;
+        _localQueryDone = true;
+
+        if (_started && _serverQueryDone)
+            this->process();
+    });
+
     connect(localJob, &DiscoverySingleLocalDirectoryJob::finished, this, [this](const auto &results) {
-        _discoveryData->_currentlyActiveJobs--;
-        _pendingAsyncJobs--;
+        localQueryFinished();
 
         _localNormalQueryEntries = results;
         _localQueryDone = true;
 
-        if (_serverQueryDone)
+        if (_started && _serverQueryDone)
             this->process();
     });
 
-    QThreadPool *pool = QThreadPool::globalInstance();
-    pool->start(localJob); // QThreadPool takes ownership
+    // Listings that are needed right away go before the prefetched ones
+    _discoveryData->localDiscoveryPool()->start(localJob, _started ? 1 : 0); // QThreadPool takes ownership
+}
+
+void ProcessDirectoryJob::localQueryFinished()
+{
+    _discoveryData->_currentlyActiveJobs--;
+    _pendingAsyncJobs--;
+    // Nothing else hands the job slot of a prefetch on
+    if (!_started)
+        QTimer::singleShot(0, _discoveryData, &DiscoveryPhase::scheduleMoreJobs);
 }
 
 
@@ -206,12 +206,52 @@ private:
      */
     DiscoverySingleDirectoryJob *startAsyncServerQuery();
 
+    /** Fill _serverNormalQueryEntries from the listing fetched with a parent
+     *
+     * Returns false if there is none, see DiscoveryPhase::_subtreeListings.
+     */
+    bool serverEntriesFromSubtree();
+
+    /** Fill _serverNormalQueryEntries from a listing stored by an unfinished sync
+     *
+     * Returns false if there is none for the directory's current etag,
+     * see DiscoveryPhase::loadServerListing().
+     */
+    bool serverEntriesFromJournal();
+
+    /// Keep the listing of a changed directory in case this sync doesn't finish
+    void storeServerEntries();
+
+    /** Fill _serverNormalQueryEntries from the database and the remote changes
+     *
+     * Returns false if the remote changes aren't known or aren't enough to know
+     * the directory's contents, a PROPFIND is needed then.
+     */
+    bool serverEntriesFromRemoteChanges();
+
     /** Discover the local directory
       *
       * Fills _localNormalQueryEntries.
       */
     void startAsyncLocalQuery();
 
+    /// Bookkeeping when the local query is done, whatever its outcome
+    void localQueryFinished();
+
+    /// Whether there may be local changes in the directory, see _shouldDiscoverLocaly
+    bool shouldDiscoverLocally() const;
+
+    /// Whether the local directory may have to be listed
+    bool isLocalQueryNeeded() const;
+
+    /** Start the local query of a queued job ahead of time
+     *
+     * The listings of queued subdirectories run while the server is queried.
+     * Their results are kept until start() is called. A running prefetch
+     * takes a job slot like any other query, and at most as many prefetches
+     * as the local discovery pool has threads are outstanding at a time.
+     */
+    void prefetchLocalQuery();
 
     /** Sets _pinState, the directory's pin state
      *
@@ -244,6 +284,14 @@ private:
     bool _serverQueryDone = false;
     bool _localQueryDone = false;
 
+    bool _started = false; // start() was called
+    bool _localQueryStarted = false;
+    bool _localQueryPrefetched = false; // counted in _localPrefetches until start()
+    bool _localQueryFailed = false; // set up _dirItem for a non fatal error
+    bool _localEntriesFromDb = false; // the directory is unchanged, process() reads the local entries from the db
+    SyncJournalDb::LocalDirectoryState _localDirectoryState; // of the listing, see process()
+    bool _localEntryIgnored = false; // a listed local entry is hidden, excluded or blacklisted
+
     RemotePermissions _rootPermissions;
     QPointer<DiscoverySingleDirectoryJob> _serverJob;
 
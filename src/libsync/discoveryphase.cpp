@@ -18,17 +18,23 @@
 #include "account.h"
 #include "common/asserts.h"
 #include "common/checksums.h"
+#include "common/filesystembase.h"
 
 #include <csync_exclude.h>
 #include "vio/csync_vio_local.h"
 
+#include <QDataStream>
 #include <QLoggingCategory>
 #include <QUrl>
 #include <QFile>
 #include <QFileInfo>
 #include <QTextCodec>
 #include <cstring>
+#include <ctime>
 #include <QDateTime>
+#include <QSharedPointer>
+#include <QStorageInfo>
+#include <QThread>
 
 
 namespace OCC {
@@ -61,6 +67,20 @@ static bool findPathInList(const QStringList &list, const QString &path)
     return pathSlash.startsWith(*it);
 }
 
+void DiscoveryPhase::dropSubtreeListings(const QString &path)
+{
+    // Without a listing of its own, there are none below either
+    if (!_subtreeListings.remove(path))
+        return;
+    const QString prefix = path + QLatin1Char('/');
+    for (auto it = _subtreeListings.begin(); it != _subtreeListings.end();) {
+        if (it.key().startsWith(prefix))
+            it = _subtreeListings.erase(it);
+        else
+            ++it;
+    }
+}
+
 bool DiscoveryPhase::isInSelectiveSyncBlackList(const QString &path) const
 {
     if (_selectiveSyncBlackList.isEmpty()) {
@@ -83,7 +103,7 @@ void DiscoveryPhase::checkSelectiveSyncNewFolder(const QString &path, RemotePerm
         && remotePerm.hasPermission(RemotePermissions::IsMounted)) {
         // external storage.
 
-        /* Note: DiscoverySingleDirectoryJob::directoryListingIteratedSlot make sure that only the
+        /* Note: DiscoverySingleDirectoryJob::directoryListingIterated make sure that only the
          * root of a mounted storage has 'M', all sub entries have 'm' */
 
         // Only allow it if the white list contains exactly this path (not parents)
@@ -152,6 +172,42 @@ QString adjustRenamedPath(const QMap<QString, QString> &renamedItems, const QStr
     return original;
 }
 
+bool DiscoveryPhase::hasPendingDeletionsBelow(const QString &path) const
+{
+    // '/' sorts after characters like '-', so look for the children separately
+    const QString pathPrefix = path + QLatin1Char('/');
+    auto isBelow = [&](const auto &map) {
+        if (map.contains(path))
+            return true;
+        auto it = map.lowerBound(pathPrefix);
+        return it != map.end() && it.key().startsWith(pathPrefix);
+    };
+    return isBelow(_deletedItem) || isBelow(_queuedDeletedDirectories);
+}
+
+bool DiscoveryPhase::listFilesInPath(const QByteArray &path, const std::function<void(const SyncJournalFileRecord &)> &rowCallback)
+{
+    if (!_journalSnapshot)
+        return _statedb->listFilesInPath(path, rowCallback);
+    _journalSnapshot->listFilesInPath(path, rowCallback);
+    return true;
+}
+
+bool DiscoveryPhase::getFileRecord(const QString &path, SyncJournalFileRecord *rec)
+{
+    if (!_journalSnapshot)
+        return _statedb->getFileRecord(path, rec);
+    _journalSnapshot->getFileRecord(path.toUtf8(), rec);
+    return true;
+}
+
+void DiscoveryPhase::deleteFileRecord(const QString &path)
+{
+    _statedb->deleteFileRecord(path, true);
+    if (_journalSnapshot)
+        _journalSnapshot->removeFileRecord(path.toUtf8());
+}
+
 QPair<bool, QByteArray> DiscoveryPhase::findAndCancelDeletedJob(const QString &originalPath)
 {
     bool result = false;
@@ -203,6 +259,151 @@ QPair<bool, QByteArray> DiscoveryPhase::findAndCancelDeletedJob(const QString &o
     return { result, oldEtag };
 }
 
+// Bump when the format written by writeServerListings() changes
+static const quint32 serverListingVersion = 1;
+
+// Bounds the memory used by the kept listings, later listings aren't kept
+static const qint64 maxServerListingEntries = 100000;
+
+void DiscoveryPhase::storeServerListing(const QString &path, const QByteArray &etag,
+    const RemotePermissions &permissions, const QVector<RemoteInfo> &entries)
+{
+    if (_serverListingEntries + entries.size() > maxServerListingEntries)
+        return;
+    _serverListingEntries += entries.size();
+    // The entries are implicitly shared, nothing is copied or serialized here
+    _serverListings.insert(path, { etag, SubtreeListing { permissions, entries } });
+}
+
+void DiscoveryPhase::writeServerListings()
+{
+    if (_serverListings.isEmpty())
+        return;
+    for (auto it = _serverListings.cbegin(); it != _serverListings.cend(); ++it) {
+        const auto &entries = it->second.entries;
+        QByteArray listing;
+        QDataStream stream(&listing, QIODevice::WriteOnly);
+        stream << serverListingVersion << it->second.permissions.toDbValue() << quint32(entries.size());
+        for (const auto &entry : entries) {
+            stream << entry.name << entry.etag << entry.fileId << entry.checksumHeader
+                   << entry.remotePerm.toDbValue() << qint64(entry.modtime) << qint64(entry.size)
+                   << entry.isDirectory << entry.directDownloadUrl << entry.directDownloadCookies;
+        }
+        _statedb->setDiscoveryListing(it.key().toUtf8(), it->first, listing);
+    }
+    _statedb->commit(QStringLiteral("discovery listings"));
+    qCInfo(lcDiscovery) << "Kept" << _serverListings.size() << "server listings of the interrupted sync";
+    _serverListings.clear();
+    _serverListingEntries = 0;
+}
+
+bool DiscoveryPhase::loadServerListing(const QString &path, const QByteArray &etag,
+    RemotePermissions *permissions, QVector<RemoteInfo> *entries)
+{
+    if (!_hasStoredServerListings)
+        return false;
+    const QByteArray listing = _statedb->discoveryListing(path.toUtf8(), etag);
+    if (listing.isEmpty())
+        return false;
+
+    QDataStream stream(listing);
+    quint32 version = 0;
+    QByteArray dirPermissions;
+    quint32 count = 0;
+    stream >> version;
+    if (version != serverListingVersion)
+        return false;
+    stream >> dirPermissions >> count;
+
+    QVector<RemoteInfo> result;
+    result.reserve(count);
+    for (quint32 i = 0; i < count && stream.status() == QDataStream::Ok; ++i) {
+        RemoteInfo entry;
+        QByteArray remotePerm;
+        qint64 modtime = 0;
+        qint64 size = 0;
+        stream >> entry.name >> entry.etag >> entry.fileId >> entry.checksumHeader
+            >> remotePerm >> modtime >> size
+            >> entry.isDirectory >> entry.directDownloadUrl >> entry.directDownloadCookies;
+        entry.remotePerm = RemotePermissions::fromDbValue(remotePerm);
+        entry.modtime = modtime;
+        entry.size = size;
+        result.push_back(std::move(entry));
+    }
+    if (stream.status() != QDataStream::Ok) {
+        qCWarning(lcDiscovery) << "Ignoring corrupt stored listing of" << path;
+        return false;
+    }
+
+    *permissions = RemotePermissions::fromDbValue(dirPermissions);
+    *entries = std::move(result);
+    return true;
+}
+
+void DiscoveryPhase::fetchRemoteChanges(std::function<void(bool)> callback)
+{
+    auto job = new SyncCollectionJob(_account, _remoteFolder, _lastSyncToken, this);
+    job->setProperties(DiscoverySingleDirectoryJob::properties(_account, false));
+
+    auto changes = QSharedPointer<RemoteChanges>::create();
+
+    // Splits a href into the path of the parent directory and the name, relative to the sync root
+    auto splitHref = [job](const QString &href) {
+        // The parser already checked that the href starts with the request path
+        QString path = href.mid(job->reply()->request().url().path().size());
+        while (path.startsWith(QLatin1Char('/')))
+            path.remove(0, 1);
+        const int slash = path.lastIndexOf(QLatin1Char('/'));
+        return qMakePair(slash < 0 ? QString() : path.left(slash), path.mid(slash + 1));
+    };
+    auto markDirty = [changes](QString dir) {
+        // All ancestors of a dirty directory are dirty too, so stop at the first known one
+        while (!changes->dirtyDirectories.contains(dir)) {
+            changes->dirtyDirectories.insert(dir);
+            if (dir.isEmpty())
+                break;
+            dir = dir.left(qMax(0, dir.lastIndexOf(QLatin1Char('/'))));
+        }
+    };
+
+    job->setTypedResultHandler([changes, splitHref, markDirty](const QString &href, const LsColProperties &properties) {
+        const auto path = splitHref(href);
+        if (path.second.isEmpty()) {
+            // The collection itself
+            return;
+        }
+        RemoteInfo result;
+        result.name = path.second;
+        result.size = -1;
+        DiscoverySingleDirectoryJob::propertiesToRemoteInfo(properties, result);
+        if (result.isDirectory) {
+            result.size = 0;
+            const QString dirPath = path.first.isEmpty() ? path.second : path.first + QLatin1Char('/') + path.second;
+            changes->directoryPermissions.insert(dirPath, result.remotePerm);
+        }
+        changes->changed[path.first].push_back(std::move(result));
+        markDirty(path.first);
+    });
+    connect(job, &LsColJob::directoryListingRemoved, this, [changes, splitHref, markDirty](const QString &href) {
+        const auto path = splitHref(href);
+        if (path.second.isEmpty())
+            return;
+        changes->removed[path.first].insert(path.second);
+        markDirty(path.first);
+    });
+    connect(job, &LsColJob::finishedWithoutError, this, [this, changes, callback] {
+        qCInfo(lcDiscovery) << "Remote changes since" << _lastSyncToken << "in" << changes->dirtyDirectories.size() << "directories";
+        _remoteChanges.reset(new RemoteChanges(std::move(*changes)));
+        callback(true);
+    });
+    connect(job, &LsColJob::finishedWithError, this, [callback](QNetworkReply *reply) {
+        qCWarning(lcDiscovery) << "Could not fetch the remote changes, falling back to a full discovery"
+                               << reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt() << reply->errorString();
+        callback(false);
+    });
+    job->start();
+}
+
 void DiscoveryPhase::startJob(ProcessDirectoryJob *job)
 {
     OC_ENFORCE(!_currentRootJob);
@@ -219,6 +420,9 @@ void DiscoveryPhase::startJob(ProcessDirectoryJob *job)
             auto nextJob = _queuedDeletedDirectories.take(_queuedDeletedDirectories.firstKey());
             startJob(nextJob);
         } else {
+            // Only an interrupted discovery needs them
+            _serverListings.clear();
+            _serverListingEntries = 0;
             emit finished();
         }
     });
@@ -226,6 +430,64 @@ void DiscoveryPhase::startJob(ProcessDirectoryJob *job)
     job->start();
 }
 
+/** Number of local directories to list in parallel
+ *
+ * Network file systems are bound by latency and profit from many requests
+ * in flight, SSDs scale with the number of cores, while concurrent reads
+ * make spinning disks seek back and forth. Local disks are only known to be
+ * spinning on Linux, elsewhere they are treated like SSDs, as the shared
+ * thread pool used before did.
+ *
+ * Can be overridden with the OWNCLOUD_LOCAL_DISCOVERY_THREADS environment variable.
+ */
+static int localDiscoveryThreadCount(const QString &localDir)
+{
+    static const int envThreads = qEnvironmentVariableIntValue("OWNCLOUD_LOCAL_DISCOVERY_THREADS");
+    if (envThreads > 0)
+        return envThreads;
+
+    const int networkThreads = 8;
+    const int ssdThreads = qBound(2, QThread::idealThreadCount(), 8);
+    const int rotationalThreads = 1;
+
+    if (FileSystem::isOnNetworkFileSystem(localDir))
+        return networkThreads;
+
+    const QStorageInfo storage(localDir);
+    if (!storage.isValid())
+        return ssdThreads;
+
+#ifdef Q_OS_LINUX
+    // Partitions don't have a queue/ of their own, it lives on the parent disk
+    QString sysPath = QFileInfo(QLatin1String("/sys/class/block/") + QFileInfo(QString::fromLocal8Bit(storage.device())).fileName()).canonicalFilePath();
+    if (!sysPath.isEmpty()) {
+        if (QFileInfo::exists(sysPath + QLatin1String("/partition")))
+            sysPath = QFileInfo(sysPath).path();
+        QFile rotational(sysPath + QLatin1String("/queue/rotational"));
+        if (rotational.open(QIODevice::ReadOnly))
+            return rotational.readAll().trimmed() == "1" ? rotationalThreads : ssdThreads;
+    }
+#endif
+    return ssdThreads;
+}
+
+DiscoveryPhase::~DiscoveryPhase()
+{
+    // Drop the local listings that haven't started yet, the pool's destructor
+    // waits for the running ones.
+    _localDiscoveryPool.clear();
+}
+
+QThreadPool *DiscoveryPhase::localDiscoveryPool()
+{
+    if (!_localDiscoveryPoolSized) {
+        _localDiscoveryPoolSized = true;
+        _localDiscoveryPool.setMaxThreadCount(localDiscoveryThreadCount(_localDir));
+        qCInfo(lcDiscovery) << "Listing local directories with" << _localDiscoveryPool.maxThreadCount() << "threads";
+    }
+    return &_localDiscoveryPool;
+}
+
 void DiscoveryPhase::setSelectiveSyncBlackList(const QStringList &list)
 {
     _selectiveSyncBlackList = list;
@@ -258,6 +520,16 @@ void DiscoverySingleLocalDirectoryJob::run() {
     if (localPath.endsWith(QLatin1Char('/'))) // Happens if _currentFolder._local.isEmpty()
         localPath.chop(1);
 
+    // Stat the directory before listing it: a change during the listing
+    // then shows up as a different mtime the next time
+    csync_file_stat_t dirStat;
+    const bool hasDirStat = csync_vio_local_stat(localPath, &dirStat) == 0 && dirStat.type == ItemTypeDirectory;
+    if (hasDirStat && _knownDirectoryState._valid
+        && dirStat.modtime == _knownDirectoryState._modtime && dirStat.inode == _knownDirectoryState._inode) {
+        emit finishedUnchanged();
+        return;
+    }
+
     auto dh = csync_vio_local_opendir(localPath);
     if (!dh) {
         qCCritical(lcDiscovery) << "Error while opening directory" << (localPath) << errno;
@@ -327,6 +599,10 @@ void DiscoverySingleLocalDirectoryJob::run() {
         qCWarning(lcDiscovery) << "closedir failed for file in " << localPath << " - errno: " << errno;
     }
 
+    // The mtime has a resolution of seconds: a directory modified within the
+    // last second may still change without getting a different one.
+    if (hasDirStat && dirStat.modtime < time(nullptr) - 1)
+        emit directoryState(dirStat.modtime, dirStat.inode);
     emit finished(results);
 }
 
@@ -345,6 +621,22 @@ void DiscoverySingleDirectoryJob::start()
     // Start the actual HTTP job
     LsColJob *lsColJob = new LsColJob(_account, _subPath, this);
 
+    lsColJob->setProperties(properties(_account, _isRootPath));
+    if (_depthInfinity)
+        lsColJob->setDepth(QByteArrayLiteral("infinity"));
+
+    lsColJob->setTypedResultHandler([this](const QString &file, const LsColProperties &properties) {
+        directoryListingIterated(file, properties);
+    });
+    QObject::connect(lsColJob, &LsColJob::finishedWithError, this, &DiscoverySingleDirectoryJob::lsJobFinishedWithErrorSlot);
+    QObject::connect(lsColJob, &LsColJob::finishedWithoutError, this, &DiscoverySingleDirectoryJob::lsJobFinishedWithoutErrorSlot);
+    lsColJob->start();
+
+    _lsColJob = lsColJob;
+}
+
+QList<QByteArray> DiscoverySingleDirectoryJob::properties(const AccountPtr &account, bool isRootPath)
+{
     QList<QByteArray> props;
     props << "resourcetype"
           << "getlastmodified"
@@ -355,22 +647,15 @@ void DiscoverySingleDirectoryJob::start()
           << "http://owncloud.org/ns:dDC"
           << "http://owncloud.org/ns:permissions"
           << "http://owncloud.org/ns:checksums";
-    if (_isRootPath)
-        props << "http://owncloud.org/ns:data-fingerprint";
-    if (_account->serverVersionInt() >= Account::makeServerVersion(10, 0, 0)) {
+    if (isRootPath) {
+        props << "http://owncloud.org/ns:data-fingerprint"
+              << "sync-token";
+    }
+    if (account->serverVersionInt() >= Account::makeServerVersion(10, 0, 0)) {
         // Server older than 10.0 have performances issue if we ask for the share-types on every PROPFIND
         props << "http://owncloud.org/ns:share-types";
     }
-
-    lsColJob->setProperties(props);
-
-    QObject::connect(lsColJob, &LsColJob::directoryListingIterated,
-        this, &DiscoverySingleDirectoryJob::directoryListingIteratedSlot);
-    QObject::connect(lsColJob, &LsColJob::finishedWithError, this, &DiscoverySingleDirectoryJob::lsJobFinishedWithErrorSlot);
-    QObject::connect(lsColJob, &LsColJob::finishedWithoutError, this, &DiscoverySingleDirectoryJob::lsJobFinishedWithoutErrorSlot);
-    lsColJob->start();
-
-    _lsColJob = lsColJob;
+    return props;
 }
 
 void DiscoverySingleDirectoryJob::abort()
@@ -380,81 +665,159 @@ void DiscoverySingleDirectoryJob::abort()
     }
 }
 
-static void propertyMapToRemoteInfo(const QMap<QString, QString> &map, RemoteInfo &result)
-{
-    for (auto it = map.constBegin(); it != map.constEnd(); ++it) {
-        QString property = it.key();
-        QString value = it.value();
-        if (property == QLatin1String("resourcetype")) {
-            result.isDirectory = value.contains(QLatin1String("collection"));
-        } else if (property == QLatin1String("getlastmodified")) {
-            const auto date = QDateTime::fromString(value, Qt::RFC2822Date);
-            Q_ASSERT(date.isValid());
-            result.modtime = date.toTime_t();
-        } else if (property == QLatin1String("getcontentlength")) {
-            // See #4573, sometimes negative size values are returned
-            bool ok = false;
-            qlonglong ll = value.toLongLong(&ok);
-            if (ok && ll >= 0) {
-                result.size = ll;
-            } else {
-                result.size = 0;
-            }
-        } else if (property == QLatin1String("getetag")) {
-            result.etag = Utility::normalizeEtag(value.toUtf8());
-        } else if (property == QLatin1String("id")) {
-            result.fileId = value.toUtf8();
-        } else if (property == QLatin1String("downloadURL")) {
-            result.directDownloadUrl = value;
-        } else if (property == QLatin1String("dDC")) {
-            result.directDownloadCookies = value;
-        } else if (property == QLatin1String("permissions")) {
-            result.remotePerm = RemotePermissions::fromServerString(value);
-        } else if (property == QLatin1String("checksums")) {
-            result.checksumHeader = findBestChecksum(value.toUtf8());
-        } else if (property == QLatin1String("share-types") && !value.isEmpty()) {
-            // Since QMap is sorted, "share-types" is always after "permissions".
-            if (result.remotePerm.isNull()) {
-                qWarning() << "Server returned a share type, but no permissions?";
-                // Empty permissions will cause a sync failure
-            } else {
-                // S means shared with me.
-                // But for our purpose, we want to know if the file is shared. It does not matter
-                // if we are the owner or not.
-                // Piggy back on the persmission field
-                result.remotePerm.setPermission(RemotePermissions::IsShared);
+/** Parses a getlastmodified value
+ *
+ * Servers send the fixed length RFC 7231 format "Fri, 06 Feb 2015 13:49:55 GMT",
+ * which is parsed directly. Anything else goes through QDateTime.
+ */
+static time_t parseLastModified(const QString &value)
+{
+    static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+
+    auto number = [&value](int pos, int count) {
+        int result = 0;
+        for (int i = pos; i < pos + count; ++i) {
+            const ushort c = value.at(i).unicode();
+            if (c < '0' || c > '9')
+                return -1;
+            result = result * 10 + (c - '0');
+        }
+        return result;
+    };
+
+    auto isAt = [&value](int pos, char c) { return value.at(pos) == QLatin1Char(c); };
+
+    if (value.size() == 29 && isAt(3, ',') && isAt(4, ' ') && isAt(7, ' ') && isAt(11, ' ') && isAt(16, ' ')
+        && isAt(19, ':') && isAt(22, ':') && value.endsWith(QLatin1String(" GMT"))) {
+        int month = -1;
+        for (int i = 0; i < 12; ++i) {
+            if (value.midRef(8, 3) == QLatin1String(months + 3 * i, 3)) {
+                month = i + 1;
+                break;
             }
         }
+        const int day = number(5, 2);
+        const int year = number(12, 4);
+        const int hour = number(17, 2);
+        const int minute = number(20, 2);
+        const int second = number(23, 2);
+        static const int daysInMonth[] = { 31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+        const bool leapYear = year % 4 == 0 && (year % 100 != 0 || year % 400 == 0);
+        const bool validDay = month > 0 && day > 0 && day <= daysInMonth[month - 1] && (month != 2 || day <= 28 || leapYear);
+        // Anything out of range, like a leap second, is left to QDateTime
+        if (validDay && year >= 0 && hour >= 0 && hour <= 23 && minute >= 0 && minute <= 59 && second >= 0 && second <= 59) {
+            // Days since the epoch for a proleptic gregorian date, see
+            // http://howardhinnant.github.io/date_algorithms.html#days_from_civil
+            const int y = month <= 2 ? year - 1 : year;
+            const int era = y / 400;
+            const int yoe = y - era * 400;
+            const int doy = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+            const int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+            const qint64 days = qint64(era) * 146097 + doe - 719468;
+            return static_cast<time_t>(days * 86400 + hour * 3600 + minute * 60 + second);
+        }
     }
+
+    const auto date = QDateTime::fromString(value, Qt::RFC2822Date);
+    Q_ASSERT(date.isValid());
+    return date.toTime_t();
 }
 
-void DiscoverySingleDirectoryJob::directoryListingIteratedSlot(const QString &file, const QMap<QString, QString> &map)
+/** Parses a getcontentlength value, see #4573, sometimes negative size values are returned */
+static int64_t parseContentLength(const QString &value)
+{
+    bool ok = false;
+    qlonglong ll = value.toLongLong(&ok);
+    return ok && ll >= 0 ? ll : 0;
+}
+
+void DiscoverySingleDirectoryJob::propertiesToRemoteInfo(const LsColProperties &properties, RemoteInfo &result)
+{
+    using P = LsColProperty;
+    if (properties.contains(P::ResourceType)) {
+        result.isDirectory = properties.value(P::ResourceType).contains(QLatin1String("collection"));
+    }
+    if (properties.contains(P::GetLastModified)) {
+        result.modtime = parseLastModified(properties.value(P::GetLastModified));
+    }
+    if (properties.contains(P::GetContentLength)) {
+        result.size = parseContentLength(properties.value(P::GetContentLength));
+    }
+    if (properties.contains(P::GetEtag)) {
+        result.etag = Utility::normalizeEtag(properties.value(P::GetEtag).toUtf8());
+    }
+    if (properties.contains(P::Id)) {
+        result.fileId = properties.value(P::Id).toUtf8();
+    }
+    if (properties.contains(P::DownloadUrl)) {
+        result.directDownloadUrl = properties.value(P::DownloadUrl);
+    }
+    if (properties.contains(P::DownloadCookies)) {
+        result.directDownloadCookies = properties.value(P::DownloadCookies);
+    }
+    if (properties.contains(P::Permissions)) {
+        result.remotePerm = RemotePermissions::fromServerString(properties.value(P::Permissions));
+    }
+    if (properties.contains(P::Checksums)) {
+        result.checksumHeader = findBestChecksum(properties.value(P::Checksums).toUtf8());
+    }
+    if (properties.contains(P::ShareTypes) && !properties.value(P::ShareTypes).isEmpty()) {
+        if (result.remotePerm.isNull()) {
+            qWarning() << "Server returned a share type, but no permissions?";
+            // Empty permissions will cause a sync failure
+        } else {
+            // S means shared with me.
+            // But for our purpose, we want to know if the file is shared. It does not matter
+            // if we are the owner or not.
+            // Piggy back on the persmission field
+            result.remotePerm.setPermission(RemotePermissions::IsShared);
+        }
+    }
+}
+
+void DiscoverySingleDirectoryJob::directoryListingIterated(const QString &file, const LsColProperties &properties)
 {
     if (!_ignoredFirst) {
         // The first entry is for the folder itself, we should process it differently.
         _ignoredFirst = true;
-        if (map.contains(QStringLiteral("permissions"))) {
-            auto perm = RemotePermissions::fromServerString(map.value(QStringLiteral("permissions")));
+        if (properties.contains(LsColProperty::Permissions)) {
+            auto perm = RemotePermissions::fromServerString(properties.value(LsColProperty::Permissions));
             emit firstDirectoryPermissions(perm);
             _isExternalStorage = perm.hasPermission(RemotePermissions::IsMounted);
         }
-        if (map.contains(QStringLiteral("data-fingerprint"))) {
-            _dataFingerprint = map.value(QStringLiteral("data-fingerprint")).toUtf8();
+        if (properties.contains(LsColProperty::DataFingerprint)) {
+            _dataFingerprint = properties.value(LsColProperty::DataFingerprint).toUtf8();
             if (_dataFingerprint.isEmpty()) {
                 // Placeholder that means that the server supports the feature even if it did not set one.
                 _dataFingerprint = "[empty]";
             }
         }
+        if (properties.contains(LsColProperty::SyncToken)) {
+            _syncToken = properties.value(LsColProperty::SyncToken).toUtf8();
+        }
+        _firstHref = file;
     } else {
 
         RemoteInfo result;
         int slash = file.lastIndexOf(QLatin1Char('/'));
         result.name = file.mid(slash + 1);
         result.size = -1;
-        propertyMapToRemoteInfo(map, result);
+        propertiesToRemoteInfo(properties, result);
         if (result.isDirectory)
             result.size = 0;
 
+        if (_depthInfinity) {
+            if (result.isDirectory) {
+                // Also gives empty directories a listing
+                _subtreeListings[file.mid(_firstHref.size() + 1)].permissions = result.remotePerm;
+            }
+            if (slash > _firstHref.size()) {
+                // Below a sub directory, see lsJobFinishedWithoutErrorSlot() for the permissions
+                _subtreeListings[file.mid(_firstHref.size() + 1, slash - _firstHref.size() - 1)].entries.push_back(std::move(result));
+                return;
+            }
+        }
+
         if (_isExternalStorage && result.remotePerm.hasPermission(RemotePermissions::IsMounted)) {
             /* All the entries in a external storage have 'M' in their permission. However, for all
                purposes in the desktop client, we only need to know about the mount points.
@@ -466,9 +829,9 @@ void DiscoverySingleDirectoryJob::directoryListingIteratedSlot(const QString &fi
     }
 
     //This works in concerto with the RequestEtagJob and the Folder object to check if the remote folder changed.
-    if (map.contains(QStringLiteral("getetag"))) {
+    if (properties.contains(LsColProperty::GetEtag)) {
         if (_firstEtag.isEmpty()) {
-            _firstEtag = parseEtag(map.value(QStringLiteral("getetag")).toUtf8()); // for directory itself
+            _firstEtag = parseEtag(properties.value(LsColProperty::GetEtag).toUtf8()); // for directory itself
         }
     }
 }
@@ -476,7 +839,7 @@ void DiscoverySingleDirectoryJob::directoryListingIteratedSlot(const QString &fi
 void DiscoverySingleDirectoryJob::lsJobFinishedWithoutErrorSlot()
 {
     if (!_ignoredFirst) {
-        // This is a sanity check, if we haven't _ignoredFirst then it means we never received any directoryListingIteratedSlot
+        // This is a sanity check, if we haven't _ignoredFirst then it means we never received any directoryListingIterated
         // which means somehow the server XML was bogus
         emit finished(HttpError{ 0, tr("Server error: PROPFIND reply is not XML formatted!") });
         deleteLater();
@@ -486,6 +849,17 @@ void DiscoverySingleDirectoryJob::lsJobFinishedWithoutErrorSlot()
         deleteLater();
         return;
     }
+    for (auto &listing : _subtreeListings) {
+        // Like for the direct entries in directoryListingIterated()
+        if (!listing.permissions.hasPermission(RemotePermissions::IsMounted))
+            continue;
+        for (auto &entry : listing.entries) {
+            if (entry.remotePerm.hasPermission(RemotePermissions::IsMounted)) {
+                entry.remotePerm.unsetPermission(RemotePermissions::IsMounted);
+                entry.remotePerm.setPermission(RemotePermissions::IsMountedSub);
+            }
+        }
+    }
     emit etag(_firstEtag, QDateTime::fromString(QString::fromUtf8(_lsColJob->responseTimestamp()), Qt::RFC2822Date));
     emit finished(_results);
     deleteLater();
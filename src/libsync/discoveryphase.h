@@ -20,13 +20,17 @@
 #include <csync.h>
 #include <QMap>
 #include <QSet>
+#include <QScopedPointer>
 #include "networkjobs.h"
 #include <QMutex>
 #include <QWaitCondition>
 #include <QRunnable>
+#include <QThreadPool>
 #include <deque>
 #include "syncoptions.h"
 #include "syncfileitem.h"
+#include "common/syncjournaldb.h"
+#include "common/syncjournalsnapshot.h"
 
 #include "csync/csync_exclude.h"
 
@@ -35,6 +39,7 @@ namespace OCC {
 enum class LocalDiscoveryStyle {
     FilesystemOnly, //< read all local data from the filesystem
     DatabaseAndFilesystem, //< read from the db, except for listed paths
+    UnchangedDirectoriesFromDatabase, //< read from the filesystem, except for unchanged directories that aren't listed
 };
 
 
@@ -62,6 +67,15 @@ struct RemoteInfo
     QString directDownloadCookies;
 };
 
+/**
+ * The listing of a directory that came with the depth-infinity PROPFIND of a parent
+ */
+struct SubtreeListing
+{
+    RemotePermissions permissions; // of the directory itself, as sent by the server
+    QVector<RemoteInfo> entries;
+};
+
 struct LocalInfo
 {
     /** FileName of the entry (this does not contains any directory or path, just the plain name */
@@ -88,12 +102,22 @@ class DiscoverySingleLocalDirectoryJob : public QObject, public QRunnable
 public:
     explicit DiscoverySingleLocalDirectoryJob(const AccountPtr &account, const QString &localPath, OCC::Vfs *vfs, QObject *parent = nullptr);
 
+    /** Skip the listing if the directory still has this mtime and inode
+     *
+     * finishedUnchanged() is emitted instead of finished() then.
+     */
+    void setKnownDirectoryState(const SyncJournalDb::LocalDirectoryState &state) { _knownDirectoryState = state; }
+
     void run() override;
 signals:
     void finished(QVector<LocalInfo> result);
+    void finishedUnchanged();
     void finishedFatalError(QString errorString);
     void finishedNonFatalError(QString errorString);
 
+    /// The directory's own mtime and inode, emitted before finished() when they can be relied on
+    void directoryState(qint64 modtime, quint64 inode);
+
     void itemDiscovered(SyncFileItemPtr item);
     void childIgnored(bool b);
 private slots:
@@ -101,6 +125,7 @@ private:
     QString _localPath;
     AccountPtr _account;
     OCC::Vfs* _vfs;
+    SyncJournalDb::LocalDirectoryState _knownDirectoryState;
 public:
 };
 
@@ -117,9 +142,17 @@ public:
     explicit DiscoverySingleDirectoryJob(const AccountPtr &account, const QString &path, QObject *parent = nullptr);
     // Specify that this is the root and we need to check the data-fingerprint
     void setIsRootPath() { _isRootPath = true; }
+    // List the whole subtree with a single PROPFIND, see _subtreeListings
+    void setDepthInfinity() { _depthInfinity = true; }
+    bool isDepthInfinity() const { return _depthInfinity; }
     void start();
     void abort();
 
+    /// The properties requested for every entry, the root also asks for data-fingerprint and sync-token
+    static QList<QByteArray> properties(const AccountPtr &account, bool isRootPath);
+    /// Fills \a result with the information in \a properties
+    static void propertiesToRemoteInfo(const LsColProperties &properties, RemoteInfo &result);
+
     // This is not actually a network job, it is just a job
 signals:
     void firstDirectoryPermissions(RemotePermissions);
@@ -127,11 +160,13 @@ signals:
     void finished(const HttpResult<QVector<RemoteInfo>> &result);
 
 private slots:
-    void directoryListingIteratedSlot(const QString &, const QMap<QString, QString> &);
     void lsJobFinishedWithoutErrorSlot();
     void lsJobFinishedWithErrorSlot(QNetworkReply *);
 
 private:
+    /// Called by the LsColJob for every entry, the first one being the directory itself
+    void directoryListingIterated(const QString &file, const LsColProperties &properties);
+
     QVector<RemoteInfo> _results;
     QString _subPath;
     QByteArray _firstEtag;
@@ -146,11 +181,33 @@ private:
     // If set, the discovery will finish with an error
     QString _error;
     QPointer<LsColJob> _lsColJob;
+    bool _depthInfinity = false;
+    // The href of the directory itself
+    QString _firstHref;
 
 public:
     QByteArray _dataFingerprint;
+    QByteArray _syncToken; // only queried for the root
+    // With setDepthInfinity(), the listings of all sub directories by path relative to this one
+    QHash<QString, SubtreeListing> _subtreeListings;
 };
 
+/**
+ * The remote changes since the last sync, as reported by a sync-collection REPORT
+ *
+ * All paths are relative to the sync root and have no leading or trailing slashes.
+ */
+struct RemoteChanges
+{
+    /// New or changed entries, by the path of their parent directory
+    QHash<QString, QVector<RemoteInfo>> changed;
+    /// Names of removed entries, by the path of their parent directory
+    QHash<QString, QSet<QString>> removed;
+    /// All directories that have a changed or removed entry somewhere below them
+    QSet<QString> dirtyDirectories;
+    /// Permissions of the directories that were reported as changed
+    QHash<QString, RemotePermissions> directoryPermissions;
+};
 class DiscoveryPhase : public QObject
 {
     Q_OBJECT
@@ -235,7 +292,67 @@ class DiscoveryPhase : public QObject
      */
     QPair<bool, QByteArray> findAndCancelDeletedJob(const QString &originalPath);
 
+    /** Fetches the remote changes since _lastSyncToken into _remoteChanges
+     *
+     * The callback gets false if the server could not provide them, discovery
+     * then continues with a PROPFIND for every directory.
+     */
+    void fetchRemoteChanges(std::function<void(bool)> callback);
+
+    /// Set by fetchRemoteChanges(), null if the changes are not known
+    QScopedPointer<RemoteChanges> _remoteChanges;
+
+    /** Listings fetched along with a parent directory, by server path
+     *
+     * The job for the directory takes its listing from here instead of
+     * doing a PROPFIND.
+     */
+    QHash<QString, SubtreeListing> _subtreeListings;
+
+    /// Drops the listings of the path and below, for directories that won't be visited
+    void dropSubtreeListings(const QString &path);
+
+    // Whether a depth-infinity PROPFIND failed, the server isn't asked again during this sync
+    bool _subtreeQueryFailed = false;
+
+    /** Keeps a server listing until the discovery finished
+     *
+     * Only if the sync is interrupted before, writeServerListings() puts the
+     * listings in the journal. The discovery of a later sync reuses them while
+     * the directory's etag is unchanged, see loadServerListing().
+     */
+    void storeServerListing(const QString &path, const QByteArray &etag,
+        const RemotePermissions &permissions, const QVector<RemoteInfo> &entries);
+
+    /// Writes the kept listings to the journal, for a sync interrupted during the discovery
+    void writeServerListings();
+
+    /// Returns false if the journal has no listing of the path for that etag
+    bool loadServerListing(const QString &path, const QByteArray &etag,
+        RemotePermissions *permissions, QVector<RemoteInfo> *entries);
+
+    // The listings kept by storeServerListing() with the etag they were fetched under
+    QHash<QString, QPair<QByteArray, SubtreeListing>> _serverListings;
+    qint64 _serverListingEntries = 0;
+
+    // Whether the journal had listings when the sync started, see loadServerListing()
+    bool _hasStoredServerListings = false;
+
+    /** Runs the DiscoverySingleLocalDirectoryJobs
+     *
+     * Sized for the storage of _localDir on first use, see localDiscoveryPool().
+     */
+    QThreadPool _localDiscoveryPool;
+    bool _localDiscoveryPoolSized = false;
+
+    // Local queries of jobs that weren't started yet, see ProcessDirectoryJob::prefetchLocalQuery()
+    int _localPrefetches = 0;
+
+    QThreadPool *localDiscoveryPool();
+
 public:
+    ~DiscoveryPhase() override;
+
     // input
     QString _localDir; // absolute path to the local directory. ends with '/'
     QString _remoteFolder; // remote folder, ends with '/'
@@ -247,14 +364,43 @@ public:
     QStringList _serverBlacklistedFiles; // The blacklist from the capabilities
     bool _ignoreHiddenFiles = false;
     std::function<bool(const QString &)> _shouldDiscoverLocaly;
+    // whether directories _shouldDiscoverLocaly() rejects are read from the db only while unchanged
+    bool _skipUnchangedLocalDirectories = false;
+    // SyncJournalDb::localDirectoryStates(), loaded if _skipUnchangedLocalDirectories
+    QHash<QByteArray, SyncJournalDb::LocalDirectoryState> _knownLocalDirectoryStates;
+    QByteArray _lastSyncToken; // sync-token of the last successful sync, if any
 
     void startJob(ProcessDirectoryJob *);
 
+    /** Whether the db-path or anything below it may still turn out to be renamed
+     *
+     * That is the case for deleted items, see _deletedItem and _queuedDeletedDirectories.
+     */
+    bool hasPendingDeletionsBelow(const QString &path) const;
+
+    /** The journal's metadata, loaded before the discovery if _syncOptions._journalSnapshot
+     *
+     * Null otherwise, the journal is queried then. See the functions below.
+     */
+    QScopedPointer<SyncJournalSnapshot> _journalSnapshot;
+
+    /// SyncJournalDb::listFilesInPath(), from _journalSnapshot if there is one
+    bool listFilesInPath(const QByteArray &path, const std::function<void(const SyncJournalFileRecord &)> &rowCallback);
+
+    /// SyncJournalDb::getFileRecord(), from _journalSnapshot if there is one
+    bool getFileRecord(const QString &path, SyncJournalFileRecord *rec);
+
+    /// SyncJournalDb::deleteFileRecord(path, true) that also updates _journalSnapshot
+    void deleteFileRecord(const QString &path);
+
     void setSelectiveSyncBlackList(const QStringList &list);
     void setSelectiveSyncWhiteList(const QStringList &list);
 
     // output
     QByteArray _dataFingerprint;
+    QByteArray _syncToken; // sync-token of the root, to be stored if the sync succeeds
+    // state of the listed local directories by path, to be stored if the sync succeeds
+    std::vector<std::pair<QString, SyncJournalDb::LocalDirectoryState>> _localDirectoryStates;
     bool _anotherSyncNeeded = false;
 
 signals:
@@ -177,30 +177,69 @@ bool MkColJob::finished()
 }
 
 /*********************************************************************************************/
-// supposed to read <D:collection> when pointing to <D:resourcetype><D:collection></D:resourcetype>..
-static QString readContentsAsString(QXmlStreamReader &reader)
-{
-    QString result;
-    int level = 0;
-    do {
-        QXmlStreamReader::TokenType type = reader.readNext();
-        if (type == QXmlStreamReader::StartElement) {
-            level++;
-            result += QLatin1Char('<') + reader.name().toString() + QLatin1Char('>');
-        } else if (type == QXmlStreamReader::Characters) {
-            result += reader.text();
-        } else if (type == QXmlStreamReader::EndElement) {
-            level--;
-            if (level < 0) {
-                break;
-            }
-            result += QStringLiteral("</") + reader.name().toString() + QLatin1Char('>');
-        }
 
-    } while (!reader.atEnd());
-    return result;
+LsColProperty lsColPropertyFromName(const QStringRef &name)
+{
+    // Dispatch on the length first, this is called for every property of every entry
+    switch (name.size()) {
+    case 2:
+        if (name == QLatin1String("id"))
+            return LsColProperty::Id;
+        break;
+    case 3:
+        if (name == QLatin1String("dDC"))
+            return LsColProperty::DownloadCookies;
+        break;
+    case 4:
+        if (name == QLatin1String("size"))
+            return LsColProperty::Size;
+        break;
+    case 7:
+        if (name == QLatin1String("getetag"))
+            return LsColProperty::GetEtag;
+        break;
+    case 9:
+        if (name == QLatin1String("checksums"))
+            return LsColProperty::Checksums;
+        break;
+    case 10:
+        if (name == QLatin1String("sync-token"))
+            return LsColProperty::SyncToken;
+        break;
+    case 11:
+        if (name == QLatin1String("permissions"))
+            return LsColProperty::Permissions;
+        if (name == QLatin1String("downloadURL"))
+            return LsColProperty::DownloadUrl;
+        if (name == QLatin1String("share-types"))
+            return LsColProperty::ShareTypes;
+        break;
+    case 12:
+        if (name == QLatin1String("resourcetype"))
+            return LsColProperty::ResourceType;
+        break;
+    case 15:
+        if (name == QLatin1String("getlastmodified"))
+            return LsColProperty::GetLastModified;
+        break;
+    case 16:
+        if (name == QLatin1String("getcontentlength"))
+            return LsColProperty::GetContentLength;
+        if (name == QLatin1String("data-fingerprint"))
+            return LsColProperty::DataFingerprint;
+        break;
+    }
+    return LsColProperty::Unknown;
 }
 
+void LsColProperties::set(LsColProperty property, const QString &value)
+{
+    auto &target = _values[static_cast<size_t>(property)];
+    // Copy into the existing buffer rather than sharing, so it can be reused for the next entry
+    target.resize(0);
+    target += value;
+    _present |= 1u << static_cast<int>(property);
+}
 
 LsColXMLParser::LsColXMLParser()
 {
@@ -208,101 +247,222 @@ LsColXMLParser::LsColXMLParser()
 
 bool LsColXMLParser::parse(const QByteArray &xml, QHash<QString, qint64> *sizes, const QString &expectedPath)
 {
-    // Parse DAV response
-    QXmlStreamReader reader(xml);
-    reader.addExtraNamespaceDeclaration(QXmlStreamNamespaceDeclaration(QStringLiteral("d"), QStringLiteral("DAV:")));
-
-    QStringList folders;
-    QString currentHref;
-    QMap<QString, QString> currentTmpProperties;
-    QMap<QString, QString> currentHttp200Properties;
-    bool currentPropsHaveHttp200 = false;
-    bool insidePropstat = false;
-    bool insideProp = false;
-    bool insideMultiStatus = false;
-
-    while (!reader.atEnd()) {
-        QXmlStreamReader::TokenType type = reader.readNext();
-        QString name = reader.name().toString();
-        // Start elements with DAV:
-        if (type == QXmlStreamReader::StartElement && reader.namespaceUri() == QLatin1String("DAV:")) {
-            if (name == QLatin1String("href")) {
-                // We don't use URL encoding in our request URL (which is the expected path) (QNAM will do it for us)
-                // but the result will have URL encoding..
-                QString hrefString = QString::fromUtf8(QByteArray::fromPercentEncoding(reader.readElementText().toUtf8()));
-                if (!hrefString.startsWith(expectedPath)) {
-                    qCWarning(lcLsColJob) << "Invalid href" << hrefString << "expected starting with" << expectedPath;
-                    return false;
+    begin(sizes, expectedPath);
+    return addData(xml) && finish();
+}
+
+void LsColXMLParser::begin(QHash<QString, qint64> *sizes, const QString &expectedPath)
+{
+    _reader.clear();
+    _reader.addExtraNamespaceDeclaration(QXmlStreamNamespaceDeclaration(QStringLiteral("d"), QStringLiteral("DAV:")));
+    _sizes = sizes;
+    _expectedPath = expectedPath;
+    _failed = false;
+
+    _folders.clear();
+    _currentHref.clear();
+    _currentTmpProperties.clear();
+    _currentHttp200Properties.clear();
+    _currentPropsHaveHttp200 = false;
+    _insidePropstat = false;
+    _insideProp = false;
+    _insideMultiStatus = false;
+    _multiStatusDone = false;
+    _currentResponseCode = 0;
+    _textTarget = TextTarget::None;
+    _text.clear();
+    _propertyLevel = 0;
+    _currentProperty = LsColProperty::Unknown;
+    _currentTmpTypedProperties.clear();
+    _currentHttp200TypedProperties.clear();
+}
+
+bool LsColXMLParser::addData(const QByteArray &data)
+{
+    if (_failed) {
+        return false;
+    }
+    _reader.addData(data);
+    if (!parseAvailable()) {
+        _failed = true;
+        return false;
+    }
+    if (_reader.hasError() && _reader.error() != QXmlStreamReader::PrematureEndOfDocumentError) {
+        // XML Parser error? Whatever had been emitted before will come as directoryListingIterated
+        qCWarning(lcLsColJob) << "ERROR" << _reader.errorString() << "at line" << _reader.lineNumber() << data;
+        _failed = true;
+        return false;
+    }
+    return true;
+}
+
+bool LsColXMLParser::finish()
+{
+    if (_failed) {
+        return false;
+    }
+    // The reader can't know that no more data will follow: running out of data
+    // is only fine once the multistatus element is complete
+    if (_reader.hasError() && !(_reader.error() == QXmlStreamReader::PrematureEndOfDocumentError && _multiStatusDone)) {
+        qCWarning(lcLsColJob) << "ERROR" << _reader.errorString() << "at line" << _reader.lineNumber();
+        return false;
+    } else if (!_insideMultiStatus) {
+        qCWarning(lcLsColJob) << "ERROR no WebDAV response?";
+        return false;
+    }
+    emit directoryListingSubfolders(_folders);
+    emit finishedWithoutError();
+    return true;
+}
+
+bool LsColXMLParser::parseAvailable()
+{
+    while (!_reader.atEnd()) {
+        const QXmlStreamReader::TokenType type = _reader.readNext();
+
+        if (_textTarget == TextTarget::Property) {
+            // All elements inside a property are part of its contents,
+            // e.g. <d:collection/> inside <d:resourcetype>
+            // The typed fast path doesn't need the contents of unknown properties
+            const bool collect = !_typedResultHandler || _currentProperty != LsColProperty::Unknown;
+            if (type == QXmlStreamReader::StartElement) {
+                _propertyLevel++;
+                if (collect) {
+                    _text += QLatin1Char('<');
+                    _text += _reader.name();
+                    _text += QLatin1Char('>');
+                }
+            } else if (type == QXmlStreamReader::Characters) {
+                if (collect) {
+                    _text += _reader.text();
+                }
+            } else if (type == QXmlStreamReader::EndElement) {
+                if (_propertyLevel > 0) {
+                    _propertyLevel--;
+                    if (collect) {
+                        _text += QLatin1String("</");
+                        _text += _reader.name();
+                        _text += QLatin1Char('>');
+                    }
+                    continue;
+                }
+                if (_currentProperty == LsColProperty::ResourceType && _text.contains(QLatin1String("collection"))) {
+                    _folders.append(_currentHref);
+                } else if (_currentProperty == LsColProperty::Size) {
+                    bool ok = false;
+                    auto s = _text.toLongLong(&ok);
+                    if (ok && _sizes) {
+                        _sizes->insert(_currentHref, s);
+                    }
                 }
-                currentHref = hrefString;
-            } else if (name == QLatin1String("response")) {
-            } else if (name == QLatin1String("propstat")) {
-                insidePropstat = true;
-            } else if (name == QLatin1String("status") && insidePropstat) {
-                QString httpStatus = reader.readElementText();
-                if (httpStatus.startsWith(QLatin1String("HTTP/1.1 200"))) {
-                    currentPropsHaveHttp200 = true;
+                if (_typedResultHandler) {
+                    if (_currentProperty != LsColProperty::Unknown) {
+                        _currentTmpTypedProperties.set(_currentProperty, _text);
+                    }
                 } else {
-                    currentPropsHaveHttp200 = false;
+                    _currentTmpProperties.insert(_reader.name().toString(), _text);
                 }
-            } else if (name == QLatin1String("prop")) {
-                insideProp = true;
-                continue;
-            } else if (name == QLatin1String("multistatus")) {
-                insideMultiStatus = true;
-                continue;
+                _textTarget = TextTarget::None;
+                // keeps the buffer for the next property
+                _text.resize(0);
             }
+            continue;
         }
 
-        if (type == QXmlStreamReader::StartElement && insidePropstat && insideProp) {
-            // All those elements are properties
-            QString propertyContent = readContentsAsString(reader);
-            if (name == QLatin1String("resourcetype") && propertyContent.contains(QLatin1String("collection"))) {
-                folders.append(currentHref);
-            } else if (name == QLatin1String("size")) {
-                bool ok = false;
-                auto s = propertyContent.toLongLong(&ok);
-                if (ok && sizes) {
-                    sizes->insert(currentHref, s);
+        if (_textTarget != TextTarget::None) {
+            // Inside <d:href> or <d:status>
+            if (type == QXmlStreamReader::Characters) {
+                _text += _reader.text();
+            } else if (type == QXmlStreamReader::EndElement) {
+                if (_textTarget == TextTarget::Href) {
+                    // We don't use URL encoding in our request URL (which is the expected path) (QNAM will do it for us)
+                    // but the result will have URL encoding..
+                    QString hrefString = QString::fromUtf8(QByteArray::fromPercentEncoding(_text.toUtf8()));
+                    if (!hrefString.startsWith(_expectedPath)) {
+                        qCWarning(lcLsColJob) << "Invalid href" << hrefString << "expected starting with" << _expectedPath;
+                        return false;
+                    }
+                    _currentHref = hrefString;
+                } else if (_textTarget == TextTarget::ResponseStatus) {
+                    // "HTTP/1.1 404 Not Found"
+                    _currentResponseCode = _text.section(QLatin1Char(' '), 1, 1).toInt();
+                } else {
+                    _currentPropsHaveHttp200 = _text.startsWith(QLatin1String("HTTP/1.1 200"));
                 }
+                _textTarget = TextTarget::None;
+                _text.clear();
             }
-            currentTmpProperties.insert(reader.name().toString(), propertyContent);
+            continue;
         }
 
-        // End elements with DAV:
-        if (type == QXmlStreamReader::EndElement) {
-            if (reader.namespaceUri() == QLatin1String("DAV:")) {
-                if (reader.name() == QLatin1String("response")) {
-                    if (currentHref.endsWith(QLatin1Char('/'))) {
-                        currentHref.chop(1);
+        if (type == QXmlStreamReader::StartElement) {
+            const QStringRef name = _reader.name();
+            // Start elements with DAV:
+            if (_reader.namespaceUri() == QLatin1String("DAV:")) {
+                if (name == QLatin1String("href")) {
+                    _textTarget = TextTarget::Href;
+                    continue;
+                } else if (name == QLatin1String("propstat")) {
+                    _insidePropstat = true;
+                } else if (name == QLatin1String("status")) {
+                    // Outside of a propstat the status applies to the whole response
+                    _textTarget = _insidePropstat ? TextTarget::Status : TextTarget::ResponseStatus;
+                    continue;
+                } else if (name == QLatin1String("prop")) {
+                    _insideProp = true;
+                    continue;
+                } else if (name == QLatin1String("multistatus")) {
+                    _insideMultiStatus = true;
+                    continue;
+                }
+            }
+
+            if (_insidePropstat && _insideProp) {
+                // All those elements are properties
+                _textTarget = TextTarget::Property;
+                _propertyLevel = 0;
+                _currentProperty = lsColPropertyFromName(name);
+            }
+        } else if (type == QXmlStreamReader::EndElement) {
+            // End elements with DAV:
+            if (_reader.namespaceUri() == QLatin1String("DAV:")) {
+                if (_reader.name() == QLatin1String("response")) {
+                    if (_currentHref.endsWith(QLatin1Char('/'))) {
+                        _currentHref.chop(1);
+                    }
+                    if (_currentResponseCode == 404) {
+                        // Only used by sync-collection reports: the resource was removed
+                        emit directoryListingRemoved(_currentHref);
+                    } else if (_currentResponseCode != 0 && _currentResponseCode / 100 != 2) {
+                        // e.g. 507 for a truncated sync-collection report
+                        qCWarning(lcLsColJob) << "Unexpected status" << _currentResponseCode << "for" << _currentHref;
+                        return false;
+                    } else if (_typedResultHandler) {
+                        _typedResultHandler(_currentHref, _currentHttp200TypedProperties);
+                    } else {
+                        emit directoryListingIterated(_currentHref, _currentHttp200Properties);
                     }
-                    emit directoryListingIterated(currentHref, currentHttp200Properties);
-                    currentHref.clear();
-                    currentHttp200Properties.clear();
-                } else if (reader.name() == QLatin1String("propstat")) {
-                    insidePropstat = false;
-                    if (currentPropsHaveHttp200) {
-                        currentHttp200Properties = std::move(currentTmpProperties);
+                    _currentHttp200TypedProperties.clear();
+                    _currentHttp200Properties.clear();
+                    _currentResponseCode = 0;
+                    _currentHref.clear();
+                } else if (_reader.name() == QLatin1String("propstat")) {
+                    _insidePropstat = false;
+                    if (_currentPropsHaveHttp200) {
+                        _currentHttp200Properties = std::move(_currentTmpProperties);
+                        std::swap(_currentHttp200TypedProperties, _currentTmpTypedProperties);
                     }
-                    currentPropsHaveHttp200 = false;
-                } else if (reader.name() == QLatin1String("prop")) {
-                    insideProp = false;
+                    _currentTmpProperties.clear();
+                    _currentTmpTypedProperties.clear();
+                    _currentPropsHaveHttp200 = false;
+                } else if (_reader.name() == QLatin1String("prop")) {
+                    _insideProp = false;
+                } else if (_reader.name() == QLatin1String("multistatus")) {
+                    _multiStatusDone = true;
                 }
             }
         }
     }
-
-    if (reader.hasError()) {
-        // XML Parser error? Whatever had been emitted before will come as directoryListingIterated
-        qCWarning(lcLsColJob) << "ERROR" << reader.errorString() << xml;
-        return false;
-    } else if (!insideMultiStatus) {
-        qCWarning(lcLsColJob) << "ERROR no WebDAV response?" << xml;
-        return false;
-    } else {
-        emit directoryListingSubfolders(folders);
-        emit finishedWithoutError();
-    }
     return true;
 }
 
@@ -333,33 +493,65 @@ QList<QByteArray> LsColJob::properties() const
 void LsColJob::start()
 {
     QNetworkRequest req;
-    req.setRawHeader(QByteArrayLiteral("Depth"), QByteArrayLiteral("1"));
+    req.setRawHeader(QByteArrayLiteral("Depth"), _depth);
     startImpl(req);
 }
 
-// TODO: Instead of doing all in this slot, we should iteratively parse in readyRead(). This
-// would allow us to be more asynchronous in processing while data is coming from the network,
-// not all in one big blob at the end.
-bool LsColJob::finished()
+void LsColJob::newReplyHook(QNetworkReply *reply)
 {
-    qCInfo(lcLsColJob) << "LSCOL of" << reply()->request().url() << "FINISHED WITH STATUS"
-                       << replyStatusString();
+    _parser.reset();
+    _parserFailed = false;
+    connect(reply, &QIODevice::readyRead, this, &LsColJob::slotReadyRead);
+}
 
-    QString contentType = reply()->header(QNetworkRequest::ContentTypeHeader).toString();
+void LsColJob::slotReadyRead()
+{
+    // Only a successful multistatus reply is parsed while it arrives,
+    // everything else is dealt with in finished()
     int httpCode = reply()->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
-    if (httpCode == 207 && contentType.contains(QLatin1String("application/xml; charset=utf-8"))) {
-        LsColXMLParser parser;
-        connect(&parser, &LsColXMLParser::directoryListingSubfolders,
+    QString contentType = reply()->header(QNetworkRequest::ContentTypeHeader).toString();
+    if (httpCode != 207 || !contentType.contains(QLatin1String("application/xml; charset=utf-8")) || _parserFailed) {
+        return;
+    }
+
+    if (!_parser) {
+        _parser.reset(new LsColXMLParser);
+        connect(_parser.data(), &LsColXMLParser::directoryListingSubfolders,
             this, &LsColJob::directoryListingSubfolders);
-        connect(&parser, &LsColXMLParser::directoryListingIterated,
+        connect(_parser.data(), &LsColXMLParser::directoryListingIterated,
             this, &LsColJob::directoryListingIterated);
-        connect(&parser, &LsColXMLParser::finishedWithError,
+        connect(_parser.data(), &LsColXMLParser::directoryListingRemoved,
+            this, &LsColJob::directoryListingRemoved);
+        connect(_parser.data(), &LsColXMLParser::finishedWithError,
             this, &LsColJob::finishedWithError);
-        connect(&parser, &LsColXMLParser::finishedWithoutError,
+        connect(_parser.data(), &LsColXMLParser::finishedWithoutError,
             this, &LsColJob::finishedWithoutError);
 
+        if (_typedResultHandler) {
+            _parser->setTypedResultHandler(_typedResultHandler);
+        }
+
         QString expectedPath = reply()->request().url().path(); // something like "/owncloud/remote.php/webdav/folder"
-        if (!parser.parse(reply()->readAll(), &_sizes, expectedPath)) {
+        _parser->begin(&_sizes, expectedPath);
+    }
+
+    if (!_parser->addData(reply()->readAll())) {
+        // XML parse error, reported in finished()
+        _parserFailed = true;
+    }
+}
+
+bool LsColJob::finished()
+{
+    qCInfo(lcLsColJob) << "LSCOL of" << reply()->request().url() << "FINISHED WITH STATUS"
+                       << replyStatusString();
+
+    QString contentType = reply()->header(QNetworkRequest::ContentTypeHeader).toString();
+    int httpCode = reply()->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if (httpCode == 207 && contentType.contains(QLatin1String("application/xml; charset=utf-8"))) {
+        // Consume whatever was not yet handled by slotReadyRead()
+        slotReadyRead();
+        if (_parserFailed || !_parser->finish()) {
             // XML parse error
             emit finishedWithError(reply());
         }
@@ -374,35 +566,42 @@ bool LsColJob::finished()
     return true;
 }
 
+QByteArray LsColJob::propElement() const
+{
+    QByteArray data;
+    QTextStream stream(&data, QIODevice::WriteOnly);
+    stream.setCodec("UTF-8");
+    stream << QByteArrayLiteral("<d:prop>");
+    for (const QByteArray &prop : qAsConst(_properties)) {
+        const int colIdx = prop.lastIndexOf(':');
+        if (colIdx >= 0) {
+            stream << QByteArrayLiteral("<") << prop.mid(colIdx + 1) << QByteArrayLiteral(" xmlns=\"") << prop.left(colIdx) << QByteArrayLiteral("\"/>");
+        } else {
+            stream << QByteArrayLiteral("<d:") << prop << QByteArrayLiteral("/>");
+        }
+    }
+    stream << QByteArrayLiteral("</d:prop>");
+    stream.flush();
+    return data;
+}
+
 void LsColJob::startImpl(const QNetworkRequest &req)
 {
     if (_properties.isEmpty()) {
         qCWarning(lcLsColJob) << "Propfind with no properties!";
     }
-    QByteArray data;
-    {
-        QTextStream stream(&data, QIODevice::WriteOnly);
-        stream.setCodec("UTF-8");
-        stream << QByteArrayLiteral("<?xml version=\"1.0\" encoding=\"utf-8\"?>"
-                                    "<d:propfind xmlns:d=\"DAV:\">"
-                                    "<d:prop>");
-
-        for (const QByteArray &prop : qAsConst(_properties)) {
-            const int colIdx = prop.lastIndexOf(':');
-            if (colIdx >= 0) {
-                stream << QByteArrayLiteral("<") << prop.mid(colIdx + 1) << QByteArrayLiteral(" xmlns=\"") << prop.left(colIdx) << QByteArrayLiteral("\"/>");
-            } else {
-                stream << QByteArrayLiteral("<d:") << prop << QByteArrayLiteral("/>");
-            }
-        }
-        stream << QByteArrayLiteral("</d:prop>M"
-                                    "</d:propfind>\n");
-    }
+    const QByteArray data = QByteArrayLiteral("<?xml version=\"1.0\" encoding=\"utf-8\"?>"
+                                              "<d:propfind xmlns:d=\"DAV:\">")
+        + propElement() + QByteArrayLiteral("</d:propfind>\n");
+    startImpl(req, QByteArrayLiteral("PROPFIND"), data);
+}
 
+void LsColJob::startImpl(const QNetworkRequest &req, const QByteArray &verb, const QByteArray &body)
+{
     QBuffer *buf = new QBuffer(this);
-    buf->setData(data);
+    buf->setData(body);
     buf->open(QIODevice::ReadOnly);
-    sendRequest(QByteArrayLiteral("PROPFIND"), _url, req, buf);
+    sendRequest(verb, _url, req, buf);
     AbstractNetworkJob::start();
 }
 
@@ -576,6 +775,27 @@ void PropfindJob::start()
     startImpl(req);
 }
 
+/*********************************************************************************************/
+
+SyncCollectionJob::SyncCollectionJob(AccountPtr account, const QString &path, const QByteArray &syncToken, QObject *parent)
+    : LsColJob(account, path, parent)
+    , _syncToken(syncToken)
+{
+}
+
+void SyncCollectionJob::start()
+{
+    QNetworkRequest req;
+    req.setRawHeader(QByteArrayLiteral("Depth"), QByteArrayLiteral("0"));
+    const QByteArray data = QByteArrayLiteral("<?xml version=\"1.0\" encoding=\"utf-8\"?>"
+                                              "<d:sync-collection xmlns:d=\"DAV:\">"
+                                              "<d:sync-token>")
+        + QString::fromUtf8(_syncToken).toHtmlEscaped().toUtf8()
+        + QByteArrayLiteral("</d:sync-token>"
+                            "<d:sync-level>infinite</d:sync-level>")
+        + propElement() + QByteArrayLiteral("</d:sync-collection>\n");
+    startImpl(req, QByteArrayLiteral("REPORT"), data);
+}
 
 /*********************************************************************************************/
 
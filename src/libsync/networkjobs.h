@@ -19,6 +19,8 @@
 #include "abstractnetworkjob.h"
 #include "common/result.h"
 #include <QUrlQuery>
+#include <QXmlStreamReader>
+#include <array>
 #include <functional>
 
 class QUrl;
@@ -56,6 +58,55 @@ private slots:
     bool finished() override;
 };
 
+/**
+ * WebDAV properties that LsColXMLParser can report in typed form.
+ *
+ * Like for the property map, only the local name of the property is considered.
+ */
+enum class LsColProperty : quint8 {
+    ResourceType,
+    GetLastModified,
+    GetContentLength,
+    GetEtag,
+    Id,
+    DownloadUrl,
+    DownloadCookies,
+    Permissions,
+    Checksums,
+    DataFingerprint,
+    ShareTypes,
+    Size,
+    SyncToken,
+
+    Count,
+    Unknown = Count
+};
+
+/** Maps a property name like "getetag" to its LsColProperty */
+OWNCLOUDSYNC_EXPORT LsColProperty lsColPropertyFromName(const QStringRef &name);
+
+/**
+ * The properties of a single <d:response>, indexed by LsColProperty.
+ *
+ * Unlike a QMap<QString, QString> the instances are reused by the parser,
+ * so filling them doesn't allocate once the buffers are large enough.
+ */
+class OWNCLOUDSYNC_EXPORT LsColProperties
+{
+public:
+    bool contains(LsColProperty property) const { return _present & (1u << static_cast<int>(property)); }
+    /// Value of the property, only meaningful if contains() is true
+    const QString &value(LsColProperty property) const { return _values[static_cast<size_t>(property)]; }
+
+private:
+    friend class LsColXMLParser;
+    void set(LsColProperty property, const QString &value);
+    void clear() { _present = 0; }
+
+    std::array<QString, static_cast<size_t>(LsColProperty::Count)> _values;
+    quint32 _present = 0;
+};
+
 /**
  * @brief The LsColJob class
  * @ingroup libsync
@@ -66,13 +117,84 @@ class OWNCLOUDSYNC_EXPORT LsColXMLParser : public QObject
 public:
     explicit LsColXMLParser();
 
+    /** Parse a complete PROPFIND reply in one go */
     bool parse(const QByteArray &xml, QHash<QString, qint64> *sizes, const QString &expectedPath);
 
+    /** Prepare for incremental parsing of a reply.
+     *
+     * Data is then passed in with addData() as it arrives and finish()
+     * must be called once the whole reply was received.
+     */
+    void begin(QHash<QString, qint64> *sizes, const QString &expectedPath);
+
+    /** Parse a chunk of the reply.
+     *
+     * directoryListingIterated() is emitted for every <d:response> that
+     * is complete. Returns false if the data can't be a valid reply.
+     */
+    bool addData(const QByteArray &data);
+
+    /** Ends incremental parsing.
+     *
+     * Returns false if the reply was incomplete or invalid, otherwise emits
+     * directoryListingSubfolders() and finishedWithoutError().
+     */
+    bool finish();
+
+    /** Callback for the typed fast path, gets the href and the properties of a response */
+    using TypedResultHandler = std::function<void(const QString &href, const LsColProperties &properties)>;
+
+    /** Report the responses to \a handler instead of emitting directoryListingIterated()
+     *
+     * Only the properties listed in LsColProperty are reported.
+     */
+    void setTypedResultHandler(const TypedResultHandler &handler) { _typedResultHandler = handler; }
+
 signals:
     void directoryListingSubfolders(const QStringList &items);
     void directoryListingIterated(const QString &name, const QMap<QString, QString> &properties);
+    /// A response with a 404 status, see SyncCollectionJob
+    void directoryListingRemoved(const QString &name);
     void finishedWithError(QNetworkReply *reply);
     void finishedWithoutError();
+
+private:
+    /// Consumes the tokens that are available in _reader
+    bool parseAvailable();
+
+    QXmlStreamReader _reader;
+    QHash<QString, qint64> *_sizes = nullptr;
+    QString _expectedPath;
+    bool _failed = false;
+
+    QStringList _folders;
+    QString _currentHref;
+    QMap<QString, QString> _currentTmpProperties;
+    QMap<QString, QString> _currentHttp200Properties;
+    bool _currentPropsHaveHttp200 = false;
+    bool _insidePropstat = false;
+    bool _insideProp = false;
+    bool _insideMultiStatus = false;
+    bool _multiStatusDone = false;
+    int _currentResponseCode = 0; // status of the whole response, if any
+
+    // Element whose text is being collected. Since the data arrives in chunks,
+    // the contents of an element can't be read in one go.
+    enum class TextTarget {
+        None,
+        Href,
+        Status,
+        ResponseStatus,
+        Property
+    };
+    TextTarget _textTarget = TextTarget::None;
+    QString _text;
+    int _propertyLevel = 0;
+    LsColProperty _currentProperty = LsColProperty::Unknown;
+
+    TypedResultHandler _typedResultHandler;
+    LsColProperties _currentTmpTypedProperties;
+    LsColProperties _currentHttp200TypedProperties;
 };
 
 class OWNCLOUDSYNC_EXPORT LsColJob : public AbstractNetworkJob
@@ -96,22 +218,45 @@ public:
 
     const QHash<QString, qint64> &sizes() const;
 
+    /// The Depth header of the request, "1" by default. "infinity" lists the whole subtree.
+    void setDepth(const QByteArray &depth) { _depth = depth; }
+
+    /** Use the typed fast path of the parser instead of directoryListingIterated()
+     *
+     * See LsColXMLParser::setTypedResultHandler()
+     */
+    void setTypedResultHandler(const LsColXMLParser::TypedResultHandler &handler) { _typedResultHandler = handler; }
+
 signals:
     void directoryListingSubfolders(const QStringList &items);
     void directoryListingIterated(const QString &name, const QMap<QString, QString> &properties);
+    void directoryListingRemoved(const QString &name);
     void finishedWithError(QNetworkReply *reply);
     void finishedWithoutError();
 
 private slots:
     bool finished() override;
+    void slotReadyRead();
 
 protected:
+    /// Sends a PROPFIND for the properties
     void startImpl(const QNetworkRequest &req);
+    /// Sends \a verb with \a body, the reply is parsed like for a PROPFIND
+    void startImpl(const QNetworkRequest &req, const QByteArray &verb, const QByteArray &body);
+    /// The <d:prop> element listing the properties
+    QByteArray propElement() const;
+    void newReplyHook(QNetworkReply *reply) override;
 
 private:
     QList<QByteArray> _properties;
     QUrl _url; // Used instead of path() if the url is specified in the constructor
     QHash<QString, qint64> _sizes;
+    QByteArray _depth = QByteArrayLiteral("1");
+
+    // Parses the reply while it is being received, see slotReadyRead()
+    QScopedPointer<LsColXMLParser> _parser;
+    bool _parserFailed = false;
+    LsColXMLParser::TypedResultHandler _typedResultHandler;
 };
 
 /**
@@ -138,6 +283,29 @@ private:
     bool _done = false;
 };
 
+/**
+ * @brief Lists the changes below a collection since a sync-token (RFC 6578)
+ *
+ * Sends a sync-collection REPORT with an infinite sync-level. Changed and new
+ * resources are reported like for a LsColJob, removed ones with
+ * directoryListingRemoved().
+ *
+ * Servers reply with an error if they don't support the report or if the
+ * token is no longer valid.
+ *
+ * @ingroup libsync
+ */
+class OWNCLOUDSYNC_EXPORT SyncCollectionJob : public LsColJob
+{
+    Q_OBJECT
+public:
+    explicit SyncCollectionJob(AccountPtr account, const QString &path, const QByteArray &syncToken, QObject *parent = nullptr);
+    void start() override;
+
+private:
+    QByteArray _syncToken;
+};
+
 #ifndef TOKEN_AUTH_ONLY
 /**
  * @brief Retrieves the account users avatar from the server using a GET request.
@@ -382,13 +382,50 @@ qint64 OwncloudPropagator::smallFileSize()
 }
 
 void OwncloudPropagator::start(SyncFileItemSet &&items)
+{
+    ensureRootJob();
+    appendJobs(items);
+
+    // Everything is known now, the root job may finish once it's done
+    _rootJob->_subJobs._expectMoreJobs = false;
+
+    _jobScheduled = false;
+    scheduleNextJob();
+}
+
+void OwncloudPropagator::startSubtree(SyncFileItemSet &&items)
+{
+    if (!_rootJob) {
+        ensureRootJob();
+        _rootJob->_subJobs._expectMoreJobs = true;
+    }
+    // The subtree goes right below the root job instead of below a job for its
+    // parent directory: the jobs of the other directories are only created by
+    // start(), once the discovery is done. That order is safe because the parent
+    // already exists locally, see SyncEngine::startPipelinedPropagation(), and
+    // its ancestors don't update their etags in this sync, so a parent job that
+    // finishes first can't mark the subtree as synced.
+    appendJobs(items);
+
+    scheduleNextJob();
+}
+
+void OwncloudPropagator::ensureRootJob()
+{
+    if (_rootJob)
+        return;
+
+    _rootJob.reset(new PropagateRootDirectory(this));
+    connect(_rootJob.data(), &PropagatorJob::finished, this, &OwncloudPropagator::emitFinished);
+}
+
+void OwncloudPropagator::appendJobs(const SyncFileItemSet &items)
 {
     /* This builds all the jobs needed for the propagation.
      * Each directory is a PropagateDirectory job, which contains the files in it.
      * In order to do that we loop over the items. (which are sorted by destination)
      * When we enter a directory, we can create the directory job and push it on the stack. */
 
-    _rootJob.reset(new PropagateRootDirectory(this));
     QStack<QPair<QString /* directory name */, PropagateDirectory * /* job */>> directories;
     directories.push(qMakePair(QString(), _rootJob.data()));
     QVector<PropagatorJob *> directoriesToRemove;
@@ -502,11 +539,6 @@ void OwncloudPropagator::start(SyncFileItemSet &&items)
     for (auto *it : qAsConst(directoriesToRemove)) {
         _rootJob->_dirDeletionJobs.appendJob(it);
     }
-
-    connect(_rootJob.data(), &PropagatorJob::finished, this, &OwncloudPropagator::emitFinished);
-
-    _jobScheduled = false;
-    scheduleNextJob();
 }
 
 const SyncOptions &OwncloudPropagator::syncOptions() const
@@ -867,7 +899,7 @@ bool PropagatorCompositeJob::scheduleSelfOrChild()
 
     // If neither us or our children had stuff left to do we could hang. Make sure
     // we mark this job as finished so that the propagator can schedule a new one.
-    if (_jobsToDo.isEmpty() && _tasksToDo.empty() && _runningJobs.isEmpty()) {
+    if (_jobsToDo.isEmpty() && _tasksToDo.empty() && _runningJobs.isEmpty() && !_expectMoreJobs) {
         // Our parent jobs are already iterating over their running jobs, post to the event loop
         // to avoid removing ourself from that list while they iterate.
         QMetaObject::invokeMethod(this, &PropagatorCompositeJob::finalize, Qt::QueuedConnection);
@@ -896,7 +928,7 @@ void PropagatorCompositeJob::slotSubJobFinished(SyncFileItem::Status status)
         _hasError = status;
     }
 
-    if (_jobsToDo.isEmpty() && _tasksToDo.empty() && _runningJobs.isEmpty()) {
+    if (_jobsToDo.isEmpty() && _tasksToDo.empty() && _runningJobs.isEmpty() && !_expectMoreJobs) {
         finalize();
     } else {
         propagator()->scheduleNextJob();
@@ -186,6 +186,12 @@ public:
     SyncFileItem::Status _hasError; // NoStatus,  or NormalError / SoftError if there was an error
     quint64 _abortsCount;
 
+    /** Don't finish when running out of jobs, more are going to be appended
+     *
+     * See OwncloudPropagator::startSubtree().
+     */
+    bool _expectMoreJobs = false;
+
     explicit PropagatorCompositeJob(OwncloudPropagator *propagator)
         : PropagatorJob(propagator)
         , _hasError(SyncFileItem::NoStatus), _abortsCount(0)
@@ -385,6 +391,14 @@ public:
 
     void start(SyncFileItemSet &&_syncedItems);
 
+    /** Start propagating some items while the discovery is still running
+     *
+     * The items must form complete subtrees that only create new things
+     * below existing directories. The propagation doesn't finish before
+     * start() was called with the remaining items.
+     */
+    void startSubtree(SyncFileItemSet &&items);
+
     const SyncOptions &syncOptions() const;
     void setSyncOptions(const SyncOptions &syncOptions);
 
@@ -575,6 +589,12 @@ signals:
     void insufficientRemoteStorage();
 
 private:
+    /// Creates _rootJob unless start() or startSubtree() already did
+    void ensureRootJob();
+
+    /// Builds the jobs for the items and appends them to _rootJob
+    void appendJobs(const SyncFileItemSet &items);
+
     AccountPtr _account;
     QScopedPointer<PropagateRootDirectory> _rootJob;
     SyncOptions _syncOptions;
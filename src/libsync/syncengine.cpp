@@ -333,6 +333,7 @@ void OCC::SyncEngine::slotItemDiscovered(const OCC::SyncFileItemPtr &item)
     // check for blacklisting of this item.
     // if the item is on blacklist, the instruction was set to ERROR
     checkErrorBlacklisting(*item);
+    noteItemError(*item);
     _needsUpdate = true;
 
     Q_ASSERT([&] {
@@ -350,9 +351,66 @@ void OCC::SyncEngine::slotItemDiscovered(const OCC::SyncFileItemPtr &item)
 
     if (item->isDirectory()) {
         slotFolderDiscovered(item->_etag.isEmpty(), item->_file);
+        startPipelinedPropagation(item);
     }
 }
 
+void SyncEngine::noteItemError(const SyncFileItem &item)
+{
+    if (item._status == SyncFileItem::BlacklistedError) {
+        // Only its own directory has to be listed again once the entry expires
+        _blacklistedItemDirectories.insert(item._file.left(qMax(0, item._file.lastIndexOf(QLatin1Char('/')))));
+    } else if (item.hasErrorStatus()) {
+        _hasItemErrors = true;
+    }
+}
+
+void SyncEngine::startPipelinedPropagation(const SyncFileItemPtr &dirItem)
+{
+    if (!_syncOptions._pipelinedPropagation || _syncOptions.fileRegex().isValid())
+        return;
+    if (dirItem->_instruction != CSYNC_INSTRUCTION_NEW || dirItem->_direction != SyncFileItem::Down
+        || dirItem->_originalFile != dirItem->_file)
+        return;
+
+    // A changed fingerprint means the downloads become uploads, see restoreOldFiles()
+    const auto databaseFingerprint = _journal->dataFingerprint();
+    if (!databaseFingerprint.isEmpty() && _discoveryPhase->_dataFingerprint != databaseFingerprint)
+        return;
+
+    // Directory items are discovered after their contents: a subtree inside a
+    // new directory is left to the subtree of that directory.
+    const QString &path = dirItem->_file;
+    const int parentEnd = path.lastIndexOf(QLatin1Char('/'));
+    if (parentEnd != -1 && !QFileInfo(_localPath + path.left(parentEnd)).isDir())
+        return;
+
+    // A new virtual file may still turn out to be a rename
+    if (_discoveryPhase->hasPendingDeletionsBelow(path))
+        return;
+
+    SyncFileItemSet subtree;
+    const QString pathPrefix = path + QLatin1Char('/');
+    for (auto it = _syncItems.find(dirItem); it != _syncItems.end(); ++it) {
+        const auto &item = *it;
+        if (item != dirItem && !item->destination().startsWith(pathPrefix))
+            break;
+        const bool newDown = item->_instruction == CSYNC_INSTRUCTION_NEW && item->_direction == SyncFileItem::Down;
+        if ((!newDown && item->_instruction != CSYNC_INSTRUCTION_IGNORE) || _pipelinedItems.count(item))
+            return;
+        subtree.insert(item);
+    }
+
+    qCInfo(lcEngine) << "Propagating" << path << "with" << subtree.size() << "items while the discovery continues";
+    _pipelinedItems.insert(subtree.begin(), subtree.end());
+    for (int i = parentEnd; i != -1; i = path.lastIndexOf(QLatin1Char('/'), i - 1))
+        _pipelinedAncestors.insert(path.left(i));
+
+    if (!_propagator)
+        createPropagator();
+    _propagator->startSubtree(std::move(subtree));
+}
+
 void SyncEngine::startSync()
 {
     if (_syncRunning) {
@@ -366,6 +424,9 @@ void SyncEngine::startSync()
 
     _hasNoneFiles = false;
     _hasRemoveFile = false;
+    _hasItemErrors = false;
+    _blacklistedItemDirectories.clear();
+    _aboutToPropagateEmitted = false;
     _seenConflictFiles.clear();
 
     _progressInfo->reset();
@@ -463,6 +524,7 @@ void SyncEngine::startSync()
     _discoveryPhase->_account = _account;
     _discoveryPhase->_excludes = _excludedFiles.data();
     _discoveryPhase->_statedb = _journal;
+    _discoveryPhase->_hasStoredServerListings = _journal->hasDiscoveryListings();
     _discoveryPhase->_localDir = _localPath;
     if (!_discoveryPhase->_localDir.endsWith(QLatin1Char('/')))
         _discoveryPhase->_localDir+=QLatin1Char('/');
@@ -471,6 +533,9 @@ void SyncEngine::startSync()
         _discoveryPhase->_remoteFolder+=QLatin1Char('/');
     _discoveryPhase->_syncOptions = _syncOptions;
     _discoveryPhase->_shouldDiscoverLocaly = [this](const QString &s) { return shouldDiscoverLocally(s); };
+    _discoveryPhase->_skipUnchangedLocalDirectories = _localDiscoveryStyle == LocalDiscoveryStyle::UnchangedDirectoriesFromDatabase;
+    if (_discoveryPhase->_skipUnchangedLocalDirectories)
+        _discoveryPhase->_knownLocalDirectoryStates = _journal->localDirectoryStates();
     _discoveryPhase->setSelectiveSyncBlackList(selectiveSyncBlackList);
     _discoveryPhase->setSelectiveSyncWhiteList(_journal->getSelectiveSyncList(SyncJournalDb::SelectiveSyncWhiteList, &ok));
     if (!ok) {
@@ -495,12 +560,24 @@ void SyncEngine::startSync()
         _discoveryPhase->_invalidFilenameRx = QRegExp(invalidFilenamePattern);
     _discoveryPhase->_serverBlacklistedFiles = _account->capabilities().blacklistedFiles();
     _discoveryPhase->_ignoreHiddenFiles = ignoreHiddenFiles();
+    _discoveryPhase->_lastSyncToken = _journal->syncToken();
+    if (_syncOptions._journalSnapshot) {
+        QElapsedTimer snapshotTimer;
+        snapshotTimer.start();
+        _discoveryPhase->_journalSnapshot.reset(new SyncJournalSnapshot);
+        if (_discoveryPhase->_journalSnapshot->load(_journal)) {
+            qCInfo(lcEngine) << "Loaded" << _discoveryPhase->_journalSnapshot->size() << "journal records in" << snapshotTimer.elapsed() << "ms";
+        } else {
+            qCWarning(lcEngine) << "Could not load the journal snapshot, querying the journal instead";
+            _discoveryPhase->_journalSnapshot.reset();
+        }
+    }
 
     connect(_discoveryPhase.data(), &DiscoveryPhase::itemDiscovered, this, &SyncEngine::slotItemDiscovered);
     connect(_discoveryPhase.data(), &DiscoveryPhase::newBigFolder, this, &SyncEngine::newBigFolder);
     connect(_discoveryPhase.data(), &DiscoveryPhase::fatalError, this, [this](const QString &errorString) {
         Q_EMIT syncError(errorString);
-        finalize(false);
+        abortBeforePropagation();
     });
     connect(_discoveryPhase.data(), &DiscoveryPhase::finished, this, &SyncEngine::slotDiscoveryFinished);
     connect(_discoveryPhase.data(), &DiscoveryPhase::silentlyExcluded,
@@ -564,7 +641,7 @@ void SyncEngine::slotDiscoveryFinished()
     if (!_journal->open()) {
         qCWarning(lcEngine) << "Bailing out, DB failure";
         Q_EMIT syncError(tr("Cannot open the sync journal"));
-        finalize(false);
+        abortBeforePropagation();
         return;
     } else {
         // Commits a possibly existing (should not though) transaction and starts a new one for the propagate phase
@@ -633,6 +710,7 @@ void SyncEngine::slotDiscoveryFinished()
 
         // To announce the beginning of the sync
         emit aboutToPropagate(_syncItems);
+        _aboutToPropagateEmitted = true;
 
         qCInfo(lcEngine) << "#### Reconcile (aboutToPropagate OK) #################################################### "<< _stopWatch.addLapTime(QStringLiteral("Reconcile (aboutToPropagate OK)")) << "ms";
 
@@ -641,6 +719,11 @@ void SyncEngine::slotDiscoveryFinished()
         emit transmissionProgress(*_progressInfo);
         _progressInfo->startEstimateUpdates();
 
+        const auto completedItems = std::move(_completedBeforePropagation);
+        _completedBeforePropagation.clear();
+        for (const auto &item : completedItems)
+            slotItemCompleted(item);
+
         // post update phase script: allow to tweak stuff by a custom script in debug mode.
         if (!qEnvironmentVariableIsEmpty("OWNCLOUD_POST_UPDATE_SCRIPT")) {
 #ifndef NDEBUG
@@ -656,24 +739,8 @@ void SyncEngine::slotDiscoveryFinished()
         // do a database commit
         _journal->commit(QStringLiteral("post treewalk"));
 
-        _propagator = QSharedPointer<OwncloudPropagator>(
-            new OwncloudPropagator(_account, _localPath, _remotePath, _journal));
-        _propagator->setSyncOptions(_syncOptions);
-        connect(_propagator.data(), &OwncloudPropagator::itemCompleted,
-            this, &SyncEngine::slotItemCompleted);
-        connect(_propagator.data(), &OwncloudPropagator::progress,
-            this, &SyncEngine::slotProgress);
-        connect(_propagator.data(), &OwncloudPropagator::updateFileTotal,
-            this, &SyncEngine::updateFileTotal);
-        connect(_propagator.data(), &OwncloudPropagator::finished, this, &SyncEngine::slotPropagationFinished, Qt::QueuedConnection);
-        connect(_propagator.data(), &OwncloudPropagator::seenLockedFile, this, &SyncEngine::seenLockedFile);
-        connect(_propagator.data(), &OwncloudPropagator::touchedFile, this, &SyncEngine::slotAddTouchedFile);
-        connect(_propagator.data(), &OwncloudPropagator::insufficientLocalStorage, this, &SyncEngine::slotInsufficientLocalStorage);
-        connect(_propagator.data(), &OwncloudPropagator::insufficientRemoteStorage, this, &SyncEngine::slotInsufficientRemoteStorage);
-        connect(_propagator.data(), &OwncloudPropagator::newItem, this, &SyncEngine::slotNewItem);
-
-        // apply the network limits to the propagator
-        setNetworkLimits(_uploadLimit, _downloadLimit);
+        if (!_propagator)
+            createPropagator();
 
         deleteStaleDownloadInfos(_syncItems);
         deleteStaleUploadInfos(_syncItems);
@@ -684,6 +751,20 @@ void SyncEngine::slotDiscoveryFinished()
         if (_needsUpdate)
             Q_EMIT started();
 
+        // The pipelined items are already being propagated
+        if (!_pipelinedItems.empty()) {
+            for (const auto &item : _pipelinedItems)
+                _syncItems.erase(item);
+            // Like for removed directories in OwncloudPropagator::start(), the etags
+            // of the parent directories are updated in the next sync
+            for (const auto &item : _syncItems) {
+                if (item->isDirectory() && item->_instruction == CSYNC_INSTRUCTION_UPDATE_METADATA
+                    && _pipelinedAncestors.contains(item->_file)) {
+                    item->_instruction = CSYNC_INSTRUCTION_NONE;
+                }
+            }
+        }
+
         _propagator->start(std::move(_syncItems));
 
         qCInfo(lcEngine) << "#### Post-Reconcile end #################################################### " << _stopWatch.addLapTime(QStringLiteral("Post-Reconcile Finished")) << "ms";
@@ -709,7 +790,7 @@ void SyncEngine::slotDiscoveryFinished()
             guard->deleteLater();
             if (cancel) {
                 qCInfo(lcEngine) << "User aborted sync";
-                finalize(false);
+                abortBeforePropagation();
                 return;
             } else {
                 finish();
@@ -721,6 +802,41 @@ void SyncEngine::slotDiscoveryFinished()
     finish();
 }
 
+void SyncEngine::createPropagator()
+{
+    _propagator = QSharedPointer<OwncloudPropagator>(
+        new OwncloudPropagator(_account, _localPath, _remotePath, _journal));
+    _propagator->setSyncOptions(_syncOptions);
+    connect(_propagator.data(), &OwncloudPropagator::itemCompleted,
+        this, &SyncEngine::slotItemCompleted);
+    connect(_propagator.data(), &OwncloudPropagator::progress,
+        this, &SyncEngine::slotProgress);
+    connect(_propagator.data(), &OwncloudPropagator::updateFileTotal,
+        this, &SyncEngine::updateFileTotal);
+    connect(_propagator.data(), &OwncloudPropagator::finished, this, &SyncEngine::slotPropagationFinished, Qt::QueuedConnection);
+    connect(_propagator.data(), &OwncloudPropagator::seenLockedFile, this, &SyncEngine::seenLockedFile);
+    connect(_propagator.data(), &OwncloudPropagator::touchedFile, this, &SyncEngine::slotAddTouchedFile);
+    connect(_propagator.data(), &OwncloudPropagator::insufficientLocalStorage, this, &SyncEngine::slotInsufficientLocalStorage);
+    connect(_propagator.data(), &OwncloudPropagator::insufficientRemoteStorage, this, &SyncEngine::slotInsufficientRemoteStorage);
+    connect(_propagator.data(), &OwncloudPropagator::newItem, this, &SyncEngine::slotNewItem);
+
+    // apply the network limits to the propagator
+    setNetworkLimits(_uploadLimit, _downloadLimit);
+}
+
+void SyncEngine::abortBeforePropagation()
+{
+    if (!_propagator) {
+        finalize(false);
+        return;
+    }
+
+    // A pipelined propagation is running, the sync finishes once it was aborted
+    if (_discoveryPhase)
+        disconnect(_discoveryPhase.data(), nullptr, this, nullptr);
+    _propagator->abort();
+}
+
 void SyncEngine::setNetworkLimits(int upload, int download)
 {
     _uploadLimit = upload;
@@ -739,7 +855,14 @@ void SyncEngine::setNetworkLimits(int upload, int download)
 
 void SyncEngine::slotItemCompleted(const SyncFileItemPtr &item)
 {
+    if (!_aboutToPropagateEmitted) {
+        // A pipelined item: announce it after aboutToPropagate() like all others
+        _completedBeforePropagation.append(item);
+        return;
+    }
+
     _progressInfo->setProgressComplete(*item);
+    noteItemError(*item);
 
     emit transmissionProgress(*_progressInfo);
     emit itemCompleted(item);
@@ -753,6 +876,20 @@ void SyncEngine::slotPropagationFinished(bool success)
 
     if (success && _discoveryPhase) {
         _journal->setDataFingerprint(_discoveryPhase->_dataFingerprint);
+        // Items that failed must be looked at again, so only then the changes since
+        // this sync are enough for the next one
+        const bool hasBlacklistedItems = !_blacklistedItemDirectories.isEmpty();
+        _journal->setSyncToken(_hasItemErrors || hasBlacklistedItems ? QByteArray() : _discoveryPhase->_syncToken);
+        // Likewise the db only has all entries of the listed directories if nothing failed
+        if (!_hasItemErrors) {
+            for (const auto &dirState : _discoveryPhase->_localDirectoryStates) {
+                if (!_blacklistedItemDirectories.contains(dirState.first))
+                    _journal->setLocalDirectoryState(dirState.first.toUtf8(), dirState.second);
+            }
+        }
+        // The listings of an interrupted sync are in the file records now
+        if (_discoveryPhase->_hasStoredServerListings)
+            _journal->clearDiscoveryListings();
     }
 
     conflictRecordMaintenance();
@@ -774,8 +911,17 @@ void SyncEngine::finalize(bool success)
 {
     qCInfo(lcEngine) << "Sync run took " << _stopWatch.addLapTime(QStringLiteral("Sync Finished")) << "ms";
     _stopWatch.stop();
+    const auto journalWrites = _journal->takeWriteStatistics();
+    qCInfo(lcEngine) << "Journal wrote" << journalWrites.records << "file records in" << journalWrites.recordNsecs / 1000000 << "ms,"
+                     << journalWrites.commits << "commits took" << journalWrites.commitNsecs / 1000000 << "ms";
+    if (SqlProfiler::isEnabled())
+        SqlProfiler::dump();
 
     if (_discoveryPhase) {
+        if (!success)
+            _discoveryPhase->writeServerListings();
+        // With pipelined propagation the discovery may still be running
+        disconnect(_discoveryPhase.data(), nullptr, this, nullptr);
         _discoveryPhase.take()->deleteLater();
     }
     _syncRunning = false;
@@ -783,6 +929,9 @@ void SyncEngine::finalize(bool success)
 
     // Delete the propagator only after emitting the signal.
     _propagator.clear();
+    _pipelinedItems.clear();
+    _pipelinedAncestors.clear();
+    _completedBeforePropagation.clear();
     _seenConflictFiles.clear();
     _uniqueErrors.clear();
     _localDiscoveryPaths.clear();
@@ -794,13 +943,16 @@ void SyncEngine::finalize(bool success)
 void SyncEngine::slotProgress(const SyncFileItem &item, qint64 current)
 {
     _progressInfo->setProgressItem(item, current);
-    emit transmissionProgress(*_progressInfo);
+    // Pipelined items only show up once the discovery announced all items
+    if (_aboutToPropagateEmitted)
+        emit transmissionProgress(*_progressInfo);
 }
 
 void SyncEngine::updateFileTotal(const SyncFileItem &item, qint64 newSize)
 {
     _progressInfo->updateTotalsForFile(item, newSize);
-    emit transmissionProgress(*_progressInfo);
+    if (_aboutToPropagateEmitted)
+        emit transmissionProgress(*_progressInfo);
 }
 void SyncEngine::restoreOldFiles(SyncFileItemSet &syncItems)
 {
@@ -974,12 +1126,16 @@ void SyncEngine::abort()
         qCInfo(lcEngine) << "Aborting sync";
 
     if (_propagator) {
-        // If we're already in the propagation phase, aborting that is sufficient
+        // If we're already in the propagation phase, aborting that is sufficient.
+        // A pipelined propagation may have started during the discovery though.
+        if (_discoveryPhase)
+            disconnect(_discoveryPhase.data(), nullptr, this, nullptr);
         _propagator->abort();
     } else if (_discoveryPhase) {
         // Delete the discovery and all child jobs after ensuring
         // it can't finish and start the propagator
         disconnect(_discoveryPhase.data(), nullptr, this, nullptr);
+        _discoveryPhase->writeServerListings();
         _discoveryPhase.take()->deleteLater();
 
         if (!_goingDown) {
@@ -107,6 +107,8 @@ public:
      * If style is DatabaseAndFilesystem, paths a set of file paths relative to
      * the synced folder. All the parent directories of these paths will not
      * be read from the db and scanned on the filesystem.
+     * With UnchangedDirectoriesFromDatabase the other directories are only
+     * read from the db if their mtime and inode didn't change either.
      *
      * Note, the style and paths are only retained for the next sync and
      * revert afterwards. Use _lastLocalDiscoveryStyle to discover the last
@@ -208,6 +210,8 @@ private slots:
 
 private:
     bool checkErrorBlacklisting(SyncFileItem &item);
+    /// Sets _hasItemErrors or _blacklistedItemDirectories for a discovered or completed item
+    void noteItemError(const SyncFileItem &item);
 
     // Cleans up unnecessary downloadinfo entries in the journal as well
     // as their temporary files.
@@ -225,9 +229,36 @@ private:
     // cleanup and emit the finished signal
     void finalize(bool success);
 
+    /** Ends the sync after a failure before the propagation was started
+     *
+     * A pipelined propagation is aborted first and the sync finishes with it.
+     */
+    void abortBeforePropagation();
+
+    /// Creates _propagator and connects it
+    void createPropagator();
+
+    /** Start propagating the subtree of a new remote directory right away
+     *
+     * Only done with SyncOptions::_pipelinedPropagation and if nothing the
+     * rest of the discovery finds can affect the subtree. Its items stay in
+     * _syncItems and are also recorded in _pipelinedItems.
+     */
+    void startPipelinedPropagation(const SyncFileItemPtr &dirItem);
+
     // Must only be acessed during update and reconcile
     SyncFileItemSet _syncItems;
 
+    // Items that were handed to the propagator during the discovery, see startPipelinedPropagation()
+    SyncFileItemSet _pipelinedItems;
+
+    // Existing directories containing _pipelinedItems, their etag is only updated in the next sync
+    QSet<QString> _pipelinedAncestors;
+
+    // Pipelined items completed before aboutToPropagate() was emitted, itemCompleted() is held back
+    QVector<SyncFileItemPtr> _completedBeforePropagation;
+    bool _aboutToPropagateEmitted = false;
+
     AccountPtr _account;
     bool _needsUpdate;
     bool _syncRunning;
@@ -265,6 +296,11 @@ private:
     // true if there is at leasr one file with instruction REMOVE
     bool _hasRemoveFile;
 
+    // true if an item could not be synced, see SyncJournalDb::setSyncToken()
+    bool _hasItemErrors = false;
+    // the directories of items skipped because of their blacklist entry, see noteItemError()
+    QSet<QString> _blacklistedItemDirectories;
+
     // If ignored files should be ignored
     bool _ignore_hidden_files = false;
 
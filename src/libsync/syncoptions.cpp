@@ -49,6 +49,12 @@ void SyncOptions::fillFromEnvironmentVariables()
     int maxParallel = qgetenv("OWNCLOUD_MAX_PARALLEL").toInt();
     if (maxParallel > 0)
         _parallelNetworkJobs = maxParallel;
+
+    if (!qEnvironmentVariableIsEmpty("OWNCLOUD_PIPELINED_PROPAGATION"))
+        _pipelinedPropagation = qEnvironmentVariableIntValue("OWNCLOUD_PIPELINED_PROPAGATION") != 0;
+
+    if (!qEnvironmentVariableIsEmpty("OWNCLOUD_JOURNAL_SNAPSHOT"))
+        _journalSnapshot = qEnvironmentVariableIntValue("OWNCLOUD_JOURNAL_SNAPSHOT") != 0;
 }
 
 void SyncOptions::verifyChunkSizes()
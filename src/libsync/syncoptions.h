@@ -73,10 +73,23 @@ public:
     /** The maximum number of active jobs in parallel  */
     int _parallelNetworkJobs = 6;
 
+    /** Start propagating new remote subtrees while the discovery is still running
+     *
+     * See SyncEngine::startPipelinedPropagation().
+     */
+    bool _pipelinedPropagation = false;
+
+    /** Load the journal's metadata into memory once for the discovery
+     *
+     * Saves a query per directory at the cost of memory, see SyncJournalSnapshot.
+     */
+    bool _journalSnapshot = false;
+
     /** Reads settings from env vars where available.
      *
      * Currently reads _initialChunkSize, _minChunkSize, _maxChunkSize,
-     * _targetChunkUploadDuration, _parallelNetworkJobs.
+     * _targetChunkUploadDuration, _parallelNetworkJobs, _pipelinedPropagation,
+     * _journalSnapshot.
      */
     void fillFromEnvironmentVariables();
 
@@ -0,0 +1,178 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *    support, and with no warranty, express or implied, as to its usefulness for
+ *    any purpose.
+ *
+ */
+
+/*
+ * Measures the exclude matching of csync_exclude.cpp on its own.
+ *
+ * Usage: ExcludeMatchingBench [number of paths] [exclude list...]
+ *
+ * The global sync-exclude.lst is always loaded, further lists are added to it.
+ * Reports the time and the number of heap allocations per path.
+ */
+
+#include "csync_exclude.h"
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QRandomGenerator>
+#include <QTemporaryDir>
+
+#include <atomic>
+#include <cstdlib>
+#include <functional>
+
+static std::atomic<quint64> allocations { 0 };
+
+#ifdef __GLIBC__
+// Count all heap allocations, QString's data doesn't go through operator new
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_realloc(ptr, size);
+}
+}
+static const bool countsAllocations = true;
+#else
+static const bool countsAllocations = false;
+#endif
+
+namespace {
+
+// Names as they show up in real trees, including some that are excluded
+const char *const dirNames[] = { "Documents", "Photos", "src", "build", "node_modules", ".git",
+    "Projects", "2019", "Shared", ".TemporaryItems", "backup", "latex" };
+const char *const fileNames[] = { "report.docx", "~$report.docx", "notes.txt", "notes.txt~",
+    "IMG_0001.jpg", ".DS_Store", "Thumbs.db", "Desktop.ini", "data.part", "main.cpp",
+    "main.cpp.swp", ".~lock.report.docx#", "paper (conflicted copy 2020-01-01).tex",
+    "paper_conflict-20200101-120000.tex", "video.crdownload", "index.html", "Makefile" };
+
+// Half of the names get a number appended, the others repeat all over the tree
+template <int N>
+QString pickName(QRandomGenerator &random, const char *const (&names)[N])
+{
+    QString name = QString::fromUtf8(names[random.bounded(N)]);
+    if (random.bounded(2))
+        name += QString::number(random.bounded(1000));
+    return name;
+}
+
+/// Generates count paths of varying depth
+QStringList generatePaths(int count)
+{
+    QRandomGenerator random(42);
+
+    QStringList paths;
+    paths.reserve(count);
+    for (int i = 0; i < count; ++i) {
+        QString path;
+        const int depth = random.bounded(6);
+        for (int d = 0; d < depth; ++d)
+            path += pickName(random, dirNames) + QLatin1Char('/');
+        paths.append(path + pickName(random, fileNames));
+    }
+    return paths;
+}
+
+/// Runs match on each path until total paths were matched, prints ns and allocations per path
+void measure(const char *name, const QStringList &paths, qint64 total, const std::function<bool(const QString &)> &match)
+{
+    qint64 excluded = 0;
+    const auto allocationsBefore = allocations.load();
+    QElapsedTimer timer;
+    timer.start();
+    for (qint64 i = 0; i < total; ++i) {
+        if (match(paths[i % paths.size()]))
+            ++excluded;
+    }
+    const auto nsecs = timer.nsecsElapsed();
+    const auto allocated = allocations.load() - allocationsBefore;
+
+    qDebug() << name << ":" << total << "paths," << excluded << "excluded,"
+             << double(nsecs) / total << "ns/path,"
+             << (countsAllocations ? QString::number(double(allocated) / total) : QStringLiteral("n/a"))
+             << "allocations/path";
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    const auto arguments = app.arguments();
+
+    qint64 total = 1000000;
+    if (arguments.size() > 1)
+        total = arguments[1].toLongLong();
+
+    ExcludedFiles excludes;
+    excludes.addExcludeFilePath(QStringLiteral(SOURCEDIR "/sync-exclude.lst"));
+    for (int i = 2; i < arguments.size(); ++i)
+        excludes.addExcludeFilePath(arguments[i]);
+    if (!excludes.reloadExcludeFiles()) {
+        qWarning() << "Could not load the exclude lists";
+        return -1;
+    }
+
+    // Paths are repeated once there are more than this
+    const auto paths = generatePaths(int(std::min<qint64>(total, 100000)));
+    qDebug() << "PATHS" << total << "UNIQUE" << paths.size();
+
+    measure("traversalPatternMatch", paths, total, [&](const QString &path) {
+        return excludes.traversalPatternMatch(&path, ItemTypeFile) != CSYNC_NOT_EXCLUDED;
+    });
+
+    // fullPatternMatch() is reached through isExcludedRemote()
+    const QString basePath = QStringLiteral("/base/");
+    QStringList absolutePaths;
+    absolutePaths.reserve(paths.size());
+    for (const auto &path : paths)
+        absolutePaths.append(basePath + path);
+    measure("fullPatternMatch", absolutePaths, total, [&](const QString &path) {
+        return excludes.isExcludedRemote(path, basePath, false, ItemTypeFile);
+    });
+
+    // isExcluded() stats the file, so it needs a real tree
+    QTemporaryDir tmp;
+    if (!tmp.isValid())
+        return -1;
+    const QString localBasePath = tmp.path() + QLatin1Char('/');
+    QStringList localPaths;
+    for (int i = 0; i < std::min(paths.size(), 10000); ++i) {
+        const auto &path = paths[i];
+        if (path.contains(QLatin1Char('/')))
+            QDir(localBasePath).mkpath(path.section(QLatin1Char('/'), 0, -2));
+        QFile file(localBasePath + path);
+        if (!file.open(QFile::WriteOnly))
+            continue;
+        localPaths.append(localBasePath + path);
+    }
+    measure("isExcluded", localPaths, std::min<qint64>(total, localPaths.size() * 10), [&](const QString &path) {
+        return excludes.isExcluded(path, localBasePath, false);
+    });
+
+    return 0;
+}
@@ -0,0 +1,309 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *    support, and with no warranty, express or implied, as to its usefulness for
+ *    any purpose.
+ *
+ */
+
+/*
+ * Measures SyncJournalDb on a synthetic journal of the given size.
+ *
+ * Usage: JournalScaleBench [number of records] [output file]
+ *
+ * The journal is filled with a generated tree that mixes small document
+ * folders, deep source trees and large media folders. The results are
+ * written as JSON to the output file, or to stdout if there is none.
+ */
+
+#include "common/syncjournaldb.h"
+#include "common/syncjournalfilerecord.h"
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QRandomGenerator>
+#include <QTemporaryDir>
+
+#include <algorithm>
+#include <deque>
+#include <functional>
+
+using namespace OCC;
+
+namespace {
+
+const int sampleSize = 10000;
+
+struct Journal
+{
+    qint64 records = 0;
+    QVector<QByteArray> dirs;
+    // Random existing files, see fill()
+    QVector<SyncJournalFileRecord> sample;
+};
+
+SyncJournalFileRecord makeRecord(QRandomGenerator &random, const QByteArray &path, ItemType type, qint64 number)
+{
+    SyncJournalFileRecord record;
+    record._path = path;
+    record._type = type;
+    record._inode = quint64(number + 1);
+    record._modtime = 1500000000 + random.bounded(100000000);
+    record._etag = QByteArray::number(random.generate64(), 16);
+    record._fileId = QByteArray::number(number).rightJustified(8, '0') + "ocbench0000";
+    if (type == ItemTypeDirectory) {
+        record._remotePerm = RemotePermissions::fromDbValue("WDNVCKR");
+    } else {
+        record._remotePerm = RemotePermissions::fromDbValue("WDNVR");
+        record._fileSize = random.bounded(10 * 1024 * 1024);
+        record._checksumHeader = "SHA1:" + QByteArray::number(random.generate64(), 16).repeated(3);
+    }
+    return record;
+}
+
+/// Writes count records in the shape of a real sync folder
+bool fill(SyncJournalDb &db, qint64 count, Journal &journal)
+{
+    QRandomGenerator random(42);
+    std::deque<QPair<QByteArray, int>> pending; // path and depth
+    qint64 files = 0;
+
+    auto add = [&](const QByteArray &path, ItemType type) {
+        const auto record = makeRecord(random, path, type, journal.records);
+        if (!db.setFileRecord(record))
+            return false;
+        ++journal.records;
+        if (type == ItemTypeDirectory) {
+            journal.dirs.append(path);
+        } else if (++files <= sampleSize) {
+            journal.sample.append(record);
+        } else {
+            // Reservoir sampling over the files only, every file has the same chance to be in the sample
+            const auto slot = random.bounded(quint32(files));
+            if (slot < sampleSize)
+                journal.sample[int(slot)] = record;
+        }
+        if (journal.records % 50000 == 0)
+            db.commitIfNeededAndStartNewTransaction(QStringLiteral("fill"));
+        return true;
+    };
+
+    db.commitIfNeededAndStartNewTransaction(QStringLiteral("fill"));
+    int topLevel = 0;
+    while (journal.records < count) {
+        if (pending.empty()) {
+            const QByteArray path = "Folder" + QByteArray::number(++topLevel);
+            if (!add(path, ItemTypeDirectory))
+                return false;
+            pending.emplace_back(path, 1);
+        }
+        const auto dir = pending.front();
+        pending.pop_front();
+
+        int files, subDirs;
+        const auto shape = random.bounded(100);
+        if (shape < 70) {
+            // Documents
+            files = random.bounded(20);
+            subDirs = random.bounded(5);
+        } else if (shape < 90) {
+            // Source trees, they get deep
+            files = 5 + random.bounded(45);
+            subDirs = 2 + random.bounded(7);
+        } else {
+            // Photos and other media
+            files = 200 + random.bounded(1800);
+            subDirs = random.bounded(2);
+        }
+        if (dir.second >= 12)
+            subDirs = 0;
+
+        for (int i = 0; i < files && journal.records < count; ++i) {
+            if (!add(dir.first + "/file" + QByteArray::number(i) + ".dat", ItemTypeFile))
+                return false;
+        }
+        for (int i = 0; i < subDirs && journal.records < count; ++i) {
+            const QByteArray path = dir.first + "/dir" + QByteArray::number(i);
+            if (!add(path, ItemTypeDirectory))
+                return false;
+            pending.emplace_back(path, dir.second + 1);
+        }
+    }
+    db.commit(QStringLiteral("fill"), false);
+    return true;
+}
+
+/// Runs op iterations times, op returns the number of rows it handled or -1 on error
+QJsonObject measure(const char *name, int iterations, const std::function<qint64(int)> &op)
+{
+    qint64 rows = 0;
+    bool ok = true;
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < iterations; ++i) {
+        const auto result = op(i);
+        if (result < 0)
+            ok = false;
+        else
+            rows += result;
+    }
+    const auto nsecs = timer.nsecsElapsed();
+    const auto perCall = double(nsecs) / std::max(iterations, 1);
+
+    qDebug() << name << ":" << iterations << "calls," << rows << "rows,"
+             << double(nsecs) / 1000000 << "ms," << perCall << "ns/call" << (ok ? "" : "FAILED");
+    return QJsonObject {
+        { QStringLiteral("iterations"), iterations },
+        { QStringLiteral("rows"), rows },
+        { QStringLiteral("totalMs"), double(nsecs) / 1000000 },
+        { QStringLiteral("nsPerCall"), perCall },
+        { QStringLiteral("ok"), ok },
+    };
+}
+
+qint64 countBelow(SyncJournalDb &db, const QByteArray &path)
+{
+    qint64 rows = 0;
+    if (!db.getFilesBelowPath(path, [&](const SyncJournalFileRecord &) { ++rows; }))
+        return -1;
+    return rows;
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    const auto arguments = app.arguments();
+
+    qint64 count = 1000000;
+    if (arguments.size() > 1)
+        count = arguments[1].toLongLong();
+
+    QTemporaryDir tmp;
+    if (!tmp.isValid())
+        return -1;
+    SyncJournalDb db(tmp.path() + QStringLiteral("/journal.db"));
+
+    Journal journal;
+    QElapsedTimer timer;
+    timer.start();
+    if (!fill(db, count, journal)) {
+        qWarning() << "Could not fill the journal";
+        return -1;
+    }
+    const auto fillMsecs = timer.elapsed();
+    qDebug() << "RECORDS" << journal.records << "DIRS" << journal.dirs.size() << "FILL" << fillMsecs << "ms";
+    if (journal.sample.isEmpty() || journal.dirs.isEmpty())
+        return -1;
+
+    QRandomGenerator random(23);
+    auto randomDir = [&] { return journal.dirs[random.bounded(journal.dirs.size())]; };
+    QJsonObject results;
+
+    results[QStringLiteral("getFileRecord")] = measure("getFileRecord", journal.sample.size(), [&](int i) {
+        SyncJournalFileRecord record;
+        if (!db.getFileRecord(journal.sample[i]._path, &record))
+            return -1;
+        return record.isValid() ? 1 : 0;
+    });
+    results[QStringLiteral("getFileRecordMissing")] = measure("getFileRecordMissing", journal.sample.size(), [&](int i) {
+        SyncJournalFileRecord record;
+        if (!db.getFileRecord(journal.sample[i]._path + ".missing", &record))
+            return -1;
+        return record.isValid() ? 1 : 0;
+    });
+    results[QStringLiteral("getFileRecordsByFileId")] = measure("getFileRecordsByFileId", journal.sample.size(), [&](int i) {
+        qint64 rows = 0;
+        if (!db.getFileRecordsByFileId(journal.sample[i]._fileId, [&](const SyncJournalFileRecord &) { ++rows; }))
+            return qint64(-1);
+        return rows;
+    });
+    results[QStringLiteral("listFilesInPath")] = measure("listFilesInPath", 1000, [&](int) {
+        qint64 rows = 0;
+        if (!db.listFilesInPath(randomDir(), [&](const SyncJournalFileRecord &) { ++rows; }))
+            return qint64(-1);
+        return rows;
+    });
+    results[QStringLiteral("getFilesBelowPath")] = measure("getFilesBelowPath", 100, [&](int) {
+        return countBelow(db, randomDir());
+    });
+    // What the local discovery of a sync reads when it can't trust the file system
+    results[QStringLiteral("getFilesBelowPathRoot")] = measure("getFilesBelowPathRoot", 1, [&](int) {
+        return countBelow(db, QByteArray());
+    });
+
+    // Batches the way the propagator writes them, committed at the end
+    const int batchSize = 1000;
+    const int batches = journal.sample.size() / batchSize;
+    results[QStringLiteral("setFileRecordUpdate")] = measure("setFileRecordUpdate", batches, [&](int batch) {
+        db.commitIfNeededAndStartNewTransaction(QStringLiteral("update"));
+        for (int i = batch * batchSize; i < (batch + 1) * batchSize; ++i) {
+            auto record = journal.sample[i];
+            record._etag += "-updated";
+            if (!db.setFileRecord(record))
+                return qint64(-1);
+        }
+        db.commit(QStringLiteral("update"), false);
+        return qint64(batchSize);
+    });
+    results[QStringLiteral("setFileRecordInsert")] = measure("setFileRecordInsert", batches, [&](int batch) {
+        db.commitIfNeededAndStartNewTransaction(QStringLiteral("insert"));
+        const QByteArray dir = randomDir();
+        for (int i = 0; i < batchSize; ++i) {
+            const QByteArray path = dir + "/new" + QByteArray::number(batch) + "-" + QByteArray::number(i);
+            if (!db.setFileRecord(makeRecord(random, path, ItemTypeFile, count + batch * batchSize + i)))
+                return qint64(-1);
+        }
+        db.commit(QStringLiteral("insert"), false);
+        return qint64(batchSize);
+    });
+
+    // Counting isn't part of the measurement, so get the sizes of the deleted trees first.
+    // The trees must not overlap, or the rows of a tree deleted earlier would be counted again
+    QVector<QPair<QByteArray, qint64>> deletions;
+    auto isBelow = [](const QByteArray &path, const QByteArray &dir) {
+        return path.startsWith(dir) && (path.size() == dir.size() || path[dir.size()] == '/');
+    };
+    for (int attempt = 0; attempt < 1000 && deletions.size() < 20; ++attempt) {
+        const auto dir = randomDir();
+        const bool overlaps = std::any_of(deletions.cbegin(), deletions.cend(), [&](const QPair<QByteArray, qint64> &other) {
+            return isBelow(dir, other.first) || isBelow(other.first, dir);
+        });
+        if (!overlaps)
+            deletions.append({ dir, countBelow(db, dir) + 1 });
+    }
+    results[QStringLiteral("deleteFileRecordRecursive")] = measure("deleteFileRecordRecursive", deletions.size(), [&](int i) {
+        if (!db.deleteFileRecord(QString::fromUtf8(deletions[i].first), true))
+            return qint64(-1);
+        db.commit(QStringLiteral("delete"), false);
+        return deletions[i].second;
+    });
+    db.close();
+
+    const QJsonObject output {
+        { QStringLiteral("records"), journal.records },
+        { QStringLiteral("directories"), journal.dirs.size() },
+        { QStringLiteral("fillMs"), fillMsecs },
+        { QStringLiteral("journalBytes"), QFileInfo(tmp.path() + QStringLiteral("/journal.db")).size() },
+        { QStringLiteral("operations"), results },
+    };
+    const auto json = QJsonDocument(output).toJson();
+    if (arguments.size() > 2) {
+        QFile file(arguments[2]);
+        if (!file.open(QFile::WriteOnly) || file.write(json) != json.size()) {
+            qWarning() << "Could not write" << arguments[2];
+            return -1;
+        }
+    } else {
+        QFile out;
+        if (!out.open(stdout, QFile::WriteOnly))
+            return -1;
+        out.write(json);
+    }
+    return 0;
+}
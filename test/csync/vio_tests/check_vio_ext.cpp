@@ -28,6 +28,8 @@
 #include "vio/csync_vio_local.h"
 
 #include <QDir>
+#include <QDateTime>
+#include <QFileInfo>
 
 static const auto CSYNC_TEST_DIR = []{ return QStringLiteral("%1/csync_test").arg(QDir::tempPath());}();
 
@@ -353,6 +355,35 @@ static void check_readdir_bigunicode(void **state)
     assert_int_equal(files_cnt, 0);
 }
 
+static void check_readdir_stat(void **state)
+{
+    (void) state; /* unused */
+
+    const char *t1 = "stat/";
+    create_dirs( t1 );
+    create_file( t1, "content.txt", "0123456789");
+
+    const QString dir = QStringLiteral("%1/stat").arg(CSYNC_TEST_DIR);
+    const QFileInfo expected(dir + QStringLiteral("/content.txt"));
+
+    csync_vio_handle_t *dh = csync_vio_local_opendir(dir);
+    assert_non_null(dh);
+
+    int seen = 0;
+    while (auto dirent = csync_vio_local_readdir(dh, nullptr)) {
+        assert_string_equal(dirent->path.constData(), "content.txt");
+        assert_int_equal(dirent->type, ItemTypeFile);
+        assert_int_equal(dirent->size, 10);
+        assert_int_equal(dirent->modtime, expected.lastModified().toSecsSinceEpoch());
+        assert_true(dirent->inode != 0);
+        ++seen;
+    }
+    assert_int_equal(seen, 1);
+
+    int rc = csync_vio_local_closedir(dh);
+    assert_int_equal(rc, 0);
+}
+
 int torture_run_tests(void)
 {
     const struct CMUnitTest tests[] = {
@@ -360,6 +391,7 @@ int torture_run_tests(void)
         cmocka_unit_test_setup_teardown(check_readdir_with_content, setup_testenv, teardown),
         cmocka_unit_test_setup_teardown(check_readdir_longtree, setup_testenv, teardown),
         cmocka_unit_test_setup_teardown(check_readdir_bigunicode, setup_testenv, teardown),
+        cmocka_unit_test_setup_teardown(check_readdir_stat, setup_testenv, teardown),
     };
 
     return cmocka_run_group_tests(tests, NULL, NULL);
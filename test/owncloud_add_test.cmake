@@ -32,5 +32,5 @@ macro(owncloud_add_benchmark test_class)
         syncenginetestutils
         Qt5::Core Qt5::Test Qt5::Xml Qt5::Network
     )
-    target_compile_definitions(${OWNCLOUD_TEST_CLASS}Bench PRIVATE OWNCLOUD_BIN_PATH="${CMAKE_BINARY_DIR}/bin")
+    target_compile_definitions(${OWNCLOUD_TEST_CLASS}Bench PRIVATE OWNCLOUD_BIN_PATH="${CMAKE_BINARY_DIR}/bin" SOURCEDIR="${PROJECT_SOURCE_DIR}")
 endmacro()
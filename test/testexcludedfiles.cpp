@@ -125,10 +125,13 @@ private slots:
 
         QVERIFY(excludedFiles->_fullRegexFile.pattern().contains("csync1"));
         QVERIFY(excludedFiles->_fullTraversalRegexFile.pattern().contains("csync1"));
-        QVERIFY(!excludedFiles->_bnameTraversalRegexFile.pattern().contains("csync1"));
+        // Only the "*" bname trigger of the pattern is in the bname matcher
+        const QString csync1 = QStringLiteral("check_csync1");
+        QCOMPARE(excludedFiles->_bnameMatcher.match(csync1, ItemTypeFile), ExcludedFiles::BnameMatcher::Trigger);
 
         excludedFiles->addManualExclude("foo");
-        QVERIFY(excludedFiles->_bnameTraversalRegexFile.pattern().contains("foo"));
+        const QString foo = QStringLiteral("foo");
+        QCOMPARE(excludedFiles->_bnameMatcher.match(foo, ItemTypeFile), ExcludedFiles::BnameMatcher::Exclude);
         QVERIFY(excludedFiles->_fullRegexFile.pattern().contains("foo"));
         QVERIFY(!excludedFiles->_fullTraversalRegexFile.pattern().contains("foo"));
     }
@@ -414,6 +417,125 @@ private slots:
         QCOMPARE(check_file_full("dir/foo"), CSYNC_FILE_EXCLUDE_LIST);
     }
 
+    void check_csync_bname_matcher()
+    {
+        setup();
+        excludedFiles->addManualExclude("literal");
+        excludedFiles->addManualExclude("*.ext");
+        excludedFiles->addManualExclude("prefix*");
+        excludedFiles->addManualExclude("]*.remove");
+        excludedFiles->addManualExclude("]both*");
+        excludedFiles->addManualExclude("both*");
+        excludedFiles->addManualExclude("*.dironly/");
+        excludedFiles->addManualExclude("co?plex");
+
+        QCOMPARE(check_file_traversal("s/literal"), CSYNC_FILE_EXCLUDE_LIST);
+        QCOMPARE(check_file_traversal("s/literal2"), CSYNC_NOT_EXCLUDED);
+        QCOMPARE(check_file_traversal("s/file.ext"), CSYNC_FILE_EXCLUDE_LIST);
+        QCOMPARE(check_file_traversal("s/.ext"), CSYNC_FILE_EXCLUDE_LIST);
+        QCOMPARE(check_file_traversal("s/file.ext2"), CSYNC_NOT_EXCLUDED);
+        QCOMPARE(check_file_traversal("s/prefix"), CSYNC_FILE_EXCLUDE_LIST);
+        QCOMPARE(check_file_traversal("s/prefixfoo"), CSYNC_FILE_EXCLUDE_LIST);
+        QCOMPARE(check_file_traversal("s/prefi"), CSYNC_NOT_EXCLUDED);
+        QCOMPARE(check_file_traversal("s/file.remove"), CSYNC_FILE_EXCLUDE_AND_REMOVE);
+        // A plain exclude wins over an exclude-and-remove
+        QCOMPARE(check_file_traversal("s/bothfoo"), CSYNC_FILE_EXCLUDE_LIST);
+        QCOMPARE(check_file_traversal("s/file.dironly"), CSYNC_NOT_EXCLUDED);
+        QCOMPARE(check_dir_traversal("s/file.dironly"), CSYNC_FILE_EXCLUDE_LIST);
+        QCOMPARE(check_file_traversal("s/complex"), CSYNC_FILE_EXCLUDE_LIST);
+        QCOMPARE(check_file_traversal("s/compex"), CSYNC_NOT_EXCLUDED);
+    }
+
+    void check_csync_bname_cache()
+    {
+        setup();
+        excludedFiles->addManualExclude("*.tmp");
+
+        QCOMPARE(check_file_traversal("a/foo"), CSYNC_NOT_EXCLUDED);
+        QCOMPARE(check_file_traversal("a/x.tmp"), CSYNC_FILE_EXCLUDE_LIST);
+        // Cached, for files and directories separately
+        QCOMPARE(check_file_traversal("b/foo"), CSYNC_NOT_EXCLUDED);
+        QCOMPARE(check_file_traversal("b/x.tmp"), CSYNC_FILE_EXCLUDE_LIST);
+        QCOMPARE(check_dir_traversal("b/x.tmp"), CSYNC_FILE_EXCLUDE_LIST);
+
+        // New patterns invalidate the cache
+        excludedFiles->addManualExclude("foo/");
+        QCOMPARE(check_file_traversal("a/foo"), CSYNC_NOT_EXCLUDED);
+        QCOMPARE(check_dir_traversal("a/foo"), CSYNC_FILE_EXCLUDE_LIST);
+        excludedFiles->clearManualExcludes();
+        QCOMPARE(check_file_traversal("a/x.tmp"), CSYNC_NOT_EXCLUDED);
+        QCOMPARE(check_dir_traversal("a/foo"), CSYNC_NOT_EXCLUDED);
+    }
+
+    void check_csync_directory_excludes()
+    {
+        setup();
+        excludedFiles->addManualExclude("*.tmp");
+
+        QTemporaryDir tmp;
+        QVERIFY(tmp.isValid());
+        const auto writeExcludeFile = [&](const QString &name, const QByteArray &contents) {
+            QFile f(tmp.path() + QLatin1Char('/') + name);
+            QVERIFY(f.open(QFile::WriteOnly | QFile::Truncate));
+            f.write(contents);
+        };
+        writeExcludeFile("a.lst", "*.log\nbuild/\nsub/file\n");
+        writeExcludeFile("root.lst", "*.bak\n");
+
+        excludedFiles->updateDirectoryExcludeFile("a", tmp.path() + "/a.lst", 1, 10);
+        // The global patterns still apply
+        QCOMPARE(check_file_traversal("a/x.tmp"), CSYNC_FILE_EXCLUDE_LIST);
+        // Only below the directory, relative to it
+        QCOMPARE(check_file_traversal("a/x.log"), CSYNC_FILE_EXCLUDE_LIST);
+        QCOMPARE(check_file_traversal("a/b/x.log"), CSYNC_FILE_EXCLUDE_LIST);
+        QCOMPARE(check_file_traversal("x.log"), CSYNC_NOT_EXCLUDED);
+        QCOMPARE(check_file_traversal("b/x.log"), CSYNC_NOT_EXCLUDED);
+        QCOMPARE(check_file_traversal("ab/x.log"), CSYNC_NOT_EXCLUDED);
+        QCOMPARE(check_dir_traversal("a/build"), CSYNC_FILE_EXCLUDE_LIST);
+        QCOMPARE(check_file_traversal("a/build"), CSYNC_NOT_EXCLUDED);
+        QCOMPARE(check_file_traversal("a/sub/file"), CSYNC_FILE_EXCLUDE_LIST);
+        QCOMPARE(check_file_traversal("a/b/sub/file"), CSYNC_NOT_EXCLUDED);
+        QCOMPARE(check_file_full("a/b/c/x.log"), CSYNC_FILE_EXCLUDE_LIST);
+        QCOMPARE(check_file_full("a/build/x"), CSYNC_FILE_EXCLUDE_LIST);
+        QCOMPARE(check_file_full("b/build/x"), CSYNC_NOT_EXCLUDED);
+
+        // The exclude files themselves are never synced
+        QCOMPARE(check_file_full(".sync-exclude.lst"), CSYNC_FILE_SILENTLY_EXCLUDED);
+        QCOMPARE(check_file_full("a/b/.sync-exclude.lst"), CSYNC_FILE_SILENTLY_EXCLUDED);
+
+        // The root's file applies everywhere
+        excludedFiles->updateDirectoryExcludeFile("", tmp.path() + "/root.lst", 1, 6);
+        QCOMPARE(check_file_traversal("x.bak"), CSYNC_FILE_EXCLUDE_LIST);
+        QCOMPARE(check_file_traversal("a/b/x.bak"), CSYNC_FILE_EXCLUDE_LIST);
+        QCOMPARE(check_file_traversal("a/x.log"), CSYNC_FILE_EXCLUDE_LIST);
+
+        // An unchanged file isn't read again
+        writeExcludeFile("a.lst", "*.txt\n");
+        excludedFiles->updateDirectoryExcludeFile("a", tmp.path() + "/a.lst", 1, 10);
+        QCOMPARE(check_file_traversal("a/x.log"), CSYNC_FILE_EXCLUDE_LIST);
+        QCOMPARE(check_file_traversal("a/x.txt"), CSYNC_NOT_EXCLUDED);
+        excludedFiles->updateDirectoryExcludeFile("a", tmp.path() + "/a.lst", 2, 6);
+        QCOMPARE(check_file_traversal("a/x.log"), CSYNC_NOT_EXCLUDED);
+        QCOMPARE(check_file_traversal("a/x.txt"), CSYNC_FILE_EXCLUDE_LIST);
+        QCOMPARE(check_file_traversal("x.bak"), CSYNC_FILE_EXCLUDE_LIST);
+
+        excludedFiles->removeDirectoryExcludeFile("a");
+        QCOMPARE(check_file_traversal("a/x.txt"), CSYNC_NOT_EXCLUDED);
+        QCOMPARE(check_file_traversal("a/x.bak"), CSYNC_FILE_EXCLUDE_LIST);
+        excludedFiles->removeDirectoryExcludeFile("");
+        QCOMPARE(check_file_traversal("a/x.bak"), CSYNC_NOT_EXCLUDED);
+
+        // A directory that isn't visited anymore takes the ones below it along
+        excludedFiles->updateDirectoryExcludeFile("a", tmp.path() + "/a.lst", 2, 6);
+        excludedFiles->updateDirectoryExcludeFile("a/b", tmp.path() + "/root.lst", 1, 6);
+        excludedFiles->updateDirectoryExcludeFile("ab", tmp.path() + "/root.lst", 1, 6);
+        excludedFiles->removeDirectoryExcludeFiles("a");
+        QCOMPARE(check_file_traversal("a/x.txt"), CSYNC_NOT_EXCLUDED);
+        QCOMPARE(check_file_traversal("a/b/x.bak"), CSYNC_NOT_EXCLUDED);
+        QCOMPARE(check_file_traversal("ab/x.bak"), CSYNC_FILE_EXCLUDE_LIST);
+        QCOMPARE(excludedFiles->_directoryExcludes.size(), 1);
+    }
+
     void check_csync_pathes()
     {
         setup_init();
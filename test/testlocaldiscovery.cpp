@@ -9,6 +9,7 @@
 #include "testutils/syncenginetestutils.h"
 #include <syncengine.h>
 #include <localdiscoverytracker.h>
+#include "filesystem.h"
 
 using namespace OCC;
 
@@ -184,6 +185,51 @@ private slots:
         QCOMPARE(fakeFolder.currentRemoteState(), expectedState);
     }
 
+    // Unchanged directories are read from the db unless a path below them was touched
+    void testUnchangedDirectoriesFromDatabase()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+
+        // Directories modified within the last second are always listed
+        const auto oldTime = QDateTime::currentDateTimeUtc().addDays(-1).toSecsSinceEpoch();
+        auto makeOld = [&](const QString &dir) {
+            QVERIFY(FileSystem::setModTime(fakeFolder.localPath() + dir, oldTime));
+        };
+        // The database doesn't know about ignored files, their directory is always listed
+        fakeFolder.syncEngine().excludedFiles().addManualExclude("*.ignored");
+        fakeFolder.localModifier().insert("S/s3.ignored");
+        for (const auto &dir : { "", "A", "B", "C", "S" })
+            makeOld(dir);
+
+        QVERIFY(fakeFolder.syncOnce());
+        QVERIFY(fakeFolder.syncJournal().localDirectoryState("A")._valid);
+        QVERIFY(!fakeFolder.syncJournal().localDirectoryState("S")._valid);
+
+        // Modifying a file doesn't change its directory
+        fakeFolder.localModifier().appendByte("A/a1");
+        makeOld("A");
+        fakeFolder.localModifier().insert("B/b3");
+
+        fakeFolder.syncEngine().setLocalDiscoveryOptions(LocalDiscoveryStyle::UnchangedDirectoriesFromDatabase);
+        QVERIFY(fakeFolder.syncOnce());
+        QVERIFY(fakeFolder.currentRemoteState().find("B/b3"));
+        QVERIFY(fakeFolder.currentLocalState() != fakeFolder.currentRemoteState());
+
+        // Once the watcher reports it, the change is seen
+        fakeFolder.syncEngine().setLocalDiscoveryOptions(LocalDiscoveryStyle::UnchangedDirectoriesFromDatabase, { "A/a1" });
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+
+        // Removed and renamed directories forget their state
+        QVERIFY(fakeFolder.syncJournal().localDirectoryState("B")._valid);
+        QVERIFY(fakeFolder.syncJournal().localDirectoryState("C")._valid);
+        fakeFolder.localModifier().remove("B");
+        fakeFolder.localModifier().rename("C", "C2");
+        QVERIFY(fakeFolder.syncOnce());
+        QVERIFY(!fakeFolder.syncJournal().localDirectoryState("B")._valid);
+        QVERIFY(!fakeFolder.syncJournal().localDirectoryState("C")._valid);
+    }
+
     // Tests the behavior of invalid filename detection
     void testServerBlacklist()
     {
@@ -126,6 +126,37 @@ private slots:
         }
     }
 
+    void testProfiler()
+    {
+        SqlProfiler::setEnabled(true);
+        SqlProfiler::reset();
+
+        const QByteArray sql = "SELECT id FROM addresses ORDER BY id";
+        SqlQuery q(_db);
+        q.prepare(sql);
+        for (int i = 0; i < 2; ++i) {
+            QVERIFY(q.exec());
+            while (q.next().hasData) {
+            }
+        }
+        // An execution also ends with the reset of the query
+        QVERIFY(q.exec());
+        QVERIFY(q.next().hasData);
+        q.reset_and_clear_bindings();
+
+        const auto stats = SqlProfiler::statistics().value(sql);
+        QCOMPARE(stats.prepares, qint64(1));
+        QCOMPARE(stats.calls, qint64(3));
+        QCOMPARE(stats.rows, qint64(3 + 3 + 1));
+        QVERIFY(stats.maxNsecs <= stats.totalNsecs);
+
+        SqlProfiler::setEnabled(false);
+        QVERIFY(q.exec());
+        QVERIFY(q.next().hasData);
+        q.reset_and_clear_bindings();
+        QCOMPARE(SqlProfiler::statistics().value(sql).calls, qint64(3));
+    }
+
     void testDestructor()
     {
         // This test make sure that the destructor of SqlQuery works even if the SqlDatabase
@@ -170,6 +170,157 @@ private slots:
         QVERIFY(completeSpy.findItem("nofileid")->_errorString.contains("file id"));
         QVERIFY(completeSpy.findItem("nopermissions/A")->_errorString.contains("permissions"));
     }
+
+    void testSyncCollection()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        fakeFolder.setServerSyncCollectionSupport(true);
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+
+        QStringList propfinds;
+        int reports = 0;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation, const QNetworkRequest &req, QIODevice *) -> QNetworkReply * {
+            const auto verb = req.attribute(QNetworkRequest::CustomVerbAttribute).toByteArray();
+            if (verb == "PROPFIND")
+                propfinds.append(getFilePathFromUrl(req.url()));
+            else if (verb == "REPORT")
+                ++reports;
+            return nullptr;
+        });
+
+        fakeFolder.remoteModifier().appendByte("A/a1");
+        fakeFolder.remoteModifier().insert("B/b3");
+        fakeFolder.remoteModifier().remove("C/c1");
+        fakeFolder.remoteModifier().rename("S/s1", "S/s3");
+        fakeFolder.remoteModifier().mkdir("A/sub");
+        fakeFolder.remoteModifier().insert("A/sub/new");
+        fakeFolder.localModifier().appendByte("B/b2");
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(reports, 1);
+        // The root is always listed, and the new directory isn't in the database
+        QCOMPARE(propfinds, QStringList({ QString(), QStringLiteral("A/sub") }));
+
+        // The upload of the previous sync is among the changes
+        propfinds.clear();
+        reports = 0;
+        fakeFolder.remoteModifier().remove("A/sub/new");
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(reports, 1);
+        QCOMPARE(propfinds, QStringList({ QString() }));
+    }
+
+    void testSyncCollectionFallback()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        fakeFolder.setServerSyncCollectionSupport(true);
+        QVERIFY(fakeFolder.syncOnce());
+
+        // Like a token that the server does not know anymore
+        QStringList propfinds;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &req, QIODevice *) -> QNetworkReply * {
+            const auto verb = req.attribute(QNetworkRequest::CustomVerbAttribute).toByteArray();
+            if (verb == "PROPFIND")
+                propfinds.append(getFilePathFromUrl(req.url()));
+            else if (verb == "REPORT")
+                return new FakeErrorReply(op, req, this, 403);
+            return nullptr;
+        });
+
+        fakeFolder.remoteModifier().insert("A/a3");
+        fakeFolder.remoteModifier().remove("B/b1");
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QVERIFY(propfinds.contains(QStringLiteral("A")));
+        QVERIFY(propfinds.contains(QStringLiteral("B")));
+    }
+
+    // Listings of a sync that failed during the discovery are reused
+    void testResumedDiscovery()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        fakeFolder.remoteModifier().insert("A/a3");
+        fakeFolder.remoteModifier().insert("C/c3");
+
+        QStringList propfinds;
+        bool failC = true;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &req, QIODevice *) -> QNetworkReply * {
+            if (req.attribute(QNetworkRequest::CustomVerbAttribute) == "PROPFIND") {
+                const auto path = getFilePathFromUrl(req.url());
+                propfinds.append(path);
+                if (failC && path == QLatin1String("C"))
+                    return new FakeErrorReply(op, req, this, 400);
+            }
+            return nullptr;
+        });
+        QVERIFY(!fakeFolder.syncOnce());
+        QVERIFY(propfinds.contains(QStringLiteral("A")));
+
+        const auto etagA = fakeFolder.currentRemoteState().find("A")->etag;
+        QVERIFY(!fakeFolder.syncJournal().discoveryListing("A", etagA).isEmpty());
+
+        propfinds.clear();
+        failC = false;
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QVERIFY(!propfinds.contains(QStringLiteral("A")));
+        QVERIFY(propfinds.contains(QStringLiteral("C")));
+
+        // Not needed anymore once a sync succeeded, and a successful sync doesn't keep any
+        QVERIFY(fakeFolder.syncJournal().discoveryListing("A", etagA).isEmpty());
+        fakeFolder.remoteModifier().insert("B/b3");
+        QVERIFY(fakeFolder.syncOnce());
+        QVERIFY(!fakeFolder.syncJournal().hasDiscoveryListings());
+    }
+
+    void testDepthInfinity_data()
+    {
+        QTest::addColumn<bool>("refused");
+        QTest::newRow("supported") << false;
+        QTest::newRow("refused") << true;
+    }
+
+    void testDepthInfinity()
+    {
+        QFETCH(bool, refused);
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        fakeFolder.syncEngine().account()->setCapabilities({ { "dav", QVariantMap{ { "propfind", QVariantMap{ { "depth_infinity", true } } } } } });
+        QVERIFY(fakeFolder.syncOnce());
+
+        QStringList propfinds;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &req, QIODevice *) -> QNetworkReply * {
+            if (req.attribute(QNetworkRequest::CustomVerbAttribute) == "PROPFIND") {
+                const auto depth = req.rawHeader("Depth");
+                propfinds.append(getFilePathFromUrl(req.url()) + QLatin1Char(':') + QString::fromUtf8(depth));
+                if (refused && depth == "infinity")
+                    return new FakeErrorReply(op, req, this, 403);
+            }
+            return nullptr;
+        });
+
+        fakeFolder.remoteModifier().mkdir("N");
+        fakeFolder.remoteModifier().insert("N/n1");
+        fakeFolder.remoteModifier().mkdir("N/x");
+        fakeFolder.remoteModifier().insert("N/x/x1");
+        fakeFolder.remoteModifier().mkdir("N/x/y");
+        fakeFolder.remoteModifier().insert("N/x/y/y1");
+        fakeFolder.remoteModifier().mkdir("N/empty");
+        fakeFolder.remoteModifier().appendByte("A/a1");
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+
+        if (!refused) {
+            // The sub directories of the new directory came with its listing
+            QCOMPARE(propfinds, QStringList({ QStringLiteral(":1"), QStringLiteral("A:1"), QStringLiteral("N:infinity") }));
+        } else {
+            QVERIFY(propfinds.contains(QStringLiteral("N:1")));
+            QVERIFY(propfinds.contains(QStringLiteral("N/x/y:1")));
+            // The new sub directories don't ask again
+            QCOMPARE(propfinds.filter(QStringLiteral(":infinity")), QStringList(QStringLiteral("N:infinity")));
+        }
+    }
 };
 
 QTEST_GUILESS_MAIN(TestRemoteDiscovery)
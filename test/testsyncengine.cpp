@@ -279,6 +279,59 @@ private slots:
         }
     }
 
+    /**
+     * New remote subtrees are propagated while the discovery continues
+     */
+    void testPipelinedPropagation()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        SyncOptions options;
+        options._pipelinedPropagation = true;
+        fakeFolder.syncEngine().setSyncOptions(options);
+        ItemCompletedSpy completeSpy(fakeFolder);
+
+        // Keep the discovery busy with S, Y/Z/d0 must be downloaded before it finished
+        bool aboutToPropagate = false;
+        bool downloadedDuringDiscovery = false;
+        connect(&fakeFolder.syncEngine(), &SyncEngine::aboutToPropagate, this, [&] { aboutToPropagate = true; });
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &req, QIODevice *) -> QNetworkReply * {
+            const auto path = getFilePathFromUrl(req.url());
+            if (op == QNetworkAccessManager::GetOperation && path == QLatin1String("Y/Z/d0"))
+                downloadedDuringDiscovery = !aboutToPropagate;
+            if (req.attribute(QNetworkRequest::CustomVerbAttribute) == "PROPFIND" && path == QLatin1String("S"))
+                return new DelayedReply<FakePropfindReply>(500, fakeFolder.remoteModifier(), op, req, this);
+            return nullptr;
+        });
+
+        fakeFolder.remoteModifier().mkdir("Y");
+        fakeFolder.remoteModifier().mkdir("Y/Z");
+        fakeFolder.remoteModifier().insert("Y/Z/d0");
+        fakeFolder.remoteModifier().mkdir("A/new");
+        fakeFolder.remoteModifier().insert("A/new/a0");
+        fakeFolder.remoteModifier().appendByte("B/b1");
+        fakeFolder.remoteModifier().appendByte("S/s1");
+        fakeFolder.localModifier().insert("C/c3");
+        QVERIFY(fakeFolder.syncOnce());
+        QVERIFY(downloadedDuringDiscovery);
+
+        QSet<QString> seen;
+        for (const QList<QVariant> &args : completeSpy) {
+            auto item = args[0].value<SyncFileItemPtr>();
+            QVERIFY(!seen.contains(item->_file)); // signal only sent once per item
+            seen.insert(item->_file);
+        }
+        for (const auto &path : { "Y", "Y/Z", "Y/Z/d0", "A/new", "A/new/a0", "B/b1", "S/s1", "C/c3" })
+            QVERIFY(itemDidCompleteSuccessfully(completeSpy, path));
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+
+        // The etag of A is only updated in the next sync
+        QVERIFY(fakeFolder.syncOnce());
+        SyncJournalFileRecord rec;
+        QVERIFY(fakeFolder.syncJournal().getFileRecord(QByteArrayLiteral("A"), &rec));
+        QCOMPARE(rec._etag, fakeFolder.currentRemoteState().find("A")->etag);
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+    }
+
     void testFakeConflict_data()
     {
         QTest::addColumn<bool>("sameMtime");
@@ -10,6 +10,7 @@
 
 #include "common/syncjournaldb.h"
 #include "common/syncjournalfilerecord.h"
+#include "common/syncjournalsnapshot.h"
 
 using namespace OCC;
 
@@ -24,6 +25,8 @@ public:
         : _db((_tempDir.path() + "/sync.db"))
     {
         QVERIFY(_tempDir.isValid());
+        // Some tests look at the journal through a second connection
+        qputenv("OWNCLOUD_SQLITE_LOCKING_MODE", "NORMAL");
     }
 
     qint64 dropMsecs(QDateTime time)
@@ -312,6 +315,252 @@ private slots:
         QVERIFY(checkElements());
     }
 
+    void testGroupCommit()
+    {
+        SyncJournalDb db(_tempDir.path() + "/groupcommit.db");
+        QVERIFY(db.open());
+        db.setGroupCommitPolicy(3, std::chrono::hours(1));
+        db.commitIfNeededAndStartNewTransaction(QStringLiteral("test"));
+        db.takeWriteStatistics();
+
+        auto makeRecord = [](const QByteArray &path) {
+            SyncJournalFileRecord record;
+            record._path = path;
+            record._remotePerm = RemotePermissions::fromDbValue("RW");
+            return record;
+        };
+
+        // The records are written right away, only the commit waits
+        QVERIFY(db.setFileRecord(makeRecord("a")));
+        QVERIFY(db.setFileRecord(makeRecord("b")));
+        auto statistics = db.takeWriteStatistics();
+        QCOMPARE(statistics.records, qint64(2));
+        QCOMPARE(statistics.commits, qint64(0));
+        SyncJournalFileRecord record;
+        QVERIFY(db.getFileRecord(QByteArrayLiteral("b"), &record));
+        QVERIFY(record.isValid());
+
+        // The third record completes the group
+        QVERIFY(db.setFileRecord(makeRecord("c")));
+        statistics = db.takeWriteStatistics();
+        QCOMPARE(statistics.records, qint64(1));
+        QCOMPARE(statistics.commits, qint64(1));
+
+        // commit() commits the rest
+        QVERIFY(db.setFileRecord(makeRecord("d")));
+        QCOMPARE(db.takeWriteStatistics().commits, qint64(0));
+        db.commit(QStringLiteral("test"));
+        QCOMPARE(db.takeWriteStatistics().commits, qint64(1));
+
+        // Without a transaction SQLite commits every record on its own
+        db.commit(QStringLiteral("test"), false);
+        db.takeWriteStatistics();
+        QVERIFY(db.setFileRecord(makeRecord("e")));
+        statistics = db.takeWriteStatistics();
+        QCOMPARE(statistics.records, qint64(1));
+        QCOMPARE(statistics.commits, qint64(0));
+        db.close();
+        QVERIFY(db.getFileRecord(QByteArrayLiteral("e"), &record));
+        QVERIFY(record.isValid());
+
+        // An incomplete group is committed once its delay expired
+        db.setGroupCommitPolicy(3, std::chrono::milliseconds(10));
+        db.commitIfNeededAndStartNewTransaction(QStringLiteral("test"));
+        db.takeWriteStatistics();
+        QVERIFY(db.setFileRecord(makeRecord("f")));
+        qint64 commits = 0;
+        QTRY_VERIFY((commits += db.takeWriteStatistics().commits) == 1);
+    }
+
+    void testCommittedFileRecord()
+    {
+        SyncJournalDb db(_tempDir.path() + "/committed.db");
+        QVERIFY(db.open());
+        db.commitIfNeededAndStartNewTransaction(QStringLiteral("test"));
+
+        SyncJournalFileRecord record;
+        record._path = "foo";
+        record._remotePerm = RemotePermissions::fromDbValue("RW");
+        QVERIFY(db.setFileRecord(record));
+
+        // The read-only connection only sees what was committed
+        SyncJournalFileRecord stored;
+        QVERIFY(db.getFileRecord(QByteArrayLiteral("foo"), &stored));
+        QVERIFY(stored.isValid());
+        QVERIFY(db.getCommittedFileRecord(QByteArrayLiteral("foo"), &stored));
+        QVERIFY(!stored.isValid());
+
+        db.commit(QStringLiteral("test"));
+        QVERIFY(db.getCommittedFileRecord(QByteArrayLiteral("foo"), &stored));
+        QCOMPARE(stored._path, record._path);
+        QVERIFY(db.getCommittedFileRecord(QByteArrayLiteral("bar"), &stored));
+        QVERIFY(!stored.isValid());
+    }
+
+    void testFilesBelowPathOrder()
+    {
+        SyncJournalDb db(_tempDir.path() + "/below.db");
+        for (const QByteArray path : { "foo-2/file", "foo/sub/deep", "foo", "foo/file", "foo bla/file", "foo/sub", "foo0", "foo/sub-2" }) {
+            SyncJournalFileRecord record;
+            record._path = path;
+            record._remotePerm = RemotePermissions::fromDbValue("RW");
+            QVERIFY(db.setFileRecord(record));
+        }
+        auto below = [&](const QByteArray &path) {
+            QByteArrayList result;
+            db.getFilesBelowPath(path, [&](const SyncJournalFileRecord &rec) { result.append(rec._path); });
+            return result;
+        };
+        // The contents of a directory directly follow it
+        QCOMPARE(below(""), QByteArrayList({ "foo bla/file", "foo-2/file", "foo", "foo/file", "foo/sub-2", "foo/sub", "foo/sub/deep", "foo0" }));
+        QCOMPARE(below("foo"), QByteArrayList({ "foo/file", "foo/sub-2", "foo/sub", "foo/sub/deep" }));
+        QCOMPARE(below("foo/sub"), QByteArrayList({ "foo/sub/deep" }));
+    }
+
+    void testParentIdMigration()
+    {
+        const QString dbPath = _tempDir.path() + "/parentid.db";
+        {
+            SyncJournalDb db(dbPath);
+            for (const QByteArray path : { "dir", "dir/file", "dir/sub", "dir/sub/deep", "top" }) {
+                SyncJournalFileRecord record;
+                record._path = path;
+                record._remotePerm = RemotePermissions::fromDbValue("RW");
+                QVERIFY(db.setFileRecord(record));
+            }
+        }
+        {
+            // Rows written by older clients don't have the column set,
+            // the client stores its version when it opens the journal
+            SqlDatabase raw;
+            QVERIFY(raw.openOrCreateReadWrite(dbPath));
+            SqlQuery query("UPDATE metadata SET parent_id = NULL", raw);
+            QVERIFY(query.exec());
+            query.prepare("UPDATE version SET major = 2, minor = 7, patch = 0");
+            QVERIFY(query.exec());
+        }
+
+        SyncJournalDb db(dbPath);
+        auto children = [&](const QByteArray &path) {
+            QByteArrayList result;
+            db.listFilesInPath(path, [&](const SyncJournalFileRecord &rec) { result.append(rec._path); });
+            return result;
+        };
+        QCOMPARE(children(""), QByteArrayList({ "dir", "top" }));
+        QCOMPARE(children("dir"), QByteArrayList({ "dir/file", "dir/sub" }));
+        QCOMPARE(children("dir/sub"), QByteArrayList({ "dir/sub/deep" }));
+    }
+
+    void testMaintenance()
+    {
+        const QString dbPath = _tempDir.path() + "/maintenance.db";
+        {
+            SyncJournalDb db(dbPath);
+            for (int i = 0; i < 10000; ++i) {
+                SyncJournalFileRecord record;
+                record._path = "dir/file" + QByteArray::number(i);
+                record._remotePerm = RemotePermissions::fromDbValue("RW");
+                record._checksumHeader = QByteArray(1024, 'x');
+                QVERIFY(db.setFileRecord(record));
+            }
+            QVERIFY(db.deleteFileRecord("dir", true));
+            db.performMaintenance();
+        }
+
+        SqlDatabase raw;
+        QVERIFY(raw.openOrCreateReadWrite(dbPath));
+        SqlQuery query("PRAGMA auto_vacuum;", raw);
+        QVERIFY(query.exec() && query.next().hasData);
+        QCOMPARE(query.intValue(0), 2);
+        query.prepare("PRAGMA freelist_count;");
+        QVERIFY(query.exec() && query.next().hasData);
+        QVERIFY(query.intValue(0) < 100);
+    }
+
+    void testErrorBlacklistIndex()
+    {
+        SyncJournalDb db(_tempDir.path() + "/blacklist.db");
+        auto makeEntry = [](const QString &file) {
+            SyncJournalErrorBlacklistRecord entry;
+            entry._file = file;
+            entry._lastTryEtag = "etag";
+            entry._lastTryTime = 1;
+            return entry;
+        };
+
+        db.setErrorBlacklistEntry(makeEntry(QStringLiteral("a/file")));
+        QVERIFY(db.errorBlacklistEntry(QStringLiteral("a/file")).isValid());
+        QVERIFY(!db.errorBlacklistEntry(QStringLiteral("a/other")).isValid());
+
+        // Entries are loaded again after reopening
+        db.close();
+        QVERIFY(db.errorBlacklistEntry(QStringLiteral("a/file")).isValid());
+
+        db.wipeErrorBlacklistEntry(QStringLiteral("a/file"));
+        QVERIFY(!db.errorBlacklistEntry(QStringLiteral("a/file")).isValid());
+
+        db.setErrorBlacklistEntry(makeEntry(QStringLiteral("b")));
+        db.setErrorBlacklistEntry(makeEntry(QStringLiteral("c")));
+        QVERIFY(db.deleteStaleErrorBlacklistEntries({ QStringLiteral("c") }));
+        QVERIFY(!db.errorBlacklistEntry(QStringLiteral("b")).isValid());
+        QVERIFY(db.errorBlacklistEntry(QStringLiteral("c")).isValid());
+
+        QCOMPARE(db.wipeErrorBlacklist(), 1);
+        QVERIFY(!db.errorBlacklistEntry(QStringLiteral("c")).isValid());
+    }
+
+    void testSnapshot()
+    {
+        SyncJournalDb db(_tempDir.path() + "/snapshot.db");
+        const QByteArrayList paths = { "foo", "foo/file", "foo/sub", "foo/sub/deep", "foo-2", "foo-2/file",
+            "foo bla bar/file", "bar", "a/b/c/orphan", "zzz" };
+        for (const auto &path : paths) {
+            SyncJournalFileRecord record;
+            record._path = path;
+            record._inode = qHash(path);
+            record._modtime = 1000 + path.size();
+            record._type = path.contains("file") ? ItemTypeFile : ItemTypeDirectory;
+            record._etag = "etag-" + path;
+            record._fileId = "id-" + path;
+            record._fileSize = path.size();
+            record._remotePerm = RemotePermissions::fromDbValue("RW");
+            record._checksumHeader = "SHA1:" + path;
+            QVERIFY(db.setFileRecord(record));
+        }
+
+        SyncJournalSnapshot snapshot;
+        QVERIFY(snapshot.load(&db));
+        QCOMPARE(snapshot.size(), paths.size());
+
+        auto listing = [](const std::function<void(const std::function<void(const SyncJournalFileRecord &)> &)> &list) {
+            QVector<SyncJournalFileRecord> records;
+            list([&](const SyncJournalFileRecord &rec) { records.append(rec); });
+            return records;
+        };
+        // Directories without a record of their own are listed as well
+        for (const QByteArray dir : { "", "foo", "foo/sub", "foo-2", "foo bla bar", "a", "a/b", "a/b/c", "bar", "missing", "foo/missing" }) {
+            const auto fromDb = listing([&](const auto &cb) { QVERIFY(db.listFilesInPath(dir, cb)); });
+            const auto fromSnapshot = listing([&](const auto &cb) { snapshot.listFilesInPath(dir, cb); });
+            QVERIFY(fromSnapshot == fromDb);
+        }
+        for (const QByteArray path : paths + QByteArrayList { "a", "a/b", "foo/missing", "missing", "" }) {
+            SyncJournalFileRecord fromDb, fromSnapshot;
+            QVERIFY(db.getFileRecord(path, &fromDb));
+            snapshot.getFileRecord(path, &fromSnapshot);
+            QCOMPARE(fromSnapshot.isValid(), fromDb.isValid());
+            QVERIFY(fromSnapshot == fromDb);
+        }
+
+        // Removing a record removes the ones below it
+        snapshot.removeFileRecord("foo");
+        SyncJournalFileRecord record;
+        snapshot.getFileRecord("foo/sub/deep", &record);
+        QVERIFY(!record.isValid());
+        QVERIFY(listing([&](const auto &cb) { snapshot.listFilesInPath("foo", cb); }).isEmpty());
+        snapshot.getFileRecord("foo-2/file", &record);
+        QVERIFY(record.isValid());
+    }
+
     void testPinState()
     {
         auto make = [&](const QByteArray &path, PinState state) {
@@ -443,6 +692,12 @@ private slots:
         QCOMPARE(getRaw("online"), PinState::Inherited);
         list = _db.internalPinStates().rawList();
         QCOMPARE(list->size(), 0);
+
+        // The states are read from the database again after reopening
+        make("online", PinState::OnlineOnly);
+        _db.close();
+        QCOMPARE(get("online/nonexistant"), PinState::OnlineOnly);
+        QCOMPARE(get("other"), PinState::AlwaysLocal);
     }
 
 private:
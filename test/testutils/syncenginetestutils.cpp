@@ -288,14 +288,18 @@ FileInfo *FileInfo::findInvalidatingEtags(PathComponents pathComponents)
     return find(std::move(pathComponents), true);
 }
 
-FakePropfindReply::FakePropfindReply(FileInfo &remoteRootFileInfo, QNetworkAccessManager::Operation op, const QNetworkRequest &request, QObject *parent)
+FakePropfindReply::FakePropfindReply(QNetworkAccessManager::Operation op, const QNetworkRequest &request, QObject *parent)
     : FakeReply { parent }
 {
     setRequest(request);
     setUrl(request.url());
     setOperation(op);
     open(QIODevice::ReadOnly);
+}
 
+FakePropfindReply::FakePropfindReply(FileInfo &remoteRootFileInfo, QNetworkAccessManager::Operation op, const QNetworkRequest &request, QObject *parent, const QByteArray &syncToken)
+    : FakePropfindReply { op, request, parent }
+{
     QString fileName = getFilePathFromUrl(request.url());
     Q_ASSERT(!fileName.isNull()); // for root, it should be empty
     const FileInfo *fileInfo = remoteRootFileInfo.find(fileName);
@@ -306,51 +310,28 @@ FakePropfindReply::FakePropfindReply(FileInfo &remoteRootFileInfo, QNetworkAcces
     const QString prefix = request.url().path().left(request.url().path().size() - fileName.size());
 
     // Don't care about the request and just return a full propfind
-    const QString davUri { QStringLiteral("DAV:") };
-    const QString ocUri { QStringLiteral("http://owncloud.org/ns") };
     QBuffer buffer { &payload };
     buffer.open(QIODevice::WriteOnly);
     QXmlStreamWriter xml(&buffer);
-    xml.writeNamespace(davUri, QStringLiteral("d"));
-    xml.writeNamespace(ocUri, QStringLiteral("oc"));
+    xml.writeNamespace(QStringLiteral("DAV:"), QStringLiteral("d"));
+    xml.writeNamespace(QStringLiteral("http://owncloud.org/ns"), QStringLiteral("oc"));
     xml.writeStartDocument();
-    xml.writeStartElement(davUri, QStringLiteral("multistatus"));
-    auto writeFileResponse = [&](const FileInfo &fileInfo) {
-        xml.writeStartElement(davUri, QStringLiteral("response"));
-        const auto href = OCC::Utility::concatUrlPath(prefix, QString::fromUtf8(QUrl::toPercentEncoding(fileInfo.absolutePath(), "/"))).path();
-        xml.writeTextElement(davUri, QStringLiteral("href"), href);
-        xml.writeStartElement(davUri, QStringLiteral("propstat"));
-        xml.writeStartElement(davUri, QStringLiteral("prop"));
-
-        if (fileInfo.isDir) {
-            xml.writeStartElement(davUri, QStringLiteral("resourcetype"));
-            xml.writeEmptyElement(davUri, QStringLiteral("collection"));
-            xml.writeEndElement(); // resourcetype
-        } else
-            xml.writeEmptyElement(davUri, QStringLiteral("resourcetype"));
-
-        auto gmtDate = fileInfo.lastModified.toUTC();
-        auto stringDate = QLocale::c().toString(gmtDate, QStringLiteral("ddd, dd MMM yyyy HH:mm:ss 'GMT'"));
-        xml.writeTextElement(davUri, QStringLiteral("getlastmodified"), stringDate);
-        xml.writeTextElement(davUri, QStringLiteral("getcontentlength"), QString::number(fileInfo.size));
-        xml.writeTextElement(davUri, QStringLiteral("getetag"), QStringLiteral("\"%1\"").arg(QString::fromLatin1(fileInfo.etag)));
-        xml.writeTextElement(ocUri, QStringLiteral("permissions"), !fileInfo.permissions.isNull() ? QString(fileInfo.permissions.toString()) : fileInfo.isShared ? QStringLiteral("SRDNVCKW")
-                                                                                                                                                                 : QStringLiteral("RDNVCKW"));
-        xml.writeTextElement(ocUri, QStringLiteral("id"), QString::fromUtf8(fileInfo.fileId));
-        xml.writeTextElement(ocUri, QStringLiteral("checksums"), QString::fromUtf8(fileInfo.checksums));
-        buffer.write(fileInfo.extraDavProperties);
-        xml.writeEndElement(); // prop
-        xml.writeTextElement(davUri, QStringLiteral("status"), QStringLiteral("HTTP/1.1 200 OK"));
-        xml.writeEndElement(); // propstat
-        xml.writeEndElement(); // response
-    };
+    xml.writeStartElement(QStringLiteral("DAV:"), QStringLiteral("multistatus"));
 
-    writeFileResponse(*fileInfo);
+    writeFileResponse(xml, prefix, *fileInfo, fileName.isEmpty() ? syncToken : QByteArray());
 
-    const int depth = request.rawHeader(QByteArrayLiteral("Depth")).toInt();
-    if (depth > 0) {
+    const QByteArray depth = request.rawHeader(QByteArrayLiteral("Depth"));
+    if (depth == "infinity") {
+        std::function<void(const FileInfo &)> writeSubtree = [&](const FileInfo &dir) {
+            for (const FileInfo &childFileInfo : dir.children) {
+                writeFileResponse(xml, prefix, childFileInfo);
+                writeSubtree(childFileInfo);
+            }
+        };
+        writeSubtree(*fileInfo);
+    } else if (depth.toInt() > 0) {
         for (const FileInfo &childFileInfo : fileInfo->children) {
-            writeFileResponse(childFileInfo);
+            writeFileResponse(xml, prefix, childFileInfo);
         }
     }
     xml.writeEndElement(); // multistatus
@@ -359,6 +340,41 @@ FakePropfindReply::FakePropfindReply(FileInfo &remoteRootFileInfo, QNetworkAcces
     QMetaObject::invokeMethod(this, "respond", Qt::QueuedConnection);
 }
 
+void FakePropfindReply::writeFileResponse(QXmlStreamWriter &xml, const QString &prefix, const FileInfo &fileInfo, const QByteArray &syncToken)
+{
+    const QString davUri { QStringLiteral("DAV:") };
+    const QString ocUri { QStringLiteral("http://owncloud.org/ns") };
+    xml.writeStartElement(davUri, QStringLiteral("response"));
+    const auto href = OCC::Utility::concatUrlPath(prefix, QString::fromUtf8(QUrl::toPercentEncoding(fileInfo.absolutePath(), "/"))).path();
+    xml.writeTextElement(davUri, QStringLiteral("href"), href);
+    xml.writeStartElement(davUri, QStringLiteral("propstat"));
+    xml.writeStartElement(davUri, QStringLiteral("prop"));
+
+    if (fileInfo.isDir) {
+        xml.writeStartElement(davUri, QStringLiteral("resourcetype"));
+        xml.writeEmptyElement(davUri, QStringLiteral("collection"));
+        xml.writeEndElement(); // resourcetype
+    } else
+        xml.writeEmptyElement(davUri, QStringLiteral("resourcetype"));
+
+    auto gmtDate = fileInfo.lastModified.toUTC();
+    auto stringDate = QLocale::c().toString(gmtDate, QStringLiteral("ddd, dd MMM yyyy HH:mm:ss 'GMT'"));
+    xml.writeTextElement(davUri, QStringLiteral("getlastmodified"), stringDate);
+    xml.writeTextElement(davUri, QStringLiteral("getcontentlength"), QString::number(fileInfo.size));
+    xml.writeTextElement(davUri, QStringLiteral("getetag"), QStringLiteral("\"%1\"").arg(QString::fromLatin1(fileInfo.etag)));
+    xml.writeTextElement(ocUri, QStringLiteral("permissions"), !fileInfo.permissions.isNull() ? QString(fileInfo.permissions.toString()) : fileInfo.isShared ? QStringLiteral("SRDNVCKW")
+                                                                                                                                                             : QStringLiteral("RDNVCKW"));
+    xml.writeTextElement(ocUri, QStringLiteral("id"), QString::fromUtf8(fileInfo.fileId));
+    xml.writeTextElement(ocUri, QStringLiteral("checksums"), QString::fromUtf8(fileInfo.checksums));
+    if (!syncToken.isEmpty())
+        xml.writeTextElement(davUri, QStringLiteral("sync-token"), QString::fromUtf8(syncToken));
+    xml.device()->write(fileInfo.extraDavProperties);
+    xml.writeEndElement(); // prop
+    xml.writeTextElement(davUri, QStringLiteral("status"), QStringLiteral("HTTP/1.1 200 OK"));
+    xml.writeEndElement(); // propstat
+    xml.writeEndElement(); // response
+}
+
 void FakePropfindReply::respond()
 {
     setHeader(QNetworkRequest::ContentLengthHeader, payload.size());
@@ -392,6 +408,56 @@ qint64 FakePropfindReply::readData(char *data, qint64 maxlen)
     return len;
 }
 
+FakeSyncCollectionReply::FakeSyncCollectionReply(const FileInfo &oldState, const FileInfo &remoteRootFileInfo, const QByteArray &newSyncToken,
+    QNetworkAccessManager::Operation op, const QNetworkRequest &request, QObject *parent)
+    : FakePropfindReply { op, request, parent }
+{
+    const QString fileName = getFilePathFromUrl(request.url());
+    Q_ASSERT(fileName.isEmpty()); // only the root has a sync-token
+    const QString prefix = request.url().path();
+
+    QHash<QString, const FileInfo *> oldFiles;
+    std::function<void(const FileInfo &)> collect = [&](const FileInfo &dir) {
+        for (const auto &child : dir.children) {
+            oldFiles.insert(child.path(), &child);
+            collect(child);
+        }
+    };
+    collect(oldState);
+
+    QBuffer buffer { &payload };
+    buffer.open(QIODevice::WriteOnly);
+    QXmlStreamWriter xml(&buffer);
+    const QString davUri { QStringLiteral("DAV:") };
+    xml.writeNamespace(davUri, QStringLiteral("d"));
+    xml.writeNamespace(QStringLiteral("http://owncloud.org/ns"), QStringLiteral("oc"));
+    xml.writeStartDocument();
+    xml.writeStartElement(davUri, QStringLiteral("multistatus"));
+
+    // New and changed entries, everything left in oldFiles was removed
+    std::function<void(const FileInfo &)> writeChanges = [&](const FileInfo &dir) {
+        for (const auto &child : dir.children) {
+            const FileInfo *old = oldFiles.take(child.path());
+            if (!old || old->etag != child.etag || old->fileId != child.fileId || old->isDir != child.isDir)
+                writeFileResponse(xml, prefix, child);
+            writeChanges(child);
+        }
+    };
+    writeChanges(remoteRootFileInfo);
+    for (auto it = oldFiles.cbegin(); it != oldFiles.cend(); ++it) {
+        xml.writeStartElement(davUri, QStringLiteral("response"));
+        const auto href = OCC::Utility::concatUrlPath(prefix, QString::fromUtf8(QUrl::toPercentEncoding(it.value()->absolutePath(), "/"))).path();
+        xml.writeTextElement(davUri, QStringLiteral("href"), href);
+        xml.writeTextElement(davUri, QStringLiteral("status"), QStringLiteral("HTTP/1.1 404 Not Found"));
+        xml.writeEndElement(); // response
+    }
+    xml.writeTextElement(davUri, QStringLiteral("sync-token"), QString::fromUtf8(newSyncToken));
+    xml.writeEndElement(); // multistatus
+    xml.writeEndDocument();
+
+    QMetaObject::invokeMethod(this, "respond", Qt::QueuedConnection);
+}
+
 FakePutReply::FakePutReply(FileInfo &remoteRootFileInfo, QNetworkAccessManager::Operation op, const QNetworkRequest &request, const QByteArray &putPayload, QObject *parent)
     : FakeReply { parent }
 {
@@ -857,9 +923,27 @@ QNetworkReply *FakeQNAM::createRequest(QNetworkAccessManager::Operation op, cons
         FileInfo &info = isUpload ? _uploadFileInfo : _remoteRootFileInfo;
 
         auto verb = newRequest.attribute(QNetworkRequest::CustomVerbAttribute);
-        if (verb == QLatin1String("PROPFIND"))
+        if (verb == QLatin1String("PROPFIND")) {
             // Ignore outgoingData always returning somethign good enough, works for now.
-            reply = new FakePropfindReply { info, op, newRequest, this };
+            QByteArray syncToken;
+            if (_syncCollectionSupport && !isUpload && getFilePathFromUrl(newRequest.url()).isEmpty()) {
+                syncToken = QByteArrayLiteral("http://example.com/sync/") + QByteArray::number(_syncTokenStates.size() + 1);
+                _syncTokenStates.insert(syncToken, _remoteRootFileInfo);
+            }
+            reply = new FakePropfindReply { info, op, newRequest, this, syncToken };
+        } else if (verb == QLatin1String("REPORT") && _syncCollectionSupport) {
+            const auto body = outgoingData->readAll();
+            const int tokenStart = body.indexOf("<d:sync-token>") + int(qstrlen("<d:sync-token>"));
+            const QByteArray syncToken = body.mid(tokenStart, body.indexOf("</d:sync-token>") - tokenStart);
+            if (!_syncTokenStates.contains(syncToken)) {
+                // RFC 6578: valid-sync-token precondition failed
+                reply = new FakeErrorReply { op, newRequest, this, 403 };
+            } else {
+                const QByteArray newSyncToken = QByteArrayLiteral("http://example.com/sync/") + QByteArray::number(_syncTokenStates.size() + 1);
+                _syncTokenStates.insert(newSyncToken, _remoteRootFileInfo);
+                reply = new FakeSyncCollectionReply { _syncTokenStates.value(syncToken), _remoteRootFileInfo, newSyncToken, op, newRequest, this };
+            }
+        }
         else if (verb == QLatin1String("GET") || op == QNetworkAccessManager::GetOperation)
             reply = new FakeGetReply { info, op, newRequest, this };
         else if (verb == QLatin1String("PUT") || op == QNetworkAccessManager::PutOperation)
@@ -24,6 +24,7 @@
 #include <QtTest>
 #include <cookiejar.h>
 #include <QTimer>
+#include <QXmlStreamWriter>
 
 /*
  * TODO: In theory we should use QVERIFY instead of Q_ASSERT for testing, but this
@@ -216,9 +217,10 @@ class FakePropfindReply : public FakeReply
 public:
     QByteArray payload;
 
-    FakePropfindReply(FileInfo &remoteRootFileInfo, QNetworkAccessManager::Operation op, const QNetworkRequest &request, QObject *parent);
+    /// The root listing also has the sync-token if one is given
+    FakePropfindReply(FileInfo &remoteRootFileInfo, QNetworkAccessManager::Operation op, const QNetworkRequest &request, QObject *parent, const QByteArray &syncToken = QByteArray());
 
-    Q_INVOKABLE void respond();
+    Q_INVOKABLE virtual void respond();
 
     Q_INVOKABLE void respond404();
 
@@ -226,6 +228,21 @@ public:
 
     qint64 bytesAvailable() const override;
     qint64 readData(char *data, qint64 maxlen) override;
+
+protected:
+    /// Leaves the payload to the subclass
+    FakePropfindReply(QNetworkAccessManager::Operation op, const QNetworkRequest &request, QObject *parent);
+
+    static void writeFileResponse(QXmlStreamWriter &xml, const QString &prefix, const FileInfo &fileInfo, const QByteArray &syncToken = QByteArray());
+};
+
+/// Answers a sync-collection REPORT with the differences between two states
+class FakeSyncCollectionReply : public FakePropfindReply
+{
+    Q_OBJECT
+public:
+    FakeSyncCollectionReply(const FileInfo &oldState, const FileInfo &remoteRootFileInfo, const QByteArray &newSyncToken,
+        QNetworkAccessManager::Operation op, const QNetworkRequest &request, QObject *parent);
 };
 
 class FakePutReply : public FakeReply
@@ -426,6 +443,9 @@ private:
     QHash<QString, int> _errorPaths;
     // monitor requests and optionally provide custom replies
     Override _override;
+    // the remote states handed out as sync-tokens, see setSyncCollectionSupport()
+    bool _syncCollectionSupport = false;
+    QMap<QByteArray, FileInfo> _syncTokenStates;
 
 public:
     FakeQNAM(FileInfo initialRoot);
@@ -436,6 +456,9 @@ public:
 
     void setOverride(const Override &override) { _override = override; }
 
+    /// Makes the root PROPFIND report a sync-token and answers sync-collection REPORTs
+    void setSyncCollectionSupport(bool enabled) { _syncCollectionSupport = enabled; }
+
 protected:
     QNetworkReply *createRequest(Operation op, const QNetworkRequest &request,
         QIODevice *outgoingData = nullptr) override;
@@ -500,6 +523,7 @@ public:
     };
     ErrorList serverErrorPaths() { return { _fakeQnam }; }
     void setServerOverride(const FakeQNAM::Override &override) { _fakeQnam->setOverride(override); }
+    void setServerSyncCollectionSupport(bool enabled) { _fakeQnam->setSyncCollectionSupport(enabled); }
 
     QString localPath() const;
 
@@ -272,6 +272,130 @@ private slots:
         QVERIFY(!_success);
     }
 
+    void testParserIncremental() {
+        const QByteArray testXml = "<?xml version='1.0' encoding='utf-8'?>"
+              "<d:multistatus xmlns:d=\"DAV:\" xmlns:s=\"http://sabredav.org/ns\" xmlns:oc=\"http://owncloud.org/ns\">"
+              "<d:response>"
+              "<d:href>/oc/remote.php/webdav/sharefolder/</d:href>"
+              "<d:propstat>"
+              "<d:prop>"
+              "<oc:id>00004213ocobzus5kn6s</oc:id>"
+              "<oc:size>121780</oc:size>"
+              "<d:getetag>\"5527beb0400b0\"</d:getetag>"
+              "<d:resourcetype>"
+              "<d:collection/>"
+              "</d:resourcetype>"
+              "</d:prop>"
+              "<d:status>HTTP/1.1 200 OK</d:status>"
+              "</d:propstat>"
+              "</d:response>"
+              "<d:response>"
+              "<d:href>/oc/remote.php/webdav/sharefolder/quitte.pdf</d:href>"
+              "<d:propstat>"
+              "<d:prop>"
+              "<oc:id>00004215ocobzus5kn6s</oc:id>"
+              "<d:getetag>\"2fa2f0d9ed49ea0c3e409d49e652dea0\"</d:getetag>"
+              "<d:resourcetype/>"
+              "<d:getcontentlength>121780</d:getcontentlength>"
+              "</d:prop>"
+              "<d:status>HTTP/1.1 200 OK</d:status>"
+              "</d:propstat>"
+              "</d:response>"
+              "</d:multistatus>";
+
+        LsColXMLParser parser;
+
+        connect(&parser, &LsColXMLParser::directoryListingSubfolders,
+            this, &TestXmlParse::slotDirectoryListingSubFolders);
+        QMap<QString, QString> lastProperties;
+        connect(&parser, &LsColXMLParser::directoryListingIterated,
+            this, [&](const QString &item, const QMap<QString, QString> &properties) {
+                _items.append(item);
+                lastProperties = properties;
+            });
+        connect(&parser, &LsColXMLParser::finishedWithoutError,
+            this, &TestXmlParse::slotFinishedSuccessfully);
+
+        QHash <QString, qint64> sizes;
+        parser.begin(&sizes, "/oc/remote.php/webdav/sharefolder");
+
+        // Feed the data in small chunks, splitting elements and text
+        const int firstResponseEnd = testXml.indexOf("</d:response>") + 13;
+        const int secondResponseEnd = testXml.lastIndexOf("</d:response>") + 13;
+        for (int pos = 0; pos < testXml.size(); pos += 7) {
+            QVERIFY(parser.addData(testXml.mid(pos, 7)));
+            // A response is reported as soon as it is complete
+            const int received = pos + 7;
+            QCOMPARE(_items.size(), received >= secondResponseEnd ? 2 : received >= firstResponseEnd ? 1 : 0);
+        }
+        QVERIFY(!_success);
+        QVERIFY(parser.finish());
+        QVERIFY(_success);
+
+        QCOMPARE(_items, QStringList({ "/oc/remote.php/webdav/sharefolder", "/oc/remote.php/webdav/sharefolder/quitte.pdf" }));
+        QCOMPARE(lastProperties.value("getcontentlength"), QString("121780"));
+        QCOMPARE(lastProperties.value("getetag"), QString("\"2fa2f0d9ed49ea0c3e409d49e652dea0\""));
+        QCOMPARE(sizes.value("/oc/remote.php/webdav/sharefolder/"), Q_INT64_C(121780));
+        QCOMPARE(_subdirs, QStringList("/oc/remote.php/webdav/sharefolder/"));
+    }
+
+    void testParserTyped() {
+        const QByteArray testXml = "<?xml version='1.0' encoding='utf-8'?>"
+              "<d:multistatus xmlns:d=\"DAV:\" xmlns:s=\"http://sabredav.org/ns\" xmlns:oc=\"http://owncloud.org/ns\">"
+              "<d:response>"
+              "<d:href>/oc/remote.php/webdav/sharefolder/quitte.pdf</d:href>"
+              "<d:propstat>"
+              "<d:prop>"
+              "<oc:id>00004215ocobzus5kn6s</oc:id>"
+              "<oc:permissions>RDNVW</oc:permissions>"
+              "<d:getetag>\"2fa2f0d9ed49ea0c3e409d49e652dea0\"</d:getetag>"
+              "<d:resourcetype/>"
+              "<d:getlastmodified>Fri, 06 Feb 2015 13:49:55 GMT</d:getlastmodified>"
+              "<d:getcontentlength>121780</d:getcontentlength>"
+              "<oc:unknown><oc:nested>x</oc:nested></oc:unknown>"
+              "</d:prop>"
+              "<d:status>HTTP/1.1 200 OK</d:status>"
+              "</d:propstat>"
+              "<d:propstat>"
+              "<d:prop>"
+              "<oc:downloadURL/>"
+              "<oc:dDC/>"
+              "</d:prop>"
+              "<d:status>HTTP/1.1 404 Not Found</d:status>"
+              "</d:propstat>"
+              "</d:response>"
+              "</d:multistatus>";
+
+        LsColXMLParser parser;
+        connect(&parser, &LsColXMLParser::directoryListingIterated,
+            this, &TestXmlParse::slotDirectoryListingIterated);
+        connect(&parser, &LsColXMLParser::finishedWithoutError,
+            this, &TestXmlParse::slotFinishedSuccessfully);
+
+        int responses = 0;
+        parser.setTypedResultHandler([&](const QString &href, const LsColProperties &properties) {
+            ++responses;
+            QCOMPARE(href, QString("/oc/remote.php/webdav/sharefolder/quitte.pdf"));
+            QVERIFY(properties.contains(LsColProperty::Id));
+            QCOMPARE(properties.value(LsColProperty::Id), QString("00004215ocobzus5kn6s"));
+            QCOMPARE(properties.value(LsColProperty::Permissions), QString("RDNVW"));
+            QCOMPARE(properties.value(LsColProperty::GetContentLength), QString("121780"));
+            QCOMPARE(properties.value(LsColProperty::GetLastModified), QString("Fri, 06 Feb 2015 13:49:55 GMT"));
+            QVERIFY(properties.contains(LsColProperty::ResourceType));
+            QVERIFY(properties.value(LsColProperty::ResourceType).isEmpty());
+            // Only properties with a 200 status are reported
+            QVERIFY(!properties.contains(LsColProperty::DownloadUrl));
+            QVERIFY(!properties.contains(LsColProperty::DownloadCookies));
+        });
+
+        QHash <QString, qint64> sizes;
+        QVERIFY(parser.parse(testXml, &sizes, "/oc/remote.php/webdav/sharefolder"));
+        QVERIFY(_success);
+        QCOMPARE(responses, 1);
+        // The typed path replaces the map based signal
+        QVERIFY(_items.isEmpty());
+    }
+
     void testParserBogfusHref1() {
         const QByteArray testXml = "<?xml version='1.0' encoding='utf-8'?>"
               "<d:multistatus xmlns:d=\"DAV:\" xmlns:s=\"http://sabredav.org/ns\" xmlns:oc=\"http://owncloud.org/ns\">"